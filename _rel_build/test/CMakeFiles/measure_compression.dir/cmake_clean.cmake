@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/measure_compression.dir/measure_compression.cpp.o"
+  "CMakeFiles/measure_compression.dir/measure_compression.cpp.o.d"
+  "measure_compression"
+  "measure_compression.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/measure_compression.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/measure_performance.dir/measure_performance.cpp.o"
+  "CMakeFiles/measure_performance.dir/measure_performance.cpp.o.d"
+  "measure_performance"
+  "measure_performance.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/measure_performance.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
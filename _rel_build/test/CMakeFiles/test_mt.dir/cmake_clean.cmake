@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/test_mt.dir/test_mt.cpp.o"
+  "CMakeFiles/test_mt.dir/test_mt.cpp.o.d"
+  "test_mt"
+  "test_mt.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang CXX)
+  include(CMakeFiles/test_mt.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,10 @@
+# CMake generated Testfile for 
+# Source directory: /root/repo/test
+# Build directory: /root/repo/_rel_build/test
+# 
+# This file includes the relevant testing commands required for 
+# testing this directory and lists subdirectories to be tested as well.
+add_test(test_st "/root/repo/_rel_build/test/test_st")
+set_tests_properties(test_st PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/test/CMakeLists.txt;109;add_test;/root/repo/test/CMakeLists.txt;0;")
+add_test(test_mt "/root/repo/_rel_build/test/test_mt")
+set_tests_properties(test_mt PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/test/CMakeLists.txt;110;add_test;/root/repo/test/CMakeLists.txt;0;")
@@ -17,308 +17,713 @@
 #pragma once
 
 #include <type_traits>
+#include <algorithm>
 #include <thread>
 #include <memory>
 #include <cassert>
 #include <cstdint>
 #include <atomic>
 #include <bit>
+#include <chrono>
+#include <climits>
+#include <coroutine>
+#include <cstring>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+
+#if defined( __x86_64__ )
+#include <immintrin.h>
+#endif
+#if defined( __linux__ )
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 
 namespace jps {
 
-template<typename W>
-struct _reentrant_lock_free_bit_allocator {
-    using WordT = W;
-
-    static constexpr uint8_t bits_per_byte = 8;
-    static constexpr size_t bytes_per_word = sizeof( WordT );
-    static constexpr uint8_t bits_per_word = bits_per_byte*bytes_per_word;
-
-    constexpr _reentrant_lock_free_bit_allocator() {}
-    constexpr _reentrant_lock_free_bit_allocator& operator=( const W bitset ) {
-        bitmap_[0] = bitset;
-        return *this;
-    }
-
-    [[nodiscard]] size_t alloc( size_t len, size_t start_pos = 0, size_t end_pos = bits_per_word,
-                                std::memory_order mo = std::memory_order::acquire ) noexcept {
+/**
+ * The operations a recorder of a `serialized_bit_allocator` gets notified about.
+ */
+enum class trace_op : uint8_t {
+    alloc = 0,
+    free = 1,
+};
 
-        do {
-            // find a free range
-            start_pos = find_unset_range( start_pos, end_pos, len, mo );
+/**
+ * The default recorder, which records nothing.
+ */
+struct no_recorder {
+    static constexpr void record( trace_op, size_t, size_t ) noexcept {}
+};
 
-            if( start_pos + len > end_pos )
-                return end_pos;
+/**
+ * The reasons an allocation may fail.
+ */
+enum class alloc_status : uint8_t {
+    success = 0,
+    full,           // there is no free range of the requested length
+    contended,      // free ranges were found, but other threads claimed them first in each of the attempts
+};
 
-            // try to allocate it
-            const auto first_word = _which_word( start_pos );
-            const auto start_bit_in_word = _which_bit_in_word( start_pos );
-            const auto last_word = _which_word( start_pos + len - 1 );
-            const auto last_bit_in_word = _which_bit_in_word( start_pos + len - 1 );
+struct alloc_result {
+    size_t pos;
+    alloc_status status;
+};
 
-            // just alter one word
-            if( first_word == last_word ) {
-                const auto mask = get_mask( start_bit_in_word, last_bit_in_word );
+/**
+ * Pause the CPU in a spin-wait loop, so the sibling hyper-thread and the memory subsystem get a breather.
+ */
+inline void _cpu_relax() noexcept {
+#if defined( __x86_64__ ) || defined( __i386__ )
+    __builtin_ia32_pause();
+#elif defined( __aarch64__ )
+    asm volatile( "yield" );
+#endif
+}
 
-                const auto prev = bitmap_[first_word].fetch_or( mask, mo );
+/**
+ * Block while `a` holds `old`, but at most for `timeout` (`nanoseconds::max()` blocks without a timeout). Like
+ * `std::atomic::wait`, this may return spuriously.
+ *
+ * On Linux, this is a futex wait on the word itself, which other than `std::atomic::wait` supports a timeout.
+ * Elsewhere, a timed wait degrades to polling with short sleeps.
+ */
+inline void _wait_for( const std::atomic<uint32_t>& a, uint32_t old, std::chrono::nanoseconds timeout ) noexcept {
+#if defined( __linux__ )
+    static_assert( sizeof( std::atomic<uint32_t> ) == sizeof( uint32_t ));
+    if( timeout == std::chrono::nanoseconds::max() )
+        syscall( SYS_futex, &a, FUTEX_WAIT, old, nullptr, nullptr, 0 );
+    else {
+        const timespec ts{ time_t( timeout.count()/1000000000 ), long( timeout.count()%1000000000 ) };
+        syscall( SYS_futex, &a, FUTEX_WAIT, old, &ts, nullptr, 0 );
+    }
+#else
+    if( timeout == std::chrono::nanoseconds::max() )
+        a.wait( old, std::memory_order::acquire );
+    else
+        std::this_thread::sleep_for( std::min<std::chrono::nanoseconds>( timeout, std::chrono::microseconds( 50 )));
+#endif
+}
 
-                if(( prev & mask ) == WordT( 0 ))
-                    return start_pos;
+/**
+ * Wake all threads blocked in `_wait_for` on `a`.
+ */
+inline void _wake_all( std::atomic<uint32_t>& a ) noexcept {
+#if defined( __linux__ )
+    syscall( SYS_futex, &a, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0 );
+#else
+    a.notify_all();
+#endif
+}
 
-                // on failure, rollback and try another range
-                bitmap_[first_word].fetch_and( ~mask | ( prev & mask ), mo);
-            }
+/**
+ * A word of 128 bits for the lock-free backend, so ranges of up to 128 bits are claimed in a single atomic operation.
+ * Its bits are counted in halves, see `_countl_zero`.
+ */
+__extension__ typedef unsigned __int128 uint128_t;
 
-                // altering multiple words required
-            else {
-                size_t w;
-                WordT tmp;
-                const WordT mask_first = ( WordT( ~WordT( 0 )) >> start_bit_in_word );
-                const WordT mask_last = ( WordT( ~WordT( 0 )) << ( bits_per_word - last_bit_in_word - 1 ));
-
-                WordT prev_first;
-                WordT prev_last;
-
-                // alter first word: bits range to the least significant bit
-                {
-                    prev_first = bitmap_[first_word].fetch_or( mask_first, mo );
-                    if(( prev_first & mask_first ) != WordT( 0 ))
-                        goto rollback_first;
-                }
+/*
+ * The bit counting of the scans. A word of 128 bits is counted as two halves of 64 bits, each with a single
+ * instruction, where the second half is only looked at if the first one does not decide the count.
+ */
 
-                // alter mid-range words: they shall all be zero and be set to ~0
-                {
-                    w = first_word + 1;
-                    for( ; w < last_word; ++w ) {
-                        auto prev = bitmap_[w].fetch_or( ~WordT( 0 ), mo );
-
-                        // rollback on failure
-                        if( prev != 0 ) {
-                            bitmap_[w--].fetch_and( prev, mo );
-                            break;
-                        }
-                    }
-                    if( w < last_word )
-                        goto rollback_mid;
-                }
+template<typename W>
+constexpr int _countl_zero( W w ) noexcept {
+    if constexpr( sizeof( W ) > sizeof( uint64_t )) {
+        const auto hi = uint64_t( w >> 64 );
+        return hi != 0 ? std::countl_zero( hi ) : 64 + std::countl_zero( uint64_t( w ));
+    } else
+        return std::countl_zero( w );
+}
+template<typename W>
+constexpr int _countr_zero( W w ) noexcept {
+    if constexpr( sizeof( W ) > sizeof( uint64_t )) {
+        const auto lo = uint64_t( w );
+        return lo != 0 ? std::countr_zero( lo ) : 64 + std::countr_zero( uint64_t( w >> 64 ));
+    } else
+        return std::countr_zero( w );
+}
+template<typename W>
+constexpr int _countl_one( W w ) noexcept {
+    return _countl_zero( W( ~w ));
+}
+template<typename W>
+constexpr int _countr_one( W w ) noexcept {
+    return _countr_zero( W( ~w ));
+}
+template<typename W>
+constexpr int _popcount( W w ) noexcept {
+    if constexpr( sizeof( W ) > sizeof( uint64_t ))
+        return std::popcount( uint64_t( w )) + std::popcount( uint64_t( w >> 64 ));
+    else
+        return std::popcount( w );
+}
 
-                // now care for the last word
-                {
-                    prev_last = bitmap_[last_word].fetch_or( mask_last, mo );
+/**
+ * The atomic type of the words of `_reentrant_lock_free_bit_allocator`.
+ */
+template<typename W>
+struct _atomic_word {
+    using type = std::atomic<W>;
+};
 
-                    // on success, return the location of the range
-                    if(( prev_last & mask_last ) == WordT( 0 ))
-                        return start_pos;
-                }
+#if defined( __x86_64__ )
+/**
+ * An atomic word of 128 bits on x86-64, built on `cmpxchg16b`, which `std::atomic` only provides through libatomic,
+ * and with locks. All modifications are compare-and-swap loops. The locked `cmpxchg16b` is a full barrier, so they
+ * are sequentially consistent whatever memory order is passed.
+ *
+ * Loads are single 16-byte loads on CPUs with AVX, where aligned ones are atomic. Elsewhere, a load is a
+ * `cmpxchg16b` as well, which needs the word to be writable and takes the cache line exclusively, so scans are
+ * slower there, but neither they nor `snapshot()` ever see a torn word.
+ */
+struct _atomic_uint128 {
+    static constexpr bool is_always_lock_free = true;
 
-            [[maybe_unused]] rollback_last:
-                // get the mask of the bits to keep
-                tmp = WordT( ~mask_last ) | ( prev_last & mask_last );
+    _atomic_uint128& operator=( uint128_t v ) noexcept {
+        store( v );
+        return *this;
+    }
 
-                // zero out the bits we have to rollback. track the bits we actually reset in *tmp*
-                tmp = WordT( ~tmp ) & bitmap_[last_word].fetch_and( tmp, mo );
+    [[nodiscard]] uint128_t load( [[maybe_unused]] std::memory_order mo = std::memory_order::seq_cst ) const noexcept {
+#if defined( __AVX__ )
+        const auto v = _mm_load_si128( reinterpret_cast<const __m128i*>( &value_ ));
+        std::atomic_signal_fence( mo );
+        return uint128_t( uint64_t( _mm_extract_epi64( v, 1 ))) << 64 | uint64_t( _mm_cvtsi128_si64( v ));
+#else
+        // exchange 0 for 0, which leaves the word as it is, but reads it atomically
+        auto expected = uint128_t( 0 );
+        const_cast<_atomic_uint128*>( this )->_cas( expected, 0 );
+        return expected;
+#endif
+    }
+    void store( uint128_t v, [[maybe_unused]] std::memory_order mo = std::memory_order::seq_cst ) noexcept {
+        auto expected = load( std::memory_order::relaxed );
+        while( !_cas( expected, v ))
+            ;
+    }
+    bool compare_exchange_weak( uint128_t& expected, uint128_t desired,
+                                [[maybe_unused]] std::memory_order mo = std::memory_order::seq_cst ) noexcept {
+        return _cas( expected, desired );
+    }
+    bool compare_exchange_strong( uint128_t& expected, uint128_t desired,
+                                  [[maybe_unused]] std::memory_order mo = std::memory_order::seq_cst ) noexcept {
+        return _cas( expected, desired );
+    }
+    uint128_t fetch_or( uint128_t mask, [[maybe_unused]] std::memory_order mo = std::memory_order::seq_cst ) noexcept {
+        auto expected = load( std::memory_order::relaxed );
+        while( !_cas( expected, expected | mask ))
+            ;
+        return expected;
+    }
+    uint128_t fetch_and( uint128_t mask,
+                         [[maybe_unused]] std::memory_order mo = std::memory_order::seq_cst ) noexcept {
+        auto expected = load( std::memory_order::relaxed );
+        while( !_cas( expected, expected & mask ))
+            ;
+        return expected;
+    }
 
-                // check if the bits we rolled back are indeed the ones we had to roll back
-                assert( ( tmp & prev_last ) == 0 );
-                --w;
+private:
+    /**
+     * The locked `cmpxchg16b` is a full barrier, so it serves all memory orders. On failure, `expected` receives the
+     * current value, which was read atomically.
+     */
+    bool _cas( uint128_t& expected, uint128_t desired ) noexcept {
+        auto lo = uint64_t( expected );
+        auto hi = uint64_t( expected >> 64 );
+        bool ok;
+        asm volatile( "lock cmpxchg16b %1"
+                      : "=@ccz"( ok ), "+m"( value_ ), "+a"( lo ), "+d"( hi )
+                      : "b"( uint64_t( desired )), "c"( uint64_t( desired >> 64 ))
+                      : "memory" );
+        expected = uint128_t( hi ) << 64 | lo;
+        return ok;
+    }
+    alignas( 16 ) uint128_t value_;
+};
 
-            rollback_mid:
-                for( ; w > first_word; --w ) {
-                    assert( ( tmp = bitmap_[w].load( std::memory_order::acquire )) == WordT( ~WordT( 0 )));
-                    bitmap_[w].store( 0, std::memory_order::release );
-                }
+template<>
+struct _atomic_word<uint128_t> {
+    using type = _atomic_uint128;
+};
+#endif
 
-            rollback_first:
-                // get the mask of the bits to keep
-                tmp = WordT( ~mask_first ) | ( prev_first & mask_first );
+/**
+ * Wake one thread blocked in `_wait_for` on `a`.
+ */
+inline void _wake_one( std::atomic<uint32_t>& a ) noexcept {
+#if defined( __linux__ )
+    syscall( SYS_futex, &a, FUTEX_WAKE, 1, nullptr, nullptr, 0 );
+#else
+    a.notify_one();
+#endif
+}
 
-                // zero out the bits we have to rollback. track the bits we actually reset in *tmp*
-                tmp = WordT( ~tmp ) & bitmap_[first_word].fetch_and( tmp, mo );
+/**
+ * A mutex of a single futex word, which serializes the backends that are not reentrant. It lives in the buffer of
+ * the allocator, and as the futex is not private to the process, it also serializes processes sharing the buffer.
+ *
+ * The states are 0 for unlocked, 1 for locked, and 2 for locked with possible waiters, so an uncontended unlock
+ * needs no system call. The mutex is not robust: a process dying while holding it leaves it locked.
+ */
+class _futex_mutex {
+public:
+    void lock() noexcept {
+        auto c = _cas( 0, 1 );
+        if( c == 0 )
+            return;
+        do {
+            if( c == 2 || _cas( 1, 2 ) != 0 )
+                _wait_for( state_, 2, std::chrono::nanoseconds::max() );
+        } while(( c = _cas( 0, 2 )) != 0 );
+    }
+    void unlock() noexcept {
+        if( state_.fetch_sub( 1, std::memory_order::release ) != 1 ) {
+            state_.store( 0, std::memory_order::release );
+            _wake_one( state_ );
+        }
+    }
 
-                // check if the bits we rolled back are indeed the ones we had to roll back
-                assert( ( tmp & prev_first ) == 0 );
-            }
-        } while( true );
+private:
+    /**
+     * @return The state before
+     */
+    uint32_t _cas( uint32_t expected, uint32_t desired ) noexcept {
+        state_.compare_exchange_strong( expected, desired, std::memory_order::acquire, std::memory_order::relaxed );
+        return expected;
     }
-    void free( size_t start_pos, size_t len, std::memory_order mo = std::memory_order::release ) noexcept {
-        // try to allocate it
-        const auto start_word = _which_word( start_pos );
-        const auto start_bit_in_word = _which_bit_in_word( start_pos );
-        const auto last_word = _which_word( start_pos + len - 1 );
-        const auto last_bit_in_word = _which_bit_in_word( start_pos + len - 1 );
 
-        // just alter one word
-        if( start_word == last_word ) {
-            const auto mask = get_mask( start_bit_in_word, last_bit_in_word );
+    std::atomic<uint32_t> state_{ 0 };
+};
 
-            bitmap_[start_word].fetch_and( ~mask, mo );
-        }
+/**
+ * The mutex of the reentrant backends, which need none.
+ */
+struct _no_mutex {
+    void lock() noexcept {}
+    void unlock() noexcept {}
+};
 
-        // altering multiple words required
-        else {
-            size_t w;
-            const WordT mask_first = ( WordT( ~WordT( 0 )) >> start_bit_in_word );
-            const WordT mask_last = ( WordT( ~WordT( 0 )) << ( bits_per_word - last_bit_in_word - 1 ));
+/**
+ * The state of the threads waiting in `alloc_wait` and `alloc_drain`, in the header of the allocators that support
+ * waiting.
+ */
+struct _wait_state {
+    std::atomic<uint32_t> generation_{ 0 };   // bumped by free() when there are waiters
+    std::atomic<uint32_t> waiters_{ 0 };      // number of threads in alloc_wait() that found no free range
+    std::atomic<uint32_t> draining_{ 0 };     // set while a thread in alloc_drain() reserves a window
+};
+struct _no_wait_state {};
 
-            // alter first word: bits range to the least significant bit
-            bitmap_[start_word].fetch_and( ~mask_first, mo );
+/**
+ * Spans of at least this many bytes are stored with non-temporal stores, see `_fill_bits`.
+ */
+static constexpr size_t _non_temporal_threshold = size_t( 4 ) << 20;
 
-            // alter mid-range words: they shall all be zero and be set to ~0
-            w = start_word + 1;
-            for( ; w < last_word; ++w )
-                bitmap_[w].store( WordT( 0 ), mo );
+/**
+ * Set or unset all bits of `n` words. Large spans would evict everything else from the caches anyway, so on x86-64,
+ * they bypass them with non-temporal stores.
+ */
+template<typename W>
+inline void _fill_bits( W* words, size_t n, bool set ) noexcept {
+    auto* p = reinterpret_cast<unsigned char*>( words );
+    auto* const end = p + n*sizeof( W );
+    const auto byte = set ? 0xff : 0x00;
+
+#if defined( __x86_64__ )
+    if( n*sizeof( W ) >= _non_temporal_threshold ) {
+        auto* const aligned = reinterpret_cast<unsigned char*>(( reinterpret_cast<uintptr_t>( p ) + 7 ) & ~uintptr_t( 7 ));
+        std::memset( p, byte, size_t( aligned-p ));
+        for( p = aligned; p+8 <= end; p += 8 )
+            _mm_stream_si64( reinterpret_cast<long long*>( p ), set ? -1 : 0 );
+        _mm_sfence();
+    }
+#endif
+    std::memset( p, byte, size_t( end-p ));
+}
 
-            // now care for the last word
-            bitmap_[last_word].fetch_and( ~mask_last, mo );
-        }
+/**
+ * Bitmaps of fewer bytes are split into chunks as well, but the chunks are processed by the calling thread alone, see
+ * `serialized_bit_allocator::_parallel_for`.
+ */
+static constexpr size_t _parallel_threshold = size_t( 1 ) << 20;
+
+/**
+ * The worker threads of the parallel variants, started on first use, one less than the hardware threads, as the
+ * calling thread takes part as well. A job is a number of tasks, claimed one at a time by the calling thread and the
+ * idle workers, so concurrent jobs share the workers rather than oversubscribing the machine. As the calling thread
+ * alone completes a job if need be, a child process forked without the workers still works.
+ */
+class _worker_pool {
+public:
+    static _worker_pool& instance() {
+        static _worker_pool pool;
+        return pool;
     }
-    [[nodiscard]] size_t usage( std::memory_order memory_order = std::memory_order::relaxed ) const noexcept {
-        const auto w = bitmap_[0].load( memory_order );
-        return std::popcount( w );
+    _worker_pool( const _worker_pool& ) = delete;
+    _worker_pool& operator=( const _worker_pool& ) = delete;
+    ~_worker_pool() {
+        {
+            std::lock_guard<std::mutex> lock( mutex_ );
+            stop_ = true;
+        }
+        work_.notify_all();
+        for( auto& t: threads_ )
+            t.join();
     }
 
-    static constexpr bool is_reentrant() { return true; }
-    static constexpr bool throws() { return false; }
-
-protected:
-    /*
-     * Gets a hint for where there might be a first unset bit.
+    /**
+     * Call `f( i )` for each `i` < `n`, and return once all calls returned.
      */
-    [[nodiscard]] size_t find_first_unset( size_t start_pos = 0, size_t end_pos = bits_per_word,
-                                           std::memory_order mo = std::memory_order::acquire ) const {
-        const auto start_word = _which_word( start_pos );
-        auto start_bit_in_word = _which_bit_in_word( start_pos );
+    template<typename F>
+    void run( size_t n, F& f ) {
+        _job j{ n, []( void* f, size_t i ) { ( *static_cast<F*>( f ))( i ); }, &f };
+        if( !threads_.empty() && n > 1 ) {
+            {
+                std::lock_guard<std::mutex> lock( mutex_ );
+                jobs_.push_back( &j );
+            }
+            work_.notify_all();
+        }
+        j.work();
 
-        WordT bits = bitmap_[start_word].load( mo ) << start_bit_in_word;
-        start_bit_in_word += std::countl_one( bits );
-        if( start_bit_in_word < bits_per_word )
-            return bits_per_word*start_word + start_bit_in_word;
+        std::unique_lock<std::mutex> lock( mutex_ );
+        std::erase( jobs_, &j );
+        done_.wait( lock, [&] { return j.active == 0; } );
+    }
 
-        const size_t end_word = _which_word( end_pos );
-        for( size_t w = start_word+1; w < end_word; ++w ) {
-            bits = bitmap_[w].load( mo );
-            if( bits != ~static_cast<WordT>( 0 ) )
-                return w*bits_per_word + std::countl_one( bits );
+private:
+    struct _job {
+        size_t n;
+        void ( *call )( void*, size_t );
+        void* f;
+        std::atomic<size_t> next{ 0 };
+        size_t active = 0; // workers working on the job, guarded by the mutex
+
+        void work() {
+            for( auto i = next.fetch_add( 1, std::memory_order::relaxed ); i < n;
+                 i = next.fetch_add( 1, std::memory_order::relaxed ))
+                call( f, i );
         }
+    };
 
-        return end_pos;
+    _worker_pool() {
+        const auto n = std::max( std::thread::hardware_concurrency(), 1u ) - 1;
+        threads_.reserve( n );
+        for( auto t = 0u; t < n; ++t )
+            threads_.emplace_back( [this] { _worker(); } );
+    }
+    void _worker() {
+        std::unique_lock<std::mutex> lock( mutex_ );
+        for( ;; ) {
+            work_.wait( lock, [this] { return stop_ || !jobs_.empty(); } );
+            if( stop_ )
+                return;
+            auto* j = jobs_.front();
+            // no task left to claim, the calling thread removes the job once its workers are done
+            if( j->next.load( std::memory_order::relaxed ) >= j->n ) {
+                std::erase( jobs_, j );
+                continue;
+            }
+            ++j->active;
+            lock.unlock();
+            j->work();
+            lock.lock();
+            if( --j->active == 0 )
+                done_.notify_all();
+        }
     }
 
-    /*
-     * Gets a hint for where there might be a first set bit.
-     */
-    [[nodiscard]] size_t find_first_set( size_t start_pos = 0, size_t end_pos = bits_per_word,
-                                         std::memory_order mo = std::memory_order::acquire ) const {
-        const auto start_word = _which_word( start_pos );
-        auto start_bit_in_word = _which_bit_in_word( start_pos );
+    std::mutex mutex_;
+    std::condition_variable work_;
+    std::condition_variable done_;
+    std::vector<_job*> jobs_;
+    std::vector<std::thread> threads_;
+    bool stop_ = false;
+};
 
-        WordT bits = bitmap_[start_word].load( mo ) << start_bit_in_word;
-        start_bit_in_word += std::countl_zero( bits );
-        if( start_bit_in_word < bits_per_word )
-            return bits_per_word*start_word + start_bit_in_word;
+/**
+ * A coroutine waiting in `co_alloc` for a range of bits, see `serialized_bit_allocator::co_alloc_awaiter`.
+ */
+struct _co_waiter {
+    _co_waiter* next;
+    const void* allocator;      // the allocator it waits for
+    size_t len;
+    size_t pos;
+    std::memory_order mo;
+    bool ( *alloc )( _co_waiter* ) noexcept;    // allocate `len` bits at `pos`, if there are
+    void ( *resume )( _co_waiter* ) noexcept;
+};
 
-        const size_t end_word = _which_word( end_pos );
-        for( size_t w = start_word+1; w < end_word; ++w ) {
-            bits = bitmap_[w].load( mo );
-            if( bits != static_cast<WordT>( 0 ) )
-                return w*bits_per_word + std::countl_zero( bits );
-        }
+/**
+ * A lock-free list of coroutines waiting in `co_alloc`. The lists are kept in the memory of the process rather than
+ * in the buffers of the allocators, which may be serialized or shared with other processes. The allocators share a
+ * fixed number of lists, chosen by their address, and a drain of a list serves the waiters of all of them.
+ */
+struct alignas( 64 ) _co_waiter_list {
+    static constexpr size_t n_lists = 64;
 
-        return end_pos;
+    static _co_waiter_list& of( const void* allocator ) noexcept {
+        static _co_waiter_list lists[n_lists];
+        return lists[( reinterpret_cast<uintptr_t>( allocator ) >> 6 ) % n_lists];
     }
 
+    /**
+     * Add a suspended coroutine to the list.
+     */
+    void wait( _co_waiter* w ) noexcept {
+        auto head = head_.load( std::memory_order::relaxed );
+        do {
+            w->next = head;
+        } while( !head_.compare_exchange_weak( head, w, std::memory_order::release, std::memory_order::relaxed ));
 
-    [[nodiscard]] size_t find_unset_range( size_t start_pos = 0, size_t end_pos = bits_per_word, size_t len = 1,
-                                           std::memory_order mo = std::memory_order::acquire ) const {
+        // pairs with the fence in free(): either free() sees this waiter, or the drain below sees the freed bits
+        std::atomic_thread_fence( std::memory_order::seq_cst );
+        drain();
+    }
+    /**
+     * Whether bits that were just freed may satisfy a waiter.
+     */
+    bool needs_drain() const noexcept {
+        return drain_requests_.load( std::memory_order::acquire ) != 0 ||
+               head_.load( std::memory_order::acquire ) != nullptr;
+    }
+    /**
+     * Try to satisfy the waiting coroutines, and hand those that got their range to their executors.
+     *
+     * Only one thread drains at a time. Others that free bits or add waiters in the meantime leave a request, and
+     * the draining thread drains once more for them.
+     */
+    void drain() noexcept {
+        if( drain_requests_.fetch_add( 1, std::memory_order::acq_rel ) != 0 )
+            return;
+
+        size_t requests = 1;
         do {
-            // find a possible start
-            start_pos = find_first_unset( start_pos, end_pos, mo );
-            if( start_pos + len > end_pos )
-                return end_pos;
+            // take all waiters, oldest first
+            _co_waiter* waiting = nullptr;
+            for( auto* w = head_.exchange( nullptr, std::memory_order::acquire ); w != nullptr; ) {
+                auto* next = w->next;
+                w->next = waiting;
+                waiting = w;
+                w = next;
+            }
 
-            // see if the range is large enough
-            const auto range_end = find_first_set( start_pos+1, start_pos + len, mo );
-            if( start_pos + len <= range_end )
-                return start_pos;
+            // allocate for all waiters that fit, but do not bother those that are not shorter than a failed one
+            _co_waiter* satisfied = nullptr;
+            _co_waiter** satisfied_end = &satisfied;
+            _co_waiter* remaining = nullptr;
+            _co_waiter* remaining_last = nullptr;
+            const void* failed_allocator = nullptr;
+            auto min_failed_len = ~size_t( 0 );
+            for( auto* w = waiting; w != nullptr; ) {
+                auto* next = w->next;
+                const auto skip = w->allocator == failed_allocator && w->len >= min_failed_len;
+                if( !skip && w->alloc( w )) {
+                    w->next = nullptr;
+                    *satisfied_end = w;
+                    satisfied_end = &w->next;
+                }
+                else {
+                    if( !skip ) {
+                        failed_allocator = w->allocator;
+                        min_failed_len = w->len;
+                    }
+                    w->next = remaining;
+                    remaining = w;
+                    if( remaining_last == nullptr )
+                        remaining_last = w;
+                }
+                w = next;
+            }
 
-            start_pos = range_end+1;
-        } while( start_pos + len <= end_pos );
+            // put back the others before resuming anybody
+            if( remaining != nullptr ) {
+                auto head = head_.load( std::memory_order::relaxed );
+                do {
+                    remaining_last->next = head;
+                } while( !head_.compare_exchange_weak( head, remaining, std::memory_order::release,
+                                                       std::memory_order::relaxed ));
+            }
+            while( satisfied != nullptr ) {
+                auto* next = satisfied->next;
+                satisfied->resume( satisfied );
+                satisfied = next;
+            }
 
-        return end_pos;
+            requests = drain_requests_.fetch_sub( requests, std::memory_order::acq_rel ) - requests;
+        } while( requests != 0 );
     }
 
-    static constexpr WordT get_mask( size_t first_bit, size_t last_bit ) {
-        return
-                WordT( ~WordT( 0 )) >> first_bit &
-                WordT( ~WordT( 0 )) << ( bits_per_word - last_bit - 1 );
-    }
+private:
+    std::atomic<_co_waiter*> head_{ nullptr };     // newest first
+    std::atomic<size_t> drain_requests_{ 0 };
+};
 
+/**
+ * A counter around the changes of a lock-free bitmap that span multiple words, which are the only ones that are not
+ * atomic. `serialized_bit_allocator::snapshot` checks it to tell whether its copy overlapped with such a change, and
+ * can close its gate to hold back new ones.
+ *
+ * The state packs the gate (bit 63), a sequence number that is incremented with each change (bits 32 to 62), and the
+ * number of changes in flight (bits 0 to 31).
+ */
+struct _multi_word_guard {
+    static constexpr uint64_t gate = uint64_t( 1 ) << 63;
+    static constexpr uint64_t seq_one = uint64_t( 1 ) << 32;
+    static constexpr uint64_t in_flight_mask = seq_one-1;
     /**
-     * Return the number of words necessary to store a particular number of bits.
-     * @param end_pos The number of bits
-     * @return The required number of words
+     * Whether the guard holds pointers into the memory of the process, which must not be shared with others.
      */
-    static constexpr size_t _sizeof_array( size_t end_pos ) {
-        return end_pos == 0 ? 0 : _which_word( end_pos-1 )+1;
+    static constexpr bool is_process_local = false;
+
+    void enter() noexcept {
+        auto s = state_.load( std::memory_order::relaxed );
+        do {
+            while( s & gate ) {
+                std::this_thread::yield();
+                s = state_.load( std::memory_order::relaxed );
+            }
+        } while( !state_.compare_exchange_weak( s, ( s + seq_one + 1 ) & ~gate, std::memory_order::relaxed ));
+
+        // the changes to the bitmap shall not become visible before the counter did
+        std::atomic_thread_fence( std::memory_order::release );
+    }
+    void leave() noexcept {
+        state_.fetch_sub( 1, std::memory_order::release );
     }
-    /**
-     * Return the size of a _atomic_bitset array necessary to store a particular number of bits.
-     * @param end_pos The number of bits
-     * @return The required memory usage for the _atomic_bitset array
-     */
-    static constexpr size_t _sizeof( size_t end_pos ) { return sizeof( WordT ) * _sizeof_array( end_pos ); }
 
     /**
-     * Return the index to the word containing a particular bit.
-     * @param pos The bit position
-     * @return The index of the word containing the required bit
+     * Hold back new changes, and wait for those in flight.
      */
-    static constexpr size_t _which_word( size_t pos ) { return pos/bits_per_word; }
-    /**
-     * Return the index in a word containing a particular bit.
-     * @param pos The bit position
-     * @return The index of the bit in the word
-     */
-    static constexpr uint8_t _which_bit_in_word( size_t pos ) { return pos%bits_per_word; }
-    /**
-     * Return the index of the byte in a word containing the required bit.
-     * @param pos The index of the bit
-     * @return The byte index in the word containing this particular bit
-     */
-    static constexpr size_t _which_byte_in_word( size_t pos ) { return _which_bit_in_word( pos )/bits_per_byte; }
+    void close() noexcept {
+        while( state_.fetch_or( gate, std::memory_order::acquire ) & gate )
+            std::this_thread::yield();
+        while( state_.load( std::memory_order::acquire ) & in_flight_mask )
+            std::this_thread::yield();
+    }
+    void open() noexcept {
+        state_.fetch_and( ~gate, std::memory_order::release );
+    }
 
-    union {
-        WordT __bitmap__[1];
-        std::atomic<WordT> bitmap_[1];
+    std::atomic<uint64_t> state_{ 0 };
+};
+
+/**
+ * The `_multi_word_guard` of an allocator whose backend keeps nothing else in its guard. It is kept in the memory of
+ * the process rather than in the buffer of the allocator, so the allocators share a fixed number of guards, chosen by
+ * their address.
+ */
+inline _multi_word_guard& _process_guard( const void* allocator ) noexcept {
+    struct alignas( 64 ) padded_guard {
+        _multi_word_guard guard;
     };
-    static_assert( std::atomic<WordT>::is_always_lock_free );
+    static padded_guard guards[64];
+    return guards[( reinterpret_cast<uintptr_t>( allocator ) >> 6 ) % 64].guard;
+}
+struct _no_guard {};
+
+/*
+ * Backoff policies for the lock-free backend, applied after an attempt to claim a free range failed. A new policy
+ * object is created for each allocation. To choose a policy, pass an alias template as backend, e.g.
+ *
+ *     template<typename W> using backend = jps::_reentrant_lock_free_bit_allocator<W, jps::exponential_backoff>;
+ *     jps::serialized_bit_allocator<uint64_t, backend> ...
+ */
+
+/**
+ * Retry immediately.
+ */
+struct no_backoff {
+    void operator()() noexcept {}
 };
 
-template<typename W>
-struct _single_threaded_bit_allocator {
+/**
+ * Spin with the CPU's pause instruction for a number of iterations that doubles with every failed attempt.
+ */
+template<unsigned max_spins = 1024>
+struct basic_exponential_backoff {
+    void operator()() noexcept {
+        for( auto i = 0u; i < spins_; ++i )
+            _cpu_relax();
+        spins_ = std::min( 2*spins_, max_spins );
+    }
+
+private:
+    unsigned spins_ = 1;
+};
+using exponential_backoff = basic_exponential_backoff<>;
+
+/**
+ * Give up the rest of the time slice.
+ */
+struct yield_backoff {
+    void operator()() noexcept {
+        std::this_thread::yield();
+    }
+};
+
+template<typename W, typename backoff = no_backoff>
+struct _reentrant_lock_free_bit_allocator {
     using WordT = W;
+    using backoff_type = backoff;
+    using guard_type = _multi_word_guard;
 
     static constexpr uint8_t bits_per_byte = 8;
     static constexpr size_t bytes_per_word = sizeof( WordT );
     static constexpr uint8_t bits_per_word = bits_per_byte*bytes_per_word;
 
-    constexpr _single_threaded_bit_allocator() {}
-    constexpr _single_threaded_bit_allocator& operator=( const W bitset ) {
+    constexpr _reentrant_lock_free_bit_allocator() {}
+    constexpr _reentrant_lock_free_bit_allocator& operator=( const W bitset ) {
         bitmap_[0] = bitset;
         return *this;
     }
 
     [[nodiscard]] size_t alloc( size_t len, size_t start_pos = 0, size_t end_pos = bits_per_word,
-                                std::memory_order mo = std::memory_order::acquire ) noexcept {
+                                std::memory_order mo = std::memory_order::acquire,
+                                _multi_word_guard* guard = nullptr ) noexcept {
+        return try_alloc( len, ~size_t( 0 ), start_pos, end_pos, mo, guard ).pos;
+    }
+    /**
+     * Allocate a range of `len` bits, but give up after `max_attempts` failed attempts to claim a range that was
+     * found to be free. The `backoff` policy is applied after each failed attempt.
+     * @return The position of the range and `alloc_status::success`, or `end_pos` and the reason of the failure
+     */
+    [[nodiscard]] alloc_result try_alloc( size_t len, size_t max_attempts, size_t start_pos = 0,
+                                          size_t end_pos = bits_per_word,
+                                          std::memory_order mo = std::memory_order::acquire,
+                                          _multi_word_guard* guard = nullptr ) noexcept {
+        backoff wait;
 
-        // find a free range
-        start_pos = find_unset_range( start_pos, end_pos, len, mo );
+        for( auto attempt = 0ul; attempt < max_attempts; ++attempt ) {
+            // find a free range
+            start_pos = find_unset_range( start_pos, end_pos, len, mo );
 
-        if( start_pos + len > end_pos )
-            return end_pos;
+            if( start_pos + len > end_pos )
+                return { end_pos, alloc_status::full };
 
-        // try to allocate it
+            // try to allocate it
+            if( claim_range( start_pos, len, mo, guard ))
+                return { start_pos, alloc_status::success };
+
+            wait();
+        }
+
+        return { end_pos, alloc_status::contended };
+    }
+    /**
+     * Atomically set the bits of the range [`start_pos`, `start_pos+len`) if all of them are unset. On failure, no
+     * bit is altered. A range within a single word is claimed at once; a range spanning multiple words is claimed
+     * word by word, with transient changes that are rolled back on failure. Those are wrapped by the `guard`, if any.
+     * @return True if the range was claimed
+     */
+    [[nodiscard]] bool claim_range( size_t start_pos, size_t len,
+                                    std::memory_order mo = std::memory_order::acquire,
+                                    _multi_word_guard* guard = nullptr ) noexcept {
         const auto first_word = _which_word( start_pos );
         const auto start_bit_in_word = _which_bit_in_word( start_pos );
         const auto last_word = _which_word( start_pos + len - 1 );
@@ -326,30 +731,101 @@ struct _single_threaded_bit_allocator {
 
         // just alter one word
         if( first_word == last_word ) {
-            bitmap_[first_word] |= get_mask( start_bit_in_word, last_bit_in_word );
-            return start_pos;
+            const auto mask = get_mask( start_bit_in_word, last_bit_in_word );
+
+            // only set the bits if they are all unset, so there is nothing to roll back
+            auto prev = bitmap_[first_word].load( std::memory_order::relaxed );
+            do {
+                if(( prev & mask ) != WordT( 0 ))
+                    return false;
+            } while( !bitmap_[first_word].compare_exchange_weak( prev, prev | mask, mo ));
+
+            return true;
         }
 
             // altering multiple words required
         else {
+            size_t w;
+            WordT tmp;
             const WordT mask_first = ( WordT( ~WordT( 0 )) >> start_bit_in_word );
             const WordT mask_last = ( WordT( ~WordT( 0 )) << ( bits_per_word - last_bit_in_word - 1 ));
 
+            WordT prev_first;
+            WordT prev_last;
+
+            if( guard )
+                guard->enter();
+
             // alter first word: bits range to the least significant bit
-            bitmap_[first_word] |= mask_first;
+            {
+                prev_first = bitmap_[first_word].fetch_or( mask_first, mo );
+                if(( prev_first & mask_first ) != WordT( 0 ))
+                    goto rollback_first;
+            }
 
             // alter mid-range words: they shall all be zero and be set to ~0
-            for( auto w = first_word+1; w < last_word; ++w )
-                bitmap_[w] |= ~WordT( 0 );
+            {
+                w = first_word + 1;
+                for( ; w < last_word; ++w ) {
+                    auto prev = bitmap_[w].fetch_or( ~WordT( 0 ), mo );
+
+                    // rollback on failure
+                    if( prev != 0 ) {
+                        bitmap_[w--].fetch_and( prev, mo );
+                        break;
+                    }
+                }
+                if( w < last_word )
+                    goto rollback_mid;
+            }
 
             // now care for the last word
-            bitmap_[last_word] |= mask_last;
+            {
+                prev_last = bitmap_[last_word].fetch_or( mask_last, mo );
+
+                // on success, the range is ours
+                if(( prev_last & mask_last ) == WordT( 0 )) {
+                    if( guard )
+                        guard->leave();
+                    return true;
+                }
+            }
 
-            return start_pos;
+        [[maybe_unused]] rollback_last:
+            // get the mask of the bits to keep
+            tmp = WordT( ~mask_last ) | ( prev_last & mask_last );
+
+            // zero out the bits we have to rollback. track the bits we actually reset in *tmp*
+            tmp = WordT( ~tmp ) & bitmap_[last_word].fetch_and( tmp, mo );
+
+            // check if the bits we rolled back are indeed the ones we had to roll back
+            assert( ( tmp & prev_last ) == 0 );
+            --w;
+
+        rollback_mid:
+            for( ; w > first_word; --w ) {
+                assert( ( tmp = bitmap_[w].load( std::memory_order::acquire )) == WordT( ~WordT( 0 )));
+                bitmap_[w].store( 0, std::memory_order::release );
+            }
+
+        rollback_first:
+            // get the mask of the bits to keep
+            tmp = WordT( ~mask_first ) | ( prev_first & mask_first );
+
+            // zero out the bits we have to rollback. track the bits we actually reset in *tmp*
+            tmp = WordT( ~tmp ) & bitmap_[first_word].fetch_and( tmp, mo );
+
+            // check if the bits we rolled back are indeed the ones we had to roll back
+            assert( ( tmp & prev_first ) == 0 );
+
+            if( guard )
+                guard->leave();
         }
+
+        return false;
     }
-    void free( size_t start_pos, size_t len,
-               [[maybe_unused]] std::memory_order mo = std::memory_order::release ) noexcept {
+    void free( size_t start_pos, size_t len, std::memory_order mo = std::memory_order::release,
+               _multi_word_guard* guard = nullptr ) noexcept {
         // try to allocate it
         const auto start_word = _which_word( start_pos );
         const auto start_bit_in_word = _which_bit_in_word( start_pos );
@@ -360,52 +836,65 @@ struct _single_threaded_bit_allocator {
         if( start_word == last_word ) {
             const auto mask = get_mask( start_bit_in_word, last_bit_in_word );
 
-            bitmap_[start_word] &= ~mask;
+            bitmap_[start_word].fetch_and( ~mask, mo );
         }
 
         // altering multiple words required
         else {
+            size_t w;
             const WordT mask_first = ( WordT( ~WordT( 0 )) >> start_bit_in_word );
             const WordT mask_last = ( WordT( ~WordT( 0 )) << ( bits_per_word - last_bit_in_word - 1 ));
 
+            if( guard )
+                guard->enter();
+
             // alter first word: bits range to the least significant bit
-            bitmap_[start_word] &= ~mask_first;
+            bitmap_[start_word].fetch_and( ~mask_first, mo );
 
             // alter mid-range words: they shall all be zero and be set to ~0
-            for( auto w = start_word+1; w < last_word; ++w )
-                bitmap_[w] = 0;
+            w = start_word + 1;
+            for( ; w < last_word; ++w )
+                bitmap_[w].store( WordT( 0 ), mo );
 
             // now care for the last word
-            bitmap_[last_word] &= ~mask_last;
+            bitmap_[last_word].fetch_and( ~mask_last, mo );
+
+            if( guard )
+                guard->leave();
         }
     }
-    [[nodiscard]] size_t
-    usage( [[maybe_unused]] std::memory_order memory_order = std::memory_order::relaxed ) const noexcept {
-        return std::popcount( bitmap_[0] );
+    [[nodiscard]] size_t usage( std::memory_order memory_order = std::memory_order::relaxed ) const noexcept {
+        const auto w = bitmap_[0].load( memory_order );
+        return _popcount( w );
+    }
+    [[nodiscard]] WordT load( std::memory_order memory_order = std::memory_order::relaxed ) const noexcept {
+        return bitmap_[0].load( memory_order );
     }
 
-    static constexpr bool is_reentrant() { return false; }
+    static constexpr bool is_reentrant() { return true; }
     static constexpr bool throws() { return false; }
 
-protected:
     /*
      * Gets a hint for where there might be a first unset bit.
      */
     [[nodiscard]] size_t find_first_unset( size_t start_pos = 0, size_t end_pos = bits_per_word,
-                                           [[maybe_unused]] std::memory_order mo = std::memory_order::acquire ) const {
+                                           std::memory_order mo = std::memory_order::acquire ) const {
+        if( start_pos >= end_pos )
+            return end_pos;
+
         const auto start_word = _which_word( start_pos );
         auto start_bit_in_word = _which_bit_in_word( start_pos );
 
-        WordT bits = bitmap_[start_word] << start_bit_in_word;
-        start_bit_in_word += std::countl_one( bits );
+        WordT bits = bitmap_[start_word].load( mo ) << start_bit_in_word;
+        start_bit_in_word += _countl_one( bits );
         if( start_bit_in_word < bits_per_word )
-            return bits_per_word*start_word + start_bit_in_word;
+            return std::min( bits_per_word*start_word + start_bit_in_word, end_pos );
 
-        const size_t end_word = _which_word( end_pos );
+        const size_t end_word = _sizeof_array( end_pos );
         for( size_t w = start_word+1; w < end_word; ++w ) {
-            bits = bitmap_[w];
-            if( bits != ~static_cast<WordT>( 0 ) )
-                return w*bits_per_word + std::countl_one( bits );
+            bits = bitmap_[w].load( mo );
+            if( bits != WordT( ~WordT( 0 )) )
+                return std::min( w*bits_per_word + _countl_one( bits ), end_pos );
         }
 
         return end_pos;
@@ -415,20 +904,23 @@ protected:
      * Gets a hint for where there might be a first set bit.
      */
     [[nodiscard]] size_t find_first_set( size_t start_pos = 0, size_t end_pos = bits_per_word,
-                                         [[maybe_unused]] std::memory_order mo = std::memory_order::acquire ) const {
+                                         std::memory_order mo = std::memory_order::acquire ) const {
+        if( start_pos >= end_pos )
+            return end_pos;
+
         const auto start_word = _which_word( start_pos );
         auto start_bit_in_word = _which_bit_in_word( start_pos );
 
-        WordT bits = bitmap_[start_word] << start_bit_in_word;
-        start_bit_in_word += std::countl_zero( bits );
+        WordT bits = bitmap_[start_word].load( mo ) << start_bit_in_word;
+        start_bit_in_word += _countl_zero( bits );
         if( start_bit_in_word < bits_per_word )
-            return bits_per_word*start_word + start_bit_in_word;
+            return std::min( bits_per_word*start_word + start_bit_in_word, end_pos );
 
-        const size_t end_word = _which_word( end_pos );
+        const size_t end_word = _sizeof_array( end_pos );
         for( size_t w = start_word+1; w < end_word; ++w ) {
-            bits = bitmap_[w];
+            bits = bitmap_[w].load( mo );
             if( bits != static_cast<WordT>( 0 ) )
-                return w*bits_per_word + std::countl_zero( bits );
+                return std::min( w*bits_per_word + _countl_zero( bits ), end_pos );
         }
 
         return end_pos;
@@ -454,6 +946,85 @@ protected:
         return end_pos;
     }
 
+    /*
+     * Gets a hint for where there might be a last unset bit.
+     * @return The position after the last unset bit in [`start_pos`, `end_pos`), or `start_pos` if there is none
+     */
+    [[nodiscard]] size_t find_last_unset( size_t start_pos = 0, size_t end_pos = bits_per_word,
+                                          std::memory_order mo = std::memory_order::acquire ) const {
+        if( start_pos >= end_pos )
+            return start_pos;
+
+        const auto last_word = _which_word( end_pos-1 );
+        const auto last_bit_in_word = _which_bit_in_word( end_pos-1 );
+
+        WordT bits = bitmap_[last_word].load( mo ) >> ( bits_per_word - last_bit_in_word - 1 );
+        const size_t n = _countr_one( bits );
+        if( n <= last_bit_in_word )
+            return std::max( end_pos-n, start_pos );
+
+        const size_t start_word = _which_word( start_pos );
+        for( size_t w = last_word; w-- > start_word; ) {
+            bits = bitmap_[w].load( mo );
+            if( bits != WordT( ~WordT( 0 )) )
+                return std::max(( w+1 )*bits_per_word - _countr_one( bits ), start_pos );
+        }
+
+        return start_pos;
+    }
+
+    /*
+     * Gets a hint for where there might be a last set bit.
+     * @return The position after the last set bit in [`start_pos`, `end_pos`), or `start_pos` if there is none
+     */
+    [[nodiscard]] size_t find_last_set( size_t start_pos = 0, size_t end_pos = bits_per_word,
+                                        std::memory_order mo = std::memory_order::acquire ) const {
+        if( start_pos >= end_pos )
+            return start_pos;
+
+        const auto last_word = _which_word( end_pos-1 );
+        const auto last_bit_in_word = _which_bit_in_word( end_pos-1 );
+
+        WordT bits = bitmap_[last_word].load( mo ) >> ( bits_per_word - last_bit_in_word - 1 );
+        const size_t n = _countr_zero( bits );
+        if( n <= last_bit_in_word )
+            return std::max( end_pos-n, start_pos );
+
+        const size_t start_word = _which_word( start_pos );
+        for( size_t w = last_word; w-- > start_word; ) {
+            bits = bitmap_[w].load( mo );
+            if( bits != static_cast<WordT>( 0 ) )
+                return std::max(( w+1 )*bits_per_word - _countr_zero( bits ), start_pos );
+        }
+
+        return start_pos;
+    }
+
+    /**
+     * Like `find_unset_range`, but return the highest range of `len` unset bits in [`start_pos`, `end_pos`).
+     * @return The position of the range, or `end_pos` if there is none
+     */
+    [[nodiscard]] size_t rfind_unset_range( size_t start_pos = 0, size_t end_pos = bits_per_word, size_t len = 1,
+                                            std::memory_order mo = std::memory_order::acquire ) const {
+        auto range_end = end_pos;
+        while( range_end >= start_pos + len ) {
+            // find a possible end
+            range_end = find_last_unset( start_pos, range_end, mo );
+            if( range_end < start_pos + len )
+                break;
+
+            // see if the range is large enough
+            const auto range_start = find_last_set( range_end-len, range_end-1, mo );
+            if( range_start == range_end-len )
+                return range_start;
+
+            range_end = range_start-1;
+        }
+
+        return end_pos;
+    }
+
+protected:
     static constexpr WordT get_mask( size_t first_bit, size_t last_bit ) {
         return
                 WordT( ~WordT( 0 )) >> first_bit &
@@ -494,79 +1065,1398 @@ protected:
      */
     static constexpr size_t _which_byte_in_word( size_t pos ) { return _which_bit_in_word( pos )/bits_per_byte; }
 
-    WordT bitmap_[1];
+    union {
+        WordT __bitmap__[1];
+        typename _atomic_word<WordT>::type bitmap_[1];
+    };
+    static_assert( _atomic_word<WordT>::type::is_always_lock_free );
 };
 
+template<typename W>
+struct _single_threaded_bit_allocator {
+    using WordT = W;
+    using backoff_type = no_backoff;
+    using guard_type = _multi_word_guard;
 
-/**
- * This datastructure allows the allocation of bits and bitranges in a bitmap concurrently.
- *
- * An object of this type can and should be constructed in-place in a pre-allocated buffer given its size.
- *
- * The access to this data structure is lock-free, reentrant, and does not throw exceptions, when using the
- * proposed `bit_allocator` and `bad_alloc_throws` (default) template parameters.
- *
- */
-template<typename W = uint64_t,
-        template<typename> typename bit_allocator = _reentrant_lock_free_bit_allocator,
-        bool bad_alloc_throws = false>
-struct serialized_bit_allocator {
-private:
-    static constexpr bool alloc_throws = bit_allocator<W>::throws();
-    static constexpr bool alloc_reentrant = bit_allocator<W>::is_reentrant();
+    static constexpr uint8_t bits_per_byte = 8;
+    static constexpr size_t bytes_per_word = sizeof( WordT );
+    static constexpr uint8_t bits_per_word = bits_per_byte*bytes_per_word;
 
-public:
+    constexpr _single_threaded_bit_allocator() {}
+    constexpr _single_threaded_bit_allocator& operator=( const W bitset ) {
+        bitmap_[0] = bitset;
+        return *this;
+    }
 
-    explicit constexpr serialized_bit_allocator( size_t buffer_len = 64 ) :
-            end_pos_(
-                    (       // remaining buffer for the bitmap ...
-                            ( buffer_len-sizeof( serialized_bit_allocator<W> ) + sizeof( bit_allocator_ ) )
-                            // ... rounded down to match full words ...
-                            & ~size_t( bit_allocator<W>::bytes_per_word-1)
-                    )
-                    // ... and scaled to number of bits
-                    *bit_allocator<W>::bits_per_byte
-            )
-    {}
+    /**
+     * The `guard` is ignored, as the accesses are serialized by a mutex anyway.
+     */
+    [[nodiscard]] size_t alloc( size_t len, size_t start_pos = 0, size_t end_pos = bits_per_word,
+                                std::memory_order mo = std::memory_order::acquire,
+                                [[maybe_unused]] _multi_word_guard* guard = nullptr ) noexcept {
 
-    constexpr size_t size() const noexcept {
-        return end_pos_;
-    }
+        // find a free range
+        start_pos = find_unset_range( start_pos, end_pos, len, mo );
 
-    [[nodiscard]] size_t
-    alloc( size_t len, std::memory_order mo = std::memory_order::acquire )
-            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
-        if( bad_alloc_throws ) {
-            if( len == 0 )
-                throw std::bad_alloc();
+        if( start_pos + len > end_pos )
+            return end_pos;
+
+        // try to allocate it
+        const auto first_word = _which_word( start_pos );
+        const auto start_bit_in_word = _which_bit_in_word( start_pos );
+        const auto last_word = _which_word( start_pos + len - 1 );
+        const auto last_bit_in_word = _which_bit_in_word( start_pos + len - 1 );
+
+        // just alter one word
+        if( first_word == last_word ) {
+            bitmap_[first_word] |= get_mask( start_bit_in_word, last_bit_in_word );
+            return start_pos;
         }
+
+            // altering multiple words required
         else {
-            if( len == 0 )
-                return end_pos_;
-        }
+            const WordT mask_first = ( WordT( ~WordT( 0 )) >> start_bit_in_word );
+            const WordT mask_last = ( WordT( ~WordT( 0 )) << ( bits_per_word - last_bit_in_word - 1 ));
 
-        if( !alloc_reentrant )
-            get_global_mutex().lock();
-        auto start_pos = bit_allocator_[0].alloc( len, 0, end_pos_, mo );
-        if( !alloc_reentrant )
-            get_global_mutex().unlock();
+            // alter first word: bits range to the least significant bit
+            bitmap_[first_word] |= mask_first;
 
-        if( bad_alloc_throws ) {
-            if( start_pos == end_pos_ )
-                throw std::bad_alloc();
-        }
+            // alter mid-range words: they shall all be zero and be set to ~0
+            for( auto w = first_word+1; w < last_word; ++w )
+                bitmap_[w] |= ~WordT( 0 );
 
-        return start_pos;
+            // now care for the last word
+            bitmap_[last_word] |= mask_last;
+
+            return start_pos;
+        }
     }
-    void free( size_t start_pos,
-               size_t len,
-               std::memory_order mo = std::memory_order::release )
-            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
-        if( !alloc_reentrant )
-            get_global_mutex().lock();
-        bit_allocator_[0].free( start_pos, len, mo );
+    /**
+     * Set the bits of the range [`start_pos`, `start_pos+len`) if all of them are unset.
+     * @return True if the range was claimed
+     */
+    [[nodiscard]] bool claim_range( size_t start_pos, size_t len,
+                                    std::memory_order mo = std::memory_order::acquire,
+                                    [[maybe_unused]] _multi_word_guard* guard = nullptr ) noexcept {
+        return alloc( len, start_pos, start_pos+len, mo ) == start_pos;
+    }
+    /**
+     * Like `alloc`, as there is no contention to give up on.
+     */
+    [[nodiscard]] alloc_result try_alloc( size_t len, size_t max_attempts, size_t start_pos = 0,
+                                          size_t end_pos = bits_per_word,
+                                          std::memory_order mo = std::memory_order::acquire,
+                                          [[maybe_unused]] _multi_word_guard* guard = nullptr ) noexcept {
+        if( max_attempts == 0 )
+            return { end_pos, alloc_status::contended };
+
+        start_pos = alloc( len, start_pos, end_pos, mo );
+        return { start_pos, start_pos == end_pos ? alloc_status::full : alloc_status::success };
+    }
+    void free( size_t start_pos, size_t len,
+               [[maybe_unused]] std::memory_order mo = std::memory_order::release,
+               [[maybe_unused]] _multi_word_guard* guard = nullptr ) noexcept {
+        // try to allocate it
+        const auto start_word = _which_word( start_pos );
+        const auto start_bit_in_word = _which_bit_in_word( start_pos );
+        const auto last_word = _which_word( start_pos + len - 1 );
+        const auto last_bit_in_word = _which_bit_in_word( start_pos + len - 1 );
+
+        // just alter one word
+        if( start_word == last_word ) {
+            const auto mask = get_mask( start_bit_in_word, last_bit_in_word );
+
+            bitmap_[start_word] &= ~mask;
+        }
+
+        // altering multiple words required
+        else {
+            const WordT mask_first = ( WordT( ~WordT( 0 )) >> start_bit_in_word );
+            const WordT mask_last = ( WordT( ~WordT( 0 )) << ( bits_per_word - last_bit_in_word - 1 ));
+
+            // alter first word: bits range to the least significant bit
+            bitmap_[start_word] &= ~mask_first;
+
+            // alter mid-range words: they shall all be zero and be set to ~0
+            for( auto w = start_word+1; w < last_word; ++w )
+                bitmap_[w] = 0;
+
+            // now care for the last word
+            bitmap_[last_word] &= ~mask_last;
+        }
+    }
+    [[nodiscard]] size_t
+    usage( [[maybe_unused]] std::memory_order memory_order = std::memory_order::relaxed ) const noexcept {
+        return _popcount( bitmap_[0] );
+    }
+    [[nodiscard]] WordT
+    load( [[maybe_unused]] std::memory_order memory_order = std::memory_order::relaxed ) const noexcept {
+        return bitmap_[0];
+    }
+
+    static constexpr bool is_reentrant() { return false; }
+    static constexpr bool throws() { return false; }
+
+    /*
+     * Gets a hint for where there might be a first unset bit.
+     */
+    [[nodiscard]] size_t find_first_unset( size_t start_pos = 0, size_t end_pos = bits_per_word,
+                                           [[maybe_unused]] std::memory_order mo = std::memory_order::acquire ) const {
+        if( start_pos >= end_pos )
+            return end_pos;
+
+        const auto start_word = _which_word( start_pos );
+        auto start_bit_in_word = _which_bit_in_word( start_pos );
+
+        WordT bits = bitmap_[start_word] << start_bit_in_word;
+        start_bit_in_word += _countl_one( bits );
+        if( start_bit_in_word < bits_per_word )
+            return std::min( bits_per_word*start_word + start_bit_in_word, end_pos );
+
+        const size_t end_word = _sizeof_array( end_pos );
+        for( size_t w = start_word+1; w < end_word; ++w ) {
+            bits = bitmap_[w];
+            if( bits != WordT( ~WordT( 0 )) )
+                return std::min( w*bits_per_word + _countl_one( bits ), end_pos );
+        }
+
+        return end_pos;
+    }
+
+    /*
+     * Gets a hint for where there might be a first set bit.
+     */
+    [[nodiscard]] size_t find_first_set( size_t start_pos = 0, size_t end_pos = bits_per_word,
+                                         [[maybe_unused]] std::memory_order mo = std::memory_order::acquire ) const {
+        if( start_pos >= end_pos )
+            return end_pos;
+
+        const auto start_word = _which_word( start_pos );
+        auto start_bit_in_word = _which_bit_in_word( start_pos );
+
+        WordT bits = bitmap_[start_word] << start_bit_in_word;
+        start_bit_in_word += _countl_zero( bits );
+        if( start_bit_in_word < bits_per_word )
+            return std::min( bits_per_word*start_word + start_bit_in_word, end_pos );
+
+        const size_t end_word = _sizeof_array( end_pos );
+        for( size_t w = start_word+1; w < end_word; ++w ) {
+            bits = bitmap_[w];
+            if( bits != static_cast<WordT>( 0 ) )
+                return std::min( w*bits_per_word + _countl_zero( bits ), end_pos );
+        }
+
+        return end_pos;
+    }
+
+
+    [[nodiscard]] size_t find_unset_range( size_t start_pos = 0, size_t end_pos = bits_per_word, size_t len = 1,
+                                           std::memory_order mo = std::memory_order::acquire ) const {
+        do {
+            // find a possible start
+            start_pos = find_first_unset( start_pos, end_pos, mo );
+            if( start_pos + len > end_pos )
+                return end_pos;
+
+            // see if the range is large enough
+            const auto range_end = find_first_set( start_pos+1, start_pos + len, mo );
+            if( start_pos + len <= range_end )
+                return start_pos;
+
+            start_pos = range_end+1;
+        } while( start_pos + len <= end_pos );
+
+        return end_pos;
+    }
+
+    /*
+     * Gets a hint for where there might be a last unset bit.
+     * @return The position after the last unset bit in [`start_pos`, `end_pos`), or `start_pos` if there is none
+     */
+    [[nodiscard]] size_t find_last_unset( size_t start_pos = 0, size_t end_pos = bits_per_word,
+                                          [[maybe_unused]] std::memory_order mo = std::memory_order::acquire ) const {
+        if( start_pos >= end_pos )
+            return start_pos;
+
+        const auto last_word = _which_word( end_pos-1 );
+        const auto last_bit_in_word = _which_bit_in_word( end_pos-1 );
+
+        WordT bits = bitmap_[last_word] >> ( bits_per_word - last_bit_in_word - 1 );
+        const size_t n = _countr_one( bits );
+        if( n <= last_bit_in_word )
+            return std::max( end_pos-n, start_pos );
+
+        const size_t start_word = _which_word( start_pos );
+        for( size_t w = last_word; w-- > start_word; ) {
+            bits = bitmap_[w];
+            if( bits != WordT( ~WordT( 0 )) )
+                return std::max(( w+1 )*bits_per_word - _countr_one( bits ), start_pos );
+        }
+
+        return start_pos;
+    }
+
+    /*
+     * Gets a hint for where there might be a last set bit.
+     * @return The position after the last set bit in [`start_pos`, `end_pos`), or `start_pos` if there is none
+     */
+    [[nodiscard]] size_t find_last_set( size_t start_pos = 0, size_t end_pos = bits_per_word,
+                                        [[maybe_unused]] std::memory_order mo = std::memory_order::acquire ) const {
+        if( start_pos >= end_pos )
+            return start_pos;
+
+        const auto last_word = _which_word( end_pos-1 );
+        const auto last_bit_in_word = _which_bit_in_word( end_pos-1 );
+
+        WordT bits = bitmap_[last_word] >> ( bits_per_word - last_bit_in_word - 1 );
+        const size_t n = _countr_zero( bits );
+        if( n <= last_bit_in_word )
+            return std::max( end_pos-n, start_pos );
+
+        const size_t start_word = _which_word( start_pos );
+        for( size_t w = last_word; w-- > start_word; ) {
+            bits = bitmap_[w];
+            if( bits != static_cast<WordT>( 0 ) )
+                return std::max(( w+1 )*bits_per_word - _countr_zero( bits ), start_pos );
+        }
+
+        return start_pos;
+    }
+
+    /**
+     * Like `find_unset_range`, but return the highest range of `len` unset bits in [`start_pos`, `end_pos`).
+     * @return The position of the range, or `end_pos` if there is none
+     */
+    [[nodiscard]] size_t rfind_unset_range( size_t start_pos = 0, size_t end_pos = bits_per_word, size_t len = 1,
+                                            std::memory_order mo = std::memory_order::acquire ) const {
+        auto range_end = end_pos;
+        while( range_end >= start_pos + len ) {
+            // find a possible end
+            range_end = find_last_unset( start_pos, range_end, mo );
+            if( range_end < start_pos + len )
+                break;
+
+            // see if the range is large enough
+            const auto range_start = find_last_set( range_end-len, range_end-1, mo );
+            if( range_start == range_end-len )
+                return range_start;
+
+            range_end = range_start-1;
+        }
+
+        return end_pos;
+    }
+
+protected:
+    static constexpr WordT get_mask( size_t first_bit, size_t last_bit ) {
+        return
+                WordT( ~WordT( 0 )) >> first_bit &
+                WordT( ~WordT( 0 )) << ( bits_per_word - last_bit - 1 );
+    }
+
+    /**
+     * Return the number of words necessary to store a particular number of bits.
+     * @param end_pos The number of bits
+     * @return The required number of words
+     */
+    static constexpr size_t _sizeof_array( size_t end_pos ) {
+        return end_pos == 0 ? 0 : _which_word( end_pos-1 )+1;
+    }
+    /**
+     * Return the size of a _atomic_bitset array necessary to store a particular number of bits.
+     * @param end_pos The number of bits
+     * @return The required memory usage for the _atomic_bitset array
+     */
+    static constexpr size_t _sizeof( size_t end_pos ) { return sizeof( WordT ) * _sizeof_array( end_pos ); }
+
+    /**
+     * Return the index to the word containing a particular bit.
+     * @param pos The bit position
+     * @return The index of the word containing the required bit
+     */
+    static constexpr size_t _which_word( size_t pos ) { return pos/bits_per_word; }
+    /**
+     * Return the index in a word containing a particular bit.
+     * @param pos The bit position
+     * @return The index of the bit in the word
+     */
+    static constexpr uint8_t _which_bit_in_word( size_t pos ) { return pos%bits_per_word; }
+    /**
+     * Return the index of the byte in a word containing the required bit.
+     * @param pos The index of the bit
+     * @return The byte index in the word containing this particular bit
+     */
+    static constexpr size_t _which_byte_in_word( size_t pos ) { return _which_bit_in_word( pos )/bits_per_byte; }
+
+    WordT bitmap_[1];
+};
+
+
+/**
+ * Claim the ranges returned by `find` until one claim succeeds, `find` returns `end_pos`, or `max_attempts` claims
+ * failed. The backend's `backoff_type` is applied after each failed claim.
+ */
+template<typename BA, typename F>
+alloc_result _claim_found( BA& ba, size_t len, size_t max_attempts, size_t end_pos, std::memory_order mo,
+                           typename BA::guard_type* guard, F find ) noexcept {
+    typename BA::backoff_type wait;
+
+    for( auto attempt = 0ul; attempt < max_attempts; ++attempt ) {
+        const auto start_pos = find();
+        if( start_pos == end_pos )
+            return { end_pos, alloc_status::full };
+
+        if( ba.claim_range( start_pos, len, mo, guard ))
+            return { start_pos, alloc_status::success };
+
+        wait();
+    }
+
+    return { end_pos, alloc_status::contended };
+}
+
+/**
+ * The guard of `_adaptive_bit_allocator`, which also keeps the statistics of the multi-word claims and the lock of
+ * its serialized mode.
+ *
+ * The statistics pack the number of claims in the current window (bits 32 to 63) and the number of those that were
+ * rolled back in lock-free mode, or had to wait for the lock in serialized mode (bits 0 to 31).
+ */
+struct _adaptive_guard : _multi_word_guard {
+    static constexpr uint32_t window = 256;
+    static constexpr uint32_t to_serialized = window/8;     // rollbacks per window to serialize
+    static constexpr uint32_t to_lock_free = window/32;     // waits for the lock per window to go back
+
+    /**
+     * Take the lock of the serialized mode.
+     * @return True if it had to wait for the lock
+     */
+    bool lock() noexcept {
+        auto waited = false;
+        while( locked_.exchange( true, std::memory_order::acquire )) {
+            waited = true;
+            while( locked_.load( std::memory_order::relaxed ))
+                _cpu_relax();
+        }
+        return waited;
+    }
+    void unlock() noexcept {
+        locked_.store( false, std::memory_order::release );
+    }
+
+    /**
+     * Count a multi-word claim, and switch the mode at the end of a window, if the rate of events asks for it.
+     */
+    void count( bool event ) noexcept {
+        const auto stats = stats_.fetch_add( uint64_t( 1 ) << 32 | uint64_t( event ), std::memory_order::relaxed )
+                           + ( uint64_t( 1 ) << 32 | uint64_t( event ));
+        if(( stats >> 32 ) != window )
+            return;
+
+        // the claims counted concurrently with the reset are lost, which does not matter for the statistics
+        stats_.store( 0, std::memory_order::relaxed );
+        const auto events = uint32_t( stats );
+        if( serialized_.load( std::memory_order::relaxed ))
+            serialized_.store( events >= to_lock_free, std::memory_order::relaxed );
+        else
+            serialized_.store( events >= to_serialized, std::memory_order::relaxed );
+    }
+
+    [[nodiscard]] bool serialized() const noexcept {
+        return serialized_.load( std::memory_order::relaxed );
+    }
+
+    std::atomic<uint64_t> stats_{ 0 };
+    std::atomic<bool> serialized_{ false };
+    std::atomic<bool> locked_{ false };
+};
+
+/**
+ * A lock-free backend that adapts to contention. Claims of multiple words roll back when they lose a race, which
+ * gets expensive when many threads allocate ranges of several words. When too many of them roll back, this backend
+ * switches to a serialized mode, where multi-word claims take a lock among each other. When the lock is hardly
+ * contended anymore, it switches back.
+ *
+ * Single-word claims and frees are lock-free in either mode. Claims are atomic in both modes, so threads that see
+ * different modes during a switch are still correct, and switching needs no pause of the other threads.
+ *
+ * The mode and the statistics live in the guard, which `serialized_bit_allocator` keeps in its header. Without a
+ * guard, this backend behaves like `_reentrant_lock_free_bit_allocator`.
+ */
+template<typename W, typename backoff = no_backoff>
+struct _adaptive_bit_allocator : _reentrant_lock_free_bit_allocator<W, backoff> {
+    using base = _reentrant_lock_free_bit_allocator<W, backoff>;
+    using guard_type = _adaptive_guard;
+    using base::operator=;
+
+    [[nodiscard]] size_t alloc( size_t len, size_t start_pos = 0, size_t end_pos = base::bits_per_word,
+                                std::memory_order mo = std::memory_order::acquire,
+                                _adaptive_guard* guard = nullptr ) noexcept {
+        return try_alloc( len, ~size_t( 0 ), start_pos, end_pos, mo, guard ).pos;
+    }
+    [[nodiscard]] alloc_result try_alloc( size_t len, size_t max_attempts, size_t start_pos = 0,
+                                          size_t end_pos = base::bits_per_word,
+                                          std::memory_order mo = std::memory_order::acquire,
+                                          _adaptive_guard* guard = nullptr ) noexcept {
+        backoff wait;
+        for( auto attempt = 0ul; attempt < max_attempts; ++attempt ) {
+            start_pos = this->find_unset_range( start_pos, end_pos, len, mo );
+            if( start_pos + len > end_pos )
+                return { end_pos, alloc_status::full };
+            if( claim_range( start_pos, len, mo, guard ))
+                return { start_pos, alloc_status::success };
+            wait();
+        }
+        return { end_pos, alloc_status::contended };
+    }
+    [[nodiscard]] bool claim_range( size_t start_pos, size_t len,
+                                    std::memory_order mo = std::memory_order::acquire,
+                                    _adaptive_guard* guard = nullptr ) noexcept {
+        if( guard == nullptr || base::_which_word( start_pos ) == base::_which_word( start_pos + len - 1 ))
+            return base::claim_range( start_pos, len, mo, guard );
+
+        if( guard->serialized() ) {
+            const auto waited = guard->lock();
+            const auto claimed = base::claim_range( start_pos, len, mo, guard );
+            guard->unlock();
+            guard->count( waited );
+            return claimed;
+        }
+
+        const auto claimed = base::claim_range( start_pos, len, mo, guard );
+        guard->count( !claimed );
+        return claimed;
+    }
+};
+
+
+/**
+ * The guard of `_flat_combining_bit_allocator`, which holds `n_slots` request slots and the combiner lock.
+ *
+ * A thread posts its request to a slot, starting at a slot of its own, and then either waits for the result, or
+ * takes the combiner lock and applies the pending requests of all slots in a batch. The batch is a single change in
+ * flight to the `_multi_word_guard`, so snapshots stay consistent. More threads than slots share them.
+ */
+template<size_t n_slots>
+struct _combining_guard : _multi_word_guard {
+    static constexpr unsigned max_spins = 256;
+    static constexpr bool is_process_local = true;
+
+    enum : uint32_t { empty, owned, pending, done };
+
+    /**
+     * A request, padded to a cache line of its own.
+     */
+    struct slot {
+        std::atomic<uint32_t> state{ empty };
+        uint32_t op = 0;
+        size_t start_pos = 0;
+        size_t len = 0;
+        size_t end_pos = 0;
+        size_t result = 0;
+        void* bitmap = nullptr;
+        size_t (*apply)( void*, uint32_t, size_t, size_t, size_t ) noexcept = nullptr;
+        char padding[8];
+    };
+    static_assert( sizeof( slot ) == 64 );
+
+    /**
+     * Post a request for `bitmap`, and return its result once some combiner applied it by calling `apply`.
+     */
+    template<typename BA>
+    size_t combine( BA& bitmap, uint32_t op, size_t start_pos, size_t len, size_t end_pos ) noexcept {
+        auto& s = _own_slot();
+        s.op = op;
+        s.start_pos = start_pos;
+        s.len = len;
+        s.end_pos = end_pos;
+        s.bitmap = &bitmap;
+        s.apply = &BA::_apply;
+        s.state.store( pending, std::memory_order::release );
+
+        for( auto spins = 0u; s.state.load( std::memory_order::acquire ) != done; ++spins ) {
+            if( !combining_.load( std::memory_order::relaxed ) &&
+                !combining_.exchange( true, std::memory_order::acquire )) {
+                _combine();
+                combining_.store( false, std::memory_order::release );
+            }
+            // the combiner may be preempted when there are more threads than cores
+            else if( spins % max_spins == max_spins-1 )
+                std::this_thread::yield();
+            else
+                _cpu_relax();
+        }
+
+        const auto result = s.result;
+        s.state.store( empty, std::memory_order::release );
+        return result;
+    }
+
+    /**
+     * Apply the pending requests of all slots.
+     */
+    void _combine() noexcept {
+        enter();
+        const auto n_used = used_slots_.load( std::memory_order::relaxed );
+        for( auto i = 0ul; i < n_used; ++i ) {
+            auto& s = slots_[i];
+            if( s.state.load( std::memory_order::acquire ) != pending )
+                continue;
+            s.result = s.apply( s.bitmap, s.op, s.start_pos, s.len, s.end_pos );
+            s.state.store( done, std::memory_order::release );
+        }
+        leave();
+    }
+    /**
+     * Take a slot, preferably the one of the calling thread.
+     */
+    slot& _own_slot() noexcept {
+        static std::atomic<size_t> next_home{ 0 };
+        static thread_local const size_t home = next_home.fetch_add( 1, std::memory_order::relaxed );
+
+        for( auto i = home; ; ++i ) {
+            auto& s = slots_[i % n_slots];
+            auto expected = uint32_t( empty );
+            if( s.state.load( std::memory_order::relaxed ) == empty &&
+                s.state.compare_exchange_strong( expected, owned, std::memory_order::acquire )) {
+                // a combiner that misses this slot is no problem, the posting thread combines itself eventually
+                auto n_used = used_slots_.load( std::memory_order::relaxed );
+                while( n_used <= i % n_slots &&
+                       !used_slots_.compare_exchange_weak( n_used, i % n_slots + 1, std::memory_order::relaxed ));
+                return s;
+            }
+            if(( i+1 ) % n_slots == home % n_slots )
+                std::this_thread::yield();
+        }
+    }
+
+    std::atomic<bool> combining_{ false };
+    std::atomic<size_t> used_slots_{ 0 };   // the combiner scans the slots up to the highest one ever taken
+    slot slots_[n_slots];
+};
+
+/**
+ * A backend for many threads on a small bitmap, where the atomic operations of the lock-free backend keep bouncing
+ * the same cache lines between the cores. With a guard, each request is posted to a slot and applied by a single
+ * combiner thread with plain loads and stores of the words, see `_combining_guard`. The words stay atomics, so
+ * readers like `usage()` or `snapshot()` need no lock, but they are only written by the combiner.
+ *
+ * Its guard makes the header of `serialized_bit_allocator` `n_slots` cache lines larger. Without a guard, e.g. on the
+ * companion bitmap of `track_lengths`, this backend behaves like `_reentrant_lock_free_bit_allocator`. Both ways must
+ * not be mixed on the same words.
+ */
+template<typename W, size_t n_slots = 16>
+struct _flat_combining_bit_allocator : _reentrant_lock_free_bit_allocator<W> {
+    using base = _reentrant_lock_free_bit_allocator<W>;
+    using guard_type = _combining_guard<n_slots>;
+    using base::operator=;
+
+    enum : uint32_t { op_alloc, op_claim, op_free };
+
+    [[nodiscard]] size_t alloc( size_t len, size_t start_pos = 0, size_t end_pos = base::bits_per_word,
+                                std::memory_order mo = std::memory_order::acquire,
+                                guard_type* guard = nullptr ) noexcept {
+        if( guard == nullptr )
+            return base::alloc( len, start_pos, end_pos, mo );
+        return guard->combine( *this, op_alloc, start_pos, len, end_pos );
+    }
+    /**
+     * Like `alloc`, as the combiner does not contend.
+     */
+    [[nodiscard]] alloc_result try_alloc( size_t len, size_t max_attempts, size_t start_pos = 0,
+                                          size_t end_pos = base::bits_per_word,
+                                          std::memory_order mo = std::memory_order::acquire,
+                                          guard_type* guard = nullptr ) noexcept {
+        if( max_attempts == 0 )
+            return { end_pos, alloc_status::contended };
+
+        start_pos = alloc( len, start_pos, end_pos, mo, guard );
+        return { start_pos, start_pos == end_pos ? alloc_status::full : alloc_status::success };
+    }
+    [[nodiscard]] bool claim_range( size_t start_pos, size_t len,
+                                    std::memory_order mo = std::memory_order::acquire,
+                                    guard_type* guard = nullptr ) noexcept {
+        if( guard == nullptr )
+            return base::claim_range( start_pos, len, mo );
+        return guard->combine( *this, op_claim, start_pos, len, start_pos+len ) != 0;
+    }
+    void free( size_t start_pos, size_t len,
+               std::memory_order mo = std::memory_order::release,
+               guard_type* guard = nullptr ) noexcept {
+        if( guard == nullptr )
+            base::free( start_pos, len, mo );
+        else
+            guard->combine( *this, op_free, start_pos, len, start_pos+len );
+    }
+
+    /**
+     * Apply a request on behalf of the combiner.
+     */
+    static size_t _apply( void* bitmap, uint32_t op, size_t start_pos, size_t len, size_t end_pos ) noexcept {
+        auto& self = *static_cast<_flat_combining_bit_allocator*>( bitmap );
+        const auto relaxed = std::memory_order::relaxed;
+
+        switch( op ) {
+            case op_alloc:
+                start_pos = self.find_unset_range( start_pos, end_pos, len, relaxed );
+                if( start_pos + len > end_pos )
+                    return end_pos;
+                self._store_range( start_pos, len, true );
+                return start_pos;
+
+            case op_claim:
+                if( self.find_first_set( start_pos, end_pos, relaxed ) != end_pos )
+                    return 0;
+                self._store_range( start_pos, len, true );
+                return 1;
+
+            default:
+                self._store_range( start_pos, len, false );
+                return 0;
+        }
+    }
+
+protected:
+    /**
+     * Set or unset the bits of a range with plain loads and stores, as only the combiner writes.
+     */
+    void _store_range( size_t start_pos, size_t len, bool set ) noexcept {
+        const auto first_word = base::_which_word( start_pos );
+        const auto last_word = base::_which_word( start_pos + len - 1 );
+
+        for( auto w = first_word; w <= last_word; ++w ) {
+            const auto first_bit = w == first_word ? base::_which_bit_in_word( start_pos ) : 0;
+            const auto last_bit = w == last_word ? base::_which_bit_in_word( start_pos + len - 1 )
+                                                 : base::bits_per_word-1;
+            const auto mask = base::get_mask( first_bit, last_bit );
+            const auto bits = this->bitmap_[w].load( std::memory_order::relaxed );
+            this->bitmap_[w].store( set ? W( bits | mask ) : W( bits & ~mask ), std::memory_order::relaxed );
+        }
+    }
+};
+
+
+/*
+ * Placement policies of `serialized_bit_allocator`, which decide the free range an allocation gets. A policy
+ * allocates with `try_alloc( backend, len, max_attempts, end_pos, mo, guard )` like the backend's `try_alloc`. It
+ * may keep state of its own, which then becomes part of the allocator's header.
+ */
+
+/**
+ * Take the first free range from the start of the bitmap. This is the default.
+ */
+struct first_fit {
+    template<typename BA>
+    alloc_result try_alloc( BA& ba, size_t len, size_t max_attempts, size_t end_pos, std::memory_order mo,
+                            typename BA::guard_type* guard ) noexcept {
+        return ba.try_alloc( len, max_attempts, 0, end_pos, mo, guard );
+    }
+};
+
+/**
+ * Take the first free range after the previous allocation, wrapping around at the end of the bitmap. This spreads
+ * allocations over the bitmap, and the search does not pass the allocations of the beginning over and over again.
+ */
+struct next_fit {
+    template<typename BA>
+    alloc_result try_alloc( BA& ba, size_t len, size_t max_attempts, size_t end_pos, std::memory_order mo,
+                            typename BA::guard_type* guard ) noexcept {
+        auto start_pos = cursor_.load( std::memory_order::relaxed );
+        if( start_pos >= end_pos )
+            start_pos = 0;
+
+        auto result = ba.try_alloc( len, max_attempts, start_pos, end_pos, mo, guard );
+        if( result.status == alloc_status::full && start_pos != 0 ) {
+            // wrap around, up to the ranges overlapping the cursor
+            const auto wrap_end = std::min( start_pos+len-1, end_pos );
+            result = ba.try_alloc( len, max_attempts, 0, wrap_end, mo, guard );
+            if( result.status != alloc_status::success )
+                result.pos = end_pos;
+        }
+
+        if( result.status == alloc_status::success )
+            cursor_.store( result.pos+len, std::memory_order::relaxed );
+        return result;
+    }
+
+    std::atomic<size_t> cursor_{ 0 };   // a hint only, racing updates are fine
+};
+
+/**
+ * Take the smallest of the first `window` free ranges that are large enough, or the first one that fits exactly.
+ * Large free ranges are kept for large allocations, at the cost of scanning further than first fit.
+ */
+template<size_t window = 8>
+struct basic_best_fit {
+    template<typename BA>
+    alloc_result try_alloc( BA& ba, size_t len, size_t max_attempts, size_t end_pos, std::memory_order mo,
+                            typename BA::guard_type* guard ) noexcept {
+        return _claim_found( ba, len, max_attempts, end_pos, mo, guard, [&]() {
+            auto best = end_pos;
+            auto best_len = ~size_t( 0 );
+            size_t pos = 0;
+            for( auto n = 0ul; n < window; ++n ) {
+                const auto start = ba.find_unset_range( pos, end_pos, len, mo );
+                if( start == end_pos )
+                    break;
+
+                pos = ba.find_first_set( start+len, end_pos, mo );
+                if( pos-start < best_len ) {
+                    best = start;
+                    best_len = pos-start;
+                    if( best_len == len )
+                        break;
+                }
+            }
+            return best;
+        } );
+    }
+};
+using best_fit = basic_best_fit<>;
+
+/**
+ * Take the last free range from the end of the bitmap. Together with first fit as a per-call policy, this keeps
+ * e.g. long-lived allocations at one end of the bitmap and short-lived ones at the other.
+ */
+struct top_down {
+    template<typename BA>
+    alloc_result try_alloc( BA& ba, size_t len, size_t max_attempts, size_t end_pos, std::memory_order mo,
+                            typename BA::guard_type* guard ) noexcept {
+        return _claim_found( ba, len, max_attempts, end_pos, mo, guard, [&]() {
+            return ba.rfind_unset_range( 0, end_pos, len, mo );
+        } );
+    }
+};
+
+
+/**
+ * This datastructure allows the allocation of bits and bitranges in a bitmap concurrently.
+ *
+ * An object of this type can and should be constructed in-place in a pre-allocated buffer given its size.
+ *
+ * The access to this data structure is lock-free, reentrant, and does not throw exceptions, when using the
+ * proposed `bit_allocator` and `bad_alloc_throws` (default) template parameters.
+ *
+ * Each successful allocation and each free is reported to the `recorder` (see `trace.h`), which records nothing by
+ * default.
+ *
+ * The `placement` policy decides which free range an allocation gets, see `first_fit`, `next_fit`, `best_fit`, and
+ * `top_down`.
+ *
+ * With `track_lengths`, the buffer holds a companion bitmap of the same size, which marks the last bit of each
+ * allocation. Then `free( pos )` and `size_of( pos )` work without the length of the allocation, at the cost of
+ * half of the bits and an additional atomic operation per allocation and free.
+ *
+ * With an unsigned integral `owner_type`, the buffer also holds an owner tag of that type per bit, and
+ * `alloc_for( owner, len )` tags its range. When an owner goes away, `release_all( owner )` frees all of its ranges
+ * in one pass over the tags, without any bookkeeping of the owner. Owner 0 stands for untagged allocations.
+ *
+ * With `support_waiting`, the header holds the state of the threads waiting in `alloc_wait` and `alloc_drain`, which
+ * are not available otherwise, and so is `co_alloc`. Without, the header of the default backend is just the size of
+ * the bitmap, which starts right after it.
+ *
+ */
+template<typename W = uint64_t,
+        template<typename> typename bit_allocator = _reentrant_lock_free_bit_allocator,
+        bool bad_alloc_throws = false,
+        typename recorder = no_recorder,
+        typename placement = first_fit,
+        bool track_lengths = false,
+        typename owner_type = void,
+        bool support_waiting = false>
+struct serialized_bit_allocator {
+private:
+    static constexpr bool alloc_throws = bit_allocator<W>::throws();
+    static constexpr bool alloc_reentrant = bit_allocator<W>::is_reentrant();
+    static constexpr bool owner_tags = !std::is_void_v<owner_type>;
+
+    using guard_type = typename bit_allocator<W>::guard_type;
+    // only the guards that keep more than the multi-word changes are in the header, see `_process_guard`
+    static constexpr bool guard_in_header = !std::is_same_v<guard_type, _multi_word_guard>;
+
+    // the type of the tags, also defined without owners to keep the helpers compilable
+    using _owner_t = std::conditional_t<owner_tags, owner_type, uint8_t>;
+    static constexpr size_t owner_bytes = owner_tags ? sizeof( _owner_t ) : 0;
+    // the tags are compared in blocks of 8 bytes, see `_owner_mask`
+    static constexpr size_t tag_alignment = owner_tags ? sizeof( uint64_t ) : 1;
+
+    static_assert( std::is_unsigned_v<_owner_t>, "owners are tagged with unsigned integers" );
+    static_assert( std::atomic_ref<_owner_t>::required_alignment == sizeof( _owner_t ) );
+
+    static_assert( sizeof( bit_allocator<W> ) == sizeof( W ), "a backend object is a single word of the bitmap" );
+
+public:
+    using WordT = W;
+    /**
+     * Whether the buffer holds companion regions after the bitmap: the ends of `track_lengths`, and the owner tags.
+     */
+    static constexpr bool tracks_lengths = track_lengths;
+    static constexpr bool has_owner_tags = owner_tags;
+    /**
+     * Whether the header holds pointers into the memory of the process, as the guard of the flat-combining backend
+     * does, so the buffer cannot be shared with other processes.
+     */
+    static constexpr bool is_process_local = guard_type::is_process_local;
+
+    explicit constexpr serialized_bit_allocator( size_t buffer_len = 64 ) :
+            end_pos_(
+                    (       // remaining buffer for the bitmap ...
+                            ( buffer_len-sizeof( serialized_bit_allocator ) + sizeof( bit_allocator_ ) )
+                            // ... shared with the companion bitmap and the owner tags, if any ...
+                            /(( track_lengths ? 2 : 1 ) + owner_bytes*bit_allocator<W>::bits_per_byte )
+                            // ... rounded down to match full words and keep the tags aligned to 8-byte blocks ...
+                            & ~size_t( std::max( bit_allocator<W>::bytes_per_word, tag_alignment )-1 )
+                    )
+                    // ... and scaled to number of bits
+                    *bit_allocator<W>::bits_per_byte
+            )
+    {
+        // the bitmap starts within this object, whose storage the compiler takes as undefined until it is
+        // constructed, so it may drop the caller's clearing of these bytes, which are cleared here instead
+        if( !std::is_constant_evaluated() ) {
+            auto* first = reinterpret_cast<char*>( bit_allocator_ );
+            std::memset( first, 0, size_t( reinterpret_cast<char*>( this + 1 ) - first ));
+        }
+    }
+
+    constexpr size_t size() const noexcept {
+        return end_pos_;
+    }
+    /**
+     * Return the words of the bitmap, `size()/(8*sizeof( W ))` of them, e.g. to restore a bitmap into a freshly
+     * constructed allocator. Accesses through this pointer are not synchronized with allocations of other threads.
+     */
+    W* data() noexcept {
+        return reinterpret_cast<W*>( bit_allocator_ );
+    }
+    const W* data() const noexcept {
+        return reinterpret_cast<const W*>( bit_allocator_ );
+    }
+
+    /**
+     * Allocate a range of `len` bits. The placement policy `P` overrides the allocator's one for this call, e.g.
+     * `alloc<jps::top_down>( len )`, as long as it has no state of its own.
+     */
+    template<typename P = placement>
+    [[nodiscard]] size_t
+    alloc( size_t len, std::memory_order mo = std::memory_order::acquire )
+            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
+        static_assert( std::is_same_v<P, placement> || std::is_empty_v<P>, "only stateless policies per call" );
+
+        if constexpr( bad_alloc_throws ) {
+            if( len == 0 )
+                throw std::bad_alloc();
+        }
+        else {
+            if( len == 0 )
+                return end_pos_;
+        }
+
+        auto start_pos = _alloc<P>( len, mo );
+
+        if constexpr( bad_alloc_throws ) {
+            if( start_pos == end_pos_ )
+                throw std::bad_alloc();
+        }
+
+        return start_pos;
+    }
+    /**
+     * Allocate a range of `len` bits like `alloc`, but if there is none, block until bits are freed by other threads
+     * or the `timeout` expires. By default, this waits forever.
+     *
+     * Waiting threads are parked on a generation counter in the header, which `free` bumps only when there are
+     * waiters. A waiter may still sleep through a range that became free because a concurrent allocation rolled back
+     * its partial claim; it wakes up with the next `free`. Only with `support_waiting`.
+     * @return The position of the range, or `size()` on timeout
+     */
+    [[nodiscard]] size_t
+    alloc_wait( size_t len,
+                std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max(),
+                std::memory_order mo = std::memory_order::acquire )
+            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) requires support_waiting {
+        if constexpr( bad_alloc_throws ) {
+            if( len == 0 )
+                throw std::bad_alloc();
+        }
+        else {
+            if( len == 0 )
+                return end_pos_;
+        }
+
+        auto start_pos = _alloc( len, mo );
+        if( start_pos != end_pos_ )
+            return start_pos;
+
+        const auto forever = timeout == std::chrono::nanoseconds::max();
+        const auto deadline = forever ? std::chrono::steady_clock::time_point::max()
+                                      : std::chrono::steady_clock::now() + timeout;
+
+        // register before looking at the bitmap again, pairs with the fence in free()
+        wait_.waiters_.fetch_add( 1, std::memory_order::relaxed );
+        std::atomic_thread_fence( std::memory_order::seq_cst );
+        while( true ) {
+            const auto generation = wait_.generation_.load( std::memory_order::acquire );
+            start_pos = _alloc( len, mo );
+            if( start_pos != end_pos_ )
+                break;
+
+            if( forever )
+                _wait_for( wait_.generation_, generation, std::chrono::nanoseconds::max() );
+            else {
+                const auto now = std::chrono::steady_clock::now();
+                if( now >= deadline )
+                    break;
+                _wait_for( wait_.generation_, generation, deadline-now );
+            }
+        }
+        wait_.waiters_.fetch_sub( 1, std::memory_order::relaxed );
+
+        if constexpr( bad_alloc_throws ) {
+            if( start_pos == end_pos_ )
+                throw std::bad_alloc();
+        }
+
+        return start_pos;
+    }
+    /**
+     * Allocate a large range of `len` bits like `alloc_wait`, but without being starved by the churn of small
+     * allocations, which take any bits that become free long before there is a free range of `len` bits.
+     *
+     * If there is no free range right away, the calling thread reserves a window of `len` bits, the one with the
+     * fewest allocated bits, preferably at the end of the bitmap where first-fit churn is rare. It claims all free
+     * bits in the window, and then each bit that is freed in there, until it holds the whole window. So the latency
+     * is bounded by the lifetime of the allocations that were in the window. Only one thread reserves at a time,
+     * so reservations cannot block each other. Small allocations are not slowed down.
+     *
+     * On timeout, the reserved bits are freed again. Only with `support_waiting`.
+     * @return The position of the range, or `size()` on timeout
+     */
+    [[nodiscard]] size_t
+    alloc_drain( size_t len,
+                 std::chrono::nanoseconds timeout = std::chrono::nanoseconds::max(),
+                 std::memory_order mo = std::memory_order::acquire )
+            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) requires support_waiting {
+        if constexpr( bad_alloc_throws ) {
+            if( len == 0 || len > end_pos_ )
+                throw std::bad_alloc();
+        }
+        else {
+            if( len == 0 || len > end_pos_ )
+                return end_pos_;
+        }
+
+        auto start_pos = _alloc( len, mo );
+        if( start_pos != end_pos_ )
+            return start_pos;
+
+        const auto forever = timeout == std::chrono::nanoseconds::max();
+        const auto deadline = forever ? std::chrono::steady_clock::time_point::max()
+                                      : std::chrono::steady_clock::now() + timeout;
+
+        // one reservation at a time
+        auto timed_out = false;
+        while( !timed_out && wait_.draining_.exchange( 1, std::memory_order::acquire ) != 0 ) {
+            const auto now = std::chrono::steady_clock::now();
+            timed_out = now >= deadline;
+            if( !timed_out )
+                _wait_for( wait_.draining_, 1, forever ? std::chrono::nanoseconds::max() : deadline-now );
+        }
+        if( !timed_out ) {
+            start_pos = _alloc( len, mo );
+            if( start_pos == end_pos_ )
+                start_pos = _drain( len, deadline, mo );
+
+            wait_.draining_.store( 0, std::memory_order::release );
+            _wake_all( wait_.draining_ );
+        }
+
+        if constexpr( bad_alloc_throws ) {
+            if( start_pos == end_pos_ )
+                throw std::bad_alloc();
+        }
+
+        return start_pos;
+    }
+    /**
+     * The awaitable of `co_alloc`. It lives in the awaiting coroutine's frame and serves as its node in the list of
+     * waiters while the coroutine is suspended.
+     */
+    template<typename executor>
+    struct co_alloc_awaiter : _co_waiter {
+        co_alloc_awaiter( serialized_bit_allocator* self, size_t len, executor ex, std::memory_order mo ) noexcept :
+                _co_waiter{ nullptr, self, len, 0, mo, &co_alloc_awaiter::_alloc_for, &co_alloc_awaiter::_resume },
+                self_( self ),
+                executor_( std::move( ex ))
+        {}
+
+        bool await_ready() noexcept {
+            pos = len == 0 || len > self_->end_pos_ ? self_->end_pos_ : self_->_alloc( len, mo );
+            return len == 0 || len > self_->end_pos_ || pos != self_->end_pos_;
+        }
+        void await_suspend( std::coroutine_handle<> handle ) noexcept {
+            handle_ = handle;
+            // this awaiter may be resumed and destroyed before returning from here, so do not touch it afterwards
+            _co_waiter_list::of( self_ ).wait( this );
+        }
+        size_t await_resume() const noexcept {
+            return pos;
+        }
+
+    private:
+        static bool _alloc_for( _co_waiter* w ) noexcept {
+            auto* self = static_cast<co_alloc_awaiter*>( w )->self_;
+            w->pos = self->_alloc( w->len, w->mo );
+            return w->pos != self->end_pos_;
+        }
+        static void _resume( _co_waiter* w ) noexcept {
+            // the executor may resume the coroutine inline, which destroys this awaiter
+            auto* self = static_cast<co_alloc_awaiter*>( w );
+            auto ex = self->executor_;
+            ex( self->handle_ );
+        }
+
+        serialized_bit_allocator* self_;
+        executor executor_;
+        std::coroutine_handle<> handle_;
+    };
+
+    /**
+     * Allocate a range of `len` bits in a coroutine: `co_await co_alloc( len, ex )` completes right away if there is a
+     * free range. Otherwise, the coroutine is suspended in a lock-free list of waiters in the memory of the process,
+     * which `free` drains. The draining thread allocates on behalf of the waiters and hands only those it could
+     * satisfy to their executor, `ex( std::coroutine_handle<> )`, which is supposed to resume them and must not
+     * throw. A waiter whose length does not fit yet stays suspended. Only with `support_waiting`.
+     * @return The awaitable, which results in the position of the range, or `size()` if `len` is 0 or exceeds the
+     * bitmap
+     */
+    template<typename executor>
+    [[nodiscard]] co_alloc_awaiter<executor>
+    co_alloc( size_t len, executor ex, std::memory_order mo = std::memory_order::acquire ) noexcept
+            requires support_waiting {
+        return co_alloc_awaiter<executor>( this, len, std::move( ex ), mo );
+    }
+    /**
+     * Allocate a range of `len` bits like `alloc`, but give up after `max_attempts` attempts to claim a free range
+     * were lost to other threads. This never throws `std::bad_alloc`: the status tells whether the bitmap is full or
+     * just contended, so latency-critical callers can bound their worst case and fall back.
+     */
+    [[nodiscard]] alloc_result
+    try_alloc( size_t len, size_t max_attempts, std::memory_order mo = std::memory_order::acquire )
+            noexcept( !alloc_throws && !alloc_reentrant ) {
+        if( len == 0 )
+            return { end_pos_, alloc_status::full };
+
+        if( !alloc_reentrant )
+            mutex_.lock();
+        const auto result = placement_.try_alloc( bit_allocator_[0], len, max_attempts, end_pos_, mo,
+                                                  _guard() );
+        if( result.status == alloc_status::success )
+            _mark_end( result.pos, len );
+        if( !alloc_reentrant )
+            mutex_.unlock();
+
+        if( result.status == alloc_status::success )
+            recorder::record( trace_op::alloc, result.pos, len );
+        return result;
+    }
+    void free( size_t start_pos,
+               size_t len,
+               std::memory_order mo = std::memory_order::release )
+            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
+        // record before the bits become available again, so a trace never shows them allocated twice
+        recorder::record( trace_op::free, start_pos, len );
+
+        // untag before the bits can be allocated again, so a new owner never finds a stale tag
+        _tag( start_pos, len, 0 );
+
+        if( !alloc_reentrant )
+            mutex_.lock();
+        if constexpr( track_lengths )
+            _ends().free( start_pos, len, std::memory_order::relaxed );
+        bit_allocator_[0].free( start_pos, len, mo, _guard() );
+        if( !alloc_reentrant )
+            mutex_.unlock();
+
+        _notify_waiters();
+    }
+    /**
+     * Free the allocation at `start_pos` without knowing its length, which requires `track_lengths`.
+     */
+    void free( size_t start_pos, std::memory_order mo = std::memory_order::release )
+            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
+        const auto len = size_of( start_pos );
+        assert( len != 0 );
+        if( len != 0 )
+            free( start_pos, len, mo );
+    }
+    /**
+     * Return the length of the allocation at `start_pos`, which requires `track_lengths`. It is found by scanning
+     * the companion bitmap for the next end of an allocation at word speed.
+     * @return The length, or 0 if there is no allocation at or after `start_pos`
+     */
+    [[nodiscard]] size_t
+    size_of( size_t start_pos, std::memory_order mo = std::memory_order::acquire ) const
+            noexcept( !alloc_throws && !alloc_reentrant ) {
+        static_assert( track_lengths, "the lengths of allocations are only known with track_lengths" );
+
+        if( !alloc_reentrant )
+            mutex_.lock();
+        const auto last_pos = _ends().find_first_set( start_pos, end_pos_, mo );
+        if( !alloc_reentrant )
+            mutex_.unlock();
+
+        return last_pos == end_pos_ ? 0 : last_pos+1-start_pos;
+    }
+    /**
+     * Allocate a range of `len` bits like `alloc`, and tag it with `owner`, which requires an `owner_type`.
+     */
+    template<typename P = placement>
+    [[nodiscard]] size_t
+    alloc_for( _owner_t owner, size_t len, std::memory_order mo = std::memory_order::acquire )
+            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
+        static_assert( owner_tags, "allocations are only tagged with an owner_type" );
+        assert( owner != 0 );
+
+        const auto start_pos = alloc<P>( len, mo );
+        if( start_pos != end_pos_ )
+            _tag( start_pos, len, owner );
+        return start_pos;
+    }
+    /**
+     * Return the owner of the allocated bit `pos`, or 0 if it is free or untagged.
+     */
+    [[nodiscard]] _owner_t owner_of( size_t pos ) const noexcept {
+        static_assert( owner_tags, "allocations are only tagged with an owner_type" );
+        return std::atomic_ref( _owners()[pos] ).load( std::memory_order::relaxed );
+    }
+    /**
+     * Tag the bits [`to_pos`, `to_pos+len`) with the owners of [`from_pos`, `from_pos+len`), which must not overlap,
+     * e.g. when allocations move, see `defragmenter`.
+     */
+    void copy_owners( size_t from_pos, size_t to_pos, size_t len ) noexcept {
+        static_assert( owner_tags, "allocations are only tagged with an owner_type" );
+        auto* const tags = _owners();
+        for( auto i = 0ul; i < len; ++i ) {
+            const auto owner = std::atomic_ref( tags[from_pos+i] ).load( std::memory_order::relaxed );
+            std::atomic_ref( tags[to_pos+i] ).store( owner, std::memory_order::relaxed );
+        }
+    }
+    /**
+     * Free all ranges tagged with `owner`. Only the tags of allocated words are looked at, a word of tags at a time,
+     * and free regions are skipped at word speed. The owner must not allocate or free concurrently, while all other
+     * threads may.
+     *
+     * Adjacent allocations of the owner are freed, and recorded, as a single range.
+     * @return The number of bits freed
+     */
+    size_t release_all( _owner_t owner, std::memory_order mo = std::memory_order::release )
+            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
+        static_assert( owner_tags, "allocations are only tagged with an owner_type" );
+        assert( owner != 0 );
+
+        const auto bits_per_word = bit_allocator<W>::bits_per_word;
+        size_t released = 0;
+        auto run_start = end_pos_;  // the start of the owner's range found so far, which is freed at its end
+        const auto flush = [&]( size_t run_end ) {
+            if( run_start != end_pos_ ) {
+                free( run_start, run_end-run_start, mo );
+                released += run_end-run_start;
+                run_start = end_pos_;
+            }
+        };
+
+        for( auto pos = 0ul; pos < end_pos_; ) {
+            if( !alloc_reentrant )
+                mutex_.lock();
+            pos = bit_allocator_[0].find_first_set( pos, end_pos_, std::memory_order::relaxed );
+            const auto run_end = bit_allocator_[0].find_first_unset( pos, end_pos_, std::memory_order::relaxed );
+            if( !alloc_reentrant )
+                mutex_.unlock();
+            // walk the ranges of the owner's bits within the run, a word of tags at a time
+            while( pos < run_end ) {
+                const auto w = pos/bits_per_word;
+                const auto end_bit = std::min( run_end-w*bits_per_word, size_t( bits_per_word ));
+                const auto mask = _owner_mask( w, owner );
+                for( auto bit = pos%bits_per_word; bit < end_bit; ) {
+                    const auto rest = W( mask << bit );
+                    const auto others = std::min<size_t>( _countl_zero( rest ), end_bit-bit );
+                    if( others != 0 ) {
+                        flush( w*bits_per_word + bit );
+                        bit += others;
+                        continue;
+                    }
+                    if( run_start == end_pos_ )
+                        run_start = w*bits_per_word + bit;
+                    bit += std::min<size_t>( _countl_one( rest ), end_bit-bit );
+                }
+                pos = w*bits_per_word + end_bit;
+            }
+            flush( run_end );
+        }
+        return released;
+    }
+    /**
+     * Allocate exactly the range [`start_pos`, `start_pos+len`), e.g. to mark known regions like headers or bad
+     * blocks as used. This fails without altering any bit if one of them is allocated already.
+     * @return True if the range was reserved
+     */
+    [[nodiscard]] bool
+    reserve_range( size_t start_pos, size_t len, std::memory_order mo = std::memory_order::acquire )
+            noexcept( !alloc_throws && !alloc_reentrant ) {
+        if( len == 0 || start_pos > end_pos_ || len > end_pos_-start_pos )
+            return false;
+
+        if( !alloc_reentrant )
+            mutex_.lock();
+        const auto reserved = bit_allocator_[0].claim_range( start_pos, len, mo, _guard() );
+        if( reserved )
+            _mark_end( start_pos, len );
+        if( !alloc_reentrant )
+            mutex_.unlock();
+
+        if( reserved )
+            recorder::record( trace_op::alloc, start_pos, len );
+        return reserved;
+    }
+    /**
+     * Allocate the range of `len` bits closest to `hint`, e.g. next to a related allocation. The search goes outward
+     * from `hint` in both directions, doubling its radius from a word up to `max_distance` bits, so nearby ranges are
+     * found without scanning the whole bitmap. Each ring continues where the previous one ended, and a range lost to
+     * another thread is skipped rather than scanned for again.
+     * @return The position of the range, or `size()` if there is none starting within `max_distance` of `hint`
+     */
+    [[nodiscard]] size_t
+    alloc_near( size_t hint, size_t len, size_t max_distance = ~size_t( 0 ),
+                std::memory_order mo = std::memory_order::acquire ) noexcept( !alloc_throws && !alloc_reentrant ) {
+        if( len == 0 || len > end_pos_ )
+            return end_pos_;
+        hint = std::min( hint, end_pos_-len );
+        max_distance = std::min( max_distance, end_pos_ );
+
+        auto start_pos = end_pos_;
+        auto radius = std::min<size_t>( bit_allocator<W>::bits_per_word, max_distance );
+        // the starts in [`down_to`, `up_from`) are known not to be free, so each ring only scans the ones beyond
+        auto up_from = hint;
+        auto down_to = hint;
+
+        if( !alloc_reentrant )
+            mutex_.lock();
+        while( true ) {
+            // the closest range in each direction within the radius
+            const auto up_end = std::min( hint + radius, end_pos_-len ) + len;
+            const auto up = up_from+len <= up_end ? bit_allocator_[0].find_unset_range( up_from, up_end, len, mo )
+                                                  : up_end;
+            const auto down_begin = hint - std::min( radius, hint );
+            const auto down_end = down_to + len - 1;
+            const auto down = down_begin < down_to
+                              ? bit_allocator_[0].rfind_unset_range( down_begin, down_end, len, mo ) : down_end;
+
+            if( up != up_end || down != down_end ) {
+                up_from = up != up_end ? up : up_end-len+1;
+                down_to = down != down_end ? down+1 : down_begin;
+                const auto candidate = up != up_end && ( down == down_end || up-hint <= hint-down ) ? up : down;
+                if( bit_allocator_[0].claim_range( candidate, len, mo, _guard() )) {
+                    start_pos = candidate;
+                    _mark_end( start_pos, len );
+                    break;
+                }
+                // lost it to another thread, look again past it
+                if( candidate == up )
+                    ++up_from;
+                else
+                    --down_to;
+                continue;
+            }
+
+            up_from = up_end-len+1;
+            down_to = down_begin;
+            if( radius == max_distance )
+                break;
+            radius = std::min( 2*radius, max_distance );
+        }
         if( !alloc_reentrant )
-            get_global_mutex().unlock();
+            mutex_.unlock();
+
+        if( start_pos != end_pos_ )
+            recorder::record( trace_op::alloc, start_pos, len );
+        return start_pos;
+    }
+    /**
+     * Grow the allocation [`start_pos`, `start_pos+old_len`) in place to `new_len` bits by claiming the bits right
+     * after it. This fails without altering any bit if one of them is allocated already, or beyond the bitmap.
+     * The added bits are recorded as an allocation of their own.
+     * @return True if the allocation has `new_len` bits now
+     */
+    [[nodiscard]] bool
+    try_extend( size_t start_pos, size_t old_len, size_t new_len,
+                std::memory_order mo = std::memory_order::acquire ) noexcept( !alloc_throws && !alloc_reentrant ) {
+        if( new_len <= old_len )
+            return new_len == old_len;
+
+        if( !reserve_range( start_pos+old_len, new_len-old_len, mo ))
+            return false;
+
+        if constexpr( owner_tags ) {
+            if( old_len != 0 )
+                _tag( start_pos+old_len, new_len-old_len, owner_of( start_pos ));
+        }
+        if constexpr( track_lengths ) {
+            if( old_len != 0 ) {
+                if( !alloc_reentrant )
+                    mutex_.lock();
+                _ends().free( start_pos+old_len-1, 1, std::memory_order::relaxed );
+                if( !alloc_reentrant )
+                    mutex_.unlock();
+            }
+        }
+        return true;
+    }
+    /**
+     * Shrink the allocation [`start_pos`, `start_pos+old_len`) in place to `new_len` bits by freeing its tail. The
+     * freed bits are recorded as a free of their own.
+     */
+    void shrink( size_t start_pos, size_t old_len, size_t new_len,
+                 std::memory_order mo = std::memory_order::release )
+            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
+        if( new_len >= old_len )
+            return;
+
+        if constexpr( track_lengths ) {
+            if( new_len != 0 ) {
+                if( !alloc_reentrant )
+                    mutex_.lock();
+                _mark_end( start_pos, new_len );
+                if( !alloc_reentrant )
+                    mutex_.unlock();
+            }
+        }
+        free( start_pos+new_len, old_len-new_len, mo );
+    }
+    /**
+     * Free the range [`start_pos`, `start_pos+len`), which may span any number of allocations and reservations.
+     * Whole words in between are released with plain stores.
+     */
+    void release_range( size_t start_pos,
+                        size_t len,
+                        std::memory_order mo = std::memory_order::release )
+            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
+        free( start_pos, len, mo );
+    }
+    /**
+     * Free all bits. Other than `release_range`, this must not run concurrently with other operations on the
+     * bitmap. With `n_threads` > 1, the bitmap is split among as many threads, which is meant for bitmaps of
+     * gigabytes. Neither `reset` nor `fill` is reported to the recorder.
+     */
+    void reset( size_t n_threads = 1 ) {
+        _fill( false, n_threads );
+        _notify_waiters();
+    }
+    /**
+     * Allocate all bits, see `reset`.
+     */
+    void fill( size_t n_threads = 1 ) {
+        _fill( true, n_threads );
     }
     [[nodiscard]] size_t
     usage( std::memory_order memory_order = std::memory_order::relaxed ) const
@@ -574,21 +2464,562 @@ public:
         size_t u = 0;
 
         if( !alloc_reentrant )
-            get_global_mutex().lock();
+            mutex_.lock();
         for( auto w = 0ul; w <= ( end_pos_-1 )/bit_allocator<W>::bits_per_word; ++w )
             u += bit_allocator_[w].usage( memory_order );
         if( !alloc_reentrant )
-            get_global_mutex().unlock();
+            mutex_.unlock();
+        return u;
+    }
+    /**
+     * Return the length of the longest range of unallocated bits. Together with `usage()`, this tells how
+     * fragmented the free space is.
+     */
+    [[nodiscard]] size_t
+    largest_free_range( std::memory_order memory_order = std::memory_order::relaxed ) const
+            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
+        size_t largest = 0;
+
+        if( !alloc_reentrant )
+            mutex_.lock();
+        for( auto pos = 0ul; pos < end_pos_; ) {
+            const auto start = bit_allocator_[0].find_first_unset( pos, end_pos_, memory_order );
+            pos = bit_allocator_[0].find_first_set( start, end_pos_, memory_order );
+            largest = std::max( largest, pos-start );
+        }
+        if( !alloc_reentrant )
+            mutex_.unlock();
+        return largest;
+    }
+    /**
+     * Return the number of allocated bits in [`start_pos`, `start_pos+len`). The first and the last word are masked,
+     * the words in between are counted whole. Bits beyond the bitmap are not counted.
+     */
+    [[nodiscard]] size_t
+    count_in_range( size_t start_pos, size_t len, std::memory_order mo = std::memory_order::relaxed ) const
+            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
+        size_t n = 0;
+        _for_masked_words( start_pos, len, mo, [&n]( W word, W mask ) {
+            n += size_t( _popcount( W( word & mask )));
+            return true;
+        } );
+        return n;
+    }
+    /**
+     * Tell whether all bits of [`start_pos`, `start_pos+len`) are free. This stops at the first allocated word. A
+     * range reaching beyond the bitmap is not free.
+     */
+    [[nodiscard]] bool
+    is_free( size_t start_pos, size_t len, std::memory_order mo = std::memory_order::relaxed ) const
+            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
+        if( start_pos > end_pos_ || len > end_pos_-start_pos )
+            return false;
+        return _for_masked_words( start_pos, len, mo, []( W word, W mask ) { return W( word & mask ) == 0; } );
+    }
+    /**
+     * Tell whether all bits of [`start_pos`, `start_pos+len`) are allocated. This stops at the first free word. A
+     * range reaching beyond the bitmap is not allocated.
+     */
+    [[nodiscard]] bool
+    is_allocated( size_t start_pos, size_t len, std::memory_order mo = std::memory_order::relaxed ) const
+            noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
+        if( start_pos > end_pos_ || len > end_pos_-start_pos )
+            return false;
+        return _for_masked_words( start_pos, len, mo, []( W word, W mask ) { return W( word & mask ) == mask; } );
+    }
+    /*
+     * Parallel variants for bitmaps of billions of bits: the bitmap is split into one chunk per thread, and the
+     * results of the chunks are combined. Free runs crossing the borders of the chunks are stitched together. The
+     * chunks are processed by a pool of worker threads started on first use, and only for bitmaps of at least a
+     * mebibyte, smaller ones being processed by the calling thread.
+     */
+
+    /**
+     * Return the number of allocated bits, counted by `n_threads` threads.
+     */
+    [[nodiscard]] size_t
+    usage( size_t n_threads, std::memory_order memory_order = std::memory_order::relaxed ) const {
+        n_threads = std::max<size_t>( n_threads, 1 );
+        auto counts = std::make_unique<size_t[]>( n_threads );
+
+        if( !alloc_reentrant )
+            mutex_.lock();
+        _parallel_for( n_threads, [&]( size_t begin, size_t end, size_t t ) {
+            size_t u = 0;
+            for( auto w = begin; w < end; ++w )
+                u += bit_allocator_[w].usage( memory_order );
+            counts[t] = u;
+        } );
+        if( !alloc_reentrant )
+            mutex_.unlock();
+
+        size_t u = 0;
+        for( auto t = 0ul; t < n_threads; ++t )
+            u += counts[t];
         return u;
     }
+    /**
+     * Return the length of the longest range of unallocated bits, scanned by `n_threads` threads.
+     */
+    [[nodiscard]] size_t
+    largest_free_range( size_t n_threads, std::memory_order memory_order = std::memory_order::relaxed ) const {
+        const auto chunks = _scan_runs( ~size_t( 0 ), n_threads, memory_order );
+
+        size_t largest = 0;
+        size_t carry = 0;   // the free bits at the end of the chunks so far
+        for( auto t = 0ul; t < std::max<size_t>( n_threads, 1 ); ++t ) {
+            const auto& c = chunks[t];
+            largest = std::max({ largest, c.largest, carry + c.prefix });
+            carry = c.prefix == c.end-c.begin ? carry + c.prefix : c.suffix;
+        }
+        return largest;
+    }
+    /**
+     * Return the position of the first range of `len` unallocated bits, scanned by `n_threads` threads. This is a
+     * hint only, as other threads may allocate the range right away.
+     * @return The position of the range, or `size()` if there is none
+     */
+    [[nodiscard]] size_t
+    find_unset_range( size_t len, size_t n_threads = 1, std::memory_order mo = std::memory_order::acquire ) const {
+        if( len == 0 || len > end_pos_ )
+            return end_pos_;
+
+        const auto chunks = _scan_runs( len, n_threads, mo );
+
+        size_t carry = 0;   // the free bits at the end of the chunks so far
+        for( auto t = 0ul; t < std::max<size_t>( n_threads, 1 ); ++t ) {
+            const auto& c = chunks[t];
+            if( c.begin == c.end )
+                continue;
+            if( carry + c.prefix >= len )
+                return c.begin - carry;
+            if( c.first_fit != c.end )
+                return c.first_fit;
+            carry = c.prefix == c.end-c.begin ? carry + c.prefix : c.suffix;
+        }
+        return end_pos_;
+    }
+    /**
+     * Allocate the first range of `len` bits, found by `n_threads` threads, see `find_unset_range`.
+     * @return The position of the range, or `size()` if there is none
+     */
+    [[nodiscard]] size_t
+    alloc_parallel( size_t len, size_t n_threads, std::memory_order mo = std::memory_order::acquire ) {
+        while( true ) {
+            const auto start_pos = find_unset_range( len, n_threads, mo );
+            if( start_pos == end_pos_ || reserve_range( start_pos, len, mo ))
+                return start_pos;
+        }
+    }
+    /**
+     * Copy the bitmap to `out`, which has to hold `size()/(8*sizeof( W ))` words, while other threads keep allocating
+     * and freeing. The copy is consistent: each range is either completely allocated or completely free in it, and
+     * it does not contain bits of a failed allocation that were about to be rolled back.
+     *
+     * Changes within a single word are atomic, so only those spanning multiple words may tear a copy. The copy is
+     * retried a few times until none of those overlapped with it. If they keep doing so, new multi-word changes are
+     * held back until the copy is done, while single-word changes still go on.
+     *
+     * The lock-free backend counts its multi-word changes in the memory of the process, see `_process_guard`, so in
+     * a buffer shared with other processes, the copy is only consistent with the changes of this process.
+     */
+    void snapshot( W* out ) const noexcept( !bad_alloc_throws && !alloc_throws && !alloc_reentrant ) {
+        static constexpr auto optimistic_attempts = 4;
+        const auto n_words = end_pos_/bit_allocator<W>::bits_per_word;
+
+        if( !alloc_reentrant ) {
+            mutex_.lock();
+            for( auto w = 0ul; w < n_words; ++w )
+                out[w] = bit_allocator_[w].load();
+            mutex_.unlock();
+            return;
+        }
+
+        for( auto attempt = 0; attempt < optimistic_attempts; ++attempt ) {
+            const auto before = _guard()->state_.load( std::memory_order::acquire );
+            if(( before & _multi_word_guard::in_flight_mask ) != 0 )
+                continue;
+
+            for( auto w = 0ul; w < n_words; ++w )
+                out[w] = bit_allocator_[w].load( std::memory_order::relaxed );
+
+            std::atomic_thread_fence( std::memory_order::acquire );
+            const auto after = _guard()->state_.load( std::memory_order::relaxed );
+            if(( before & ~_multi_word_guard::gate ) == ( after & ~_multi_word_guard::gate ))
+                return;
+        }
+
+        _guard()->close();
+        for( auto w = 0ul; w < n_words; ++w )
+            out[w] = bit_allocator_[w].load( std::memory_order::acquire );
+        _guard()->open();
+    }
 
 protected:
-    static std::mutex& get_global_mutex() noexcept {
-        static std::mutex m;
-        return m;
+    /**
+     * Allocate without any checks of the arguments, and return `end_pos_` on failure.
+     */
+    template<typename P = placement>
+    size_t _alloc( size_t len, std::memory_order mo ) noexcept( !alloc_throws && !alloc_reentrant ) {
+        if( !alloc_reentrant )
+            mutex_.lock();
+        size_t start_pos;
+        if constexpr( std::is_same_v<P, placement> )
+            start_pos = placement_.try_alloc( bit_allocator_[0], len, ~size_t( 0 ), end_pos_, mo,
+                                              _guard() ).pos;
+        else
+            start_pos = P().try_alloc( bit_allocator_[0], len, ~size_t( 0 ), end_pos_, mo, _guard() ).pos;
+        if( start_pos != end_pos_ )
+            _mark_end( start_pos, len );
+        if( !alloc_reentrant )
+            mutex_.unlock();
+
+        if( start_pos != end_pos_ )
+            recorder::record( trace_op::alloc, start_pos, len );
+        return start_pos;
+    }
+
+    /**
+     * Call `f( word, mask )` for each word of [`start_pos`, `start_pos+len`) in order, where `mask` selects the bits
+     * of the range, until `f` returns false. The range is clamped to the bitmap.
+     * @return False if `f` did so
+     */
+    template<typename F>
+    bool _for_masked_words( size_t start_pos, size_t len, std::memory_order mo, F&& f ) const
+            noexcept( !alloc_throws && !alloc_reentrant ) {
+        start_pos = std::min( start_pos, end_pos_ );
+        len = std::min( len, end_pos_-start_pos );
+        if( len == 0 )
+            return true;
+
+        const auto bits_per_word = bit_allocator<W>::bits_per_word;
+        const auto first_word = start_pos/bits_per_word;
+        const auto last_word = ( start_pos+len-1 )/bits_per_word;
+        constexpr auto ones = W( ~W( 0 ));
+        // the bits are stored from the most significant one on
+        const auto first_mask = W( ones >> start_pos%bits_per_word );
+        const auto last_mask = W( ones << ( bits_per_word-1 - ( start_pos+len-1 )%bits_per_word ));
+
+        if( !alloc_reentrant )
+            mutex_.lock();
+        auto complete = true;
+        if( first_word == last_word )
+            complete = f( bit_allocator_[first_word].load( mo ), W( first_mask & last_mask ));
+        else {
+            complete = f( bit_allocator_[first_word].load( mo ), first_mask );
+            for( auto w = first_word+1; complete && w < last_word; ++w )
+                complete = f( bit_allocator_[w].load( mo ), ones );
+            complete = complete && f( bit_allocator_[last_word].load( mo ), last_mask );
+        }
+        if( !alloc_reentrant )
+            mutex_.unlock();
+        return complete;
+    }
+    /**
+     * The companion bitmap of `track_lengths`, which follows the bitmap in the buffer.
+     */
+    bit_allocator<W>& _ends() noexcept {
+        return bit_allocator_[end_pos_/bit_allocator<W>::bits_per_word];
+    }
+    const bit_allocator<W>& _ends() const noexcept {
+        return bit_allocator_[end_pos_/bit_allocator<W>::bits_per_word];
+    }
+    /**
+     * The owner tags of `owner_type`, one per bit, which follow the bitmaps in the buffer.
+     */
+    _owner_t* _owners() const noexcept {
+        auto* tags = reinterpret_cast<_owner_t*>( const_cast<bit_allocator<W>*>( bit_allocator_ ))
+                     + ( track_lengths ? 2 : 1 )*end_pos_/bit_allocator<W>::bits_per_byte/sizeof( _owner_t );
+        assert( reinterpret_cast<uintptr_t>( tags ) % tag_alignment == 0 );
+        return tags;
+    }
+    /**
+     * Tag the bits [`start_pos`, `start_pos+len`) with `owner`, if there are owner tags.
+     */
+    void _tag( [[maybe_unused]] size_t start_pos, [[maybe_unused]] size_t len,
+               [[maybe_unused]] _owner_t owner ) noexcept {
+        if constexpr( owner_tags ) {
+            auto* tags = _owners();
+            for( auto pos = start_pos; pos < start_pos+len; ++pos )
+                std::atomic_ref( tags[pos] ).store( owner, std::memory_order::relaxed );
+        }
+    }
+    /**
+     * Return the mask of the bits of word `w` that are tagged with `owner`, so `release_all` looks at each bit once,
+     * and frees whole ranges rather than single bits. The tags are compared 8 bytes at a time without branches: the
+     * lanes of a block that equal `owner` become zero, their zero test sets the top bit of each such lane, and a
+     * multiplication gathers the top bits in the order of the tags.
+     */
+    W _owner_mask( size_t w, _owner_t owner ) const noexcept {
+        constexpr auto lane_bits = 8*sizeof( _owner_t );
+        constexpr auto n_lanes = sizeof( uint64_t )/sizeof( _owner_t );
+        constexpr auto ones = ~uint64_t( 0 )/uint64_t( _owner_t( ~_owner_t( 0 )));    // 1 in each lane
+        constexpr auto tops = ones << ( lane_bits-1 );
+        // moves the top bit of lane j, which is lane n_lanes-1-j on big-endian hosts, to bit 63-j
+        constexpr auto gather = []() {
+            uint64_t g = 0;
+            for( auto j = 0ul; j < n_lanes; ++j ) {
+                const auto lane = std::endian::native == std::endian::little ? j : n_lanes-1-j;
+                g |= uint64_t( 1 ) << ( 63 - j - lane*lane_bits );
+            }
+            return g;
+        }();
+
+        const auto n_blocks = bit_allocator<W>::bits_per_word/n_lanes;
+        auto* const blocks = reinterpret_cast<uint64_t*>( _owners() + w*bit_allocator<W>::bits_per_word );
+        const auto pattern = ones*uint64_t( owner );
+        W mask = 0;
+        for( auto k = 0u; k < n_blocks; ++k ) {
+            const auto x = std::atomic_ref( blocks[k] ).load( std::memory_order::relaxed ) ^ pattern;
+            const auto zero = ~((( x & ~tops ) + ~tops ) | x ) & tops;
+            mask = W( W( mask << n_lanes ) | W(( zero >> ( lane_bits-1 ))*gather >> ( 64-n_lanes )));
+        }
+        return mask;
+    }
+    /**
+     * Mark the last bit of the allocation [`start_pos`, `start_pos+len`) in the companion bitmap, if any.
+     */
+    void _mark_end( [[maybe_unused]] size_t start_pos, [[maybe_unused]] size_t len ) noexcept {
+        if constexpr( track_lengths ) {
+            [[maybe_unused]] const auto marked = _ends().claim_range( start_pos+len-1, 1, std::memory_order::relaxed );
+            assert( marked );
+        }
+    }
+
+    /**
+     * Return the start of the window of `len` bits with the fewest allocated bits, at word granularity. Of equal
+     * windows, the last one is taken.
+     */
+    size_t _drain_window( size_t len ) const noexcept {
+        const auto bits_per_word = bit_allocator<W>::bits_per_word;
+        const auto n_window_words = ( len + bits_per_word-1 )/bits_per_word;
+        const auto last_word = ( end_pos_-len )/bits_per_word;
+
+        size_t used = 0;
+        for( auto w = 0ul; w < n_window_words; ++w )
+            used += bit_allocator_[w].usage();
+
+        size_t best_word = 0;
+        auto best_used = used;
+        for( auto w = 1ul; w <= last_word; ++w ) {
+            used += bit_allocator_[w+n_window_words-1].usage();
+            used -= bit_allocator_[w-1].usage();
+            if( used <= best_used ) {
+                best_word = w;
+                best_used = used;
+            }
+        }
+        return best_word*bits_per_word;
+    }
+    /**
+     * Reserve a window of `len` bits bit by bit, see `alloc_drain`.
+     * @return The start of the window, or `end_pos_` on timeout
+     */
+    size_t _drain( size_t len, std::chrono::steady_clock::time_point deadline, std::memory_order mo ) noexcept {
+        // the bits of the window held by this thread, other than those allocated by others
+        const auto n_held_words = ( len+63 )/64;
+        std::unique_ptr<uint64_t[]> held( new( std::nothrow ) uint64_t[n_held_words]() );
+        if( !held )
+            return end_pos_;
+
+        if( !alloc_reentrant )
+            mutex_.lock();
+        const auto start_pos = _drain_window( len );
+        if( !alloc_reentrant )
+            mutex_.unlock();
+        const auto end_pos = start_pos + len;
+
+        size_t n_held = 0;
+        auto timed_out = false;
+
+        // register before looking at the bitmap again, pairs with the fence in free()
+        wait_.waiters_.fetch_add( 1, std::memory_order::relaxed );
+        std::atomic_thread_fence( std::memory_order::seq_cst );
+        while( true ) {
+            const auto generation = wait_.generation_.load( std::memory_order::acquire );
+
+            if( !alloc_reentrant )
+                mutex_.lock();
+            for( auto pos = start_pos; pos < end_pos; ) {
+                const auto run_start = bit_allocator_[0].find_first_unset( pos, end_pos, mo );
+                if( run_start == end_pos )
+                    break;
+                pos = bit_allocator_[0].find_first_set( run_start, end_pos, mo );
+                if( !bit_allocator_[0].claim_range( run_start, pos-run_start, mo, _guard() )) {
+                    // somebody else got in between, look at the run again
+                    pos = run_start;
+                    continue;
+                }
+                for( auto i = run_start-start_pos; i < pos-start_pos; ++i )
+                    held[i/64] |= uint64_t( 1 ) << ( i%64 );
+                n_held += pos-run_start;
+            }
+            if( n_held == len )
+                _mark_end( start_pos, len );
+            if( !alloc_reentrant )
+                mutex_.unlock();
+
+            if( n_held == len )
+                break;
+
+            const auto now = std::chrono::steady_clock::now();
+            timed_out = now >= deadline;
+            if( timed_out )
+                break;
+            _wait_for( wait_.generation_, generation, deadline == std::chrono::steady_clock::time_point::max()
+                                                      ? std::chrono::nanoseconds::max() : deadline-now );
+        }
+        wait_.waiters_.fetch_sub( 1, std::memory_order::relaxed );
+
+        if( timed_out ) {
+            if( !alloc_reentrant )
+                mutex_.lock();
+            for( auto i = 0ul; i < len; ) {
+                if(( held[i/64] >> ( i%64 ) & 1 ) == 0 ) {
+                    ++i;
+                    continue;
+                }
+                const auto run_start = i;
+                while( i < len && ( held[i/64] >> ( i%64 ) & 1 ))
+                    ++i;
+                bit_allocator_[0].free( start_pos+run_start, i-run_start, std::memory_order::release,
+                                        _guard() );
+            }
+            if( !alloc_reentrant )
+                mutex_.unlock();
+
+            _notify_waiters();
+            return end_pos_;
+        }
+
+        recorder::record( trace_op::alloc, start_pos, len );
+        return start_pos;
+    }
+
+    /**
+     * Wake the threads and coroutines waiting for bits after some were freed.
+     */
+    void _notify_waiters() noexcept {
+        if constexpr( support_waiting ) {
+            // a waiter either sees the freed bits, or is seen here (see alloc_wait)
+            std::atomic_thread_fence( std::memory_order::seq_cst );
+            if( wait_.waiters_.load( std::memory_order::relaxed ) != 0 ) {
+                wait_.generation_.fetch_add( 1, std::memory_order::release );
+                _wake_all( wait_.generation_ );
+            }
+            // a drain in progress has taken the waiters from the list, so it needs to know about this free as well
+            auto& co_waiters = _co_waiter_list::of( this );
+            if( co_waiters.needs_drain() )
+                co_waiters.drain();
+        }
+    }
+    /**
+     * Return the guard of the multi-word changes.
+     */
+    guard_type* _guard() const noexcept {
+        if constexpr( guard_in_header )
+            return &multi_word_guard_;
+        else
+            return &_process_guard( this );
+    }
+    /**
+     * Split the words of the bitmap in `n_threads` chunks of whole cache lines, and call `f( begin_word, end_word,
+     * index )` for each chunk, on the calling thread and the workers of the `_worker_pool`. Bitmaps smaller than the
+     * `_parallel_threshold` are not worth waking the workers, so their chunks are processed by the calling thread.
+     */
+    template<typename F>
+    void _parallel_for( size_t n_threads, F f ) const {
+        static constexpr size_t words_per_line = std::max<size_t>( 64/sizeof( W ), 1 );
+        const auto n_words = end_pos_/bit_allocator<W>::bits_per_word;
+        n_threads = std::max<size_t>( n_threads, 1 );
+        const auto chunk = (( n_words + n_threads-1 )/n_threads + words_per_line-1 )/words_per_line*words_per_line;
+        const auto n_chunks = std::min( n_threads, ( n_words + chunk-1 )/std::max<size_t>( chunk, 1 ));
+
+        auto task = [&]( size_t t ) { f( t*chunk, std::min(( t+1 )*chunk, n_words ), t ); };
+        if( n_chunks <= 1 || n_words*sizeof( W ) < _parallel_threshold ) {
+            for( auto t = 0ul; t < std::max<size_t>( n_chunks, 1 ); ++t )
+                task( t );
+        } else
+            _worker_pool::instance().run( n_chunks, task );
+    }
+    /**
+     * Set or unset all bits, split among `n_threads` threads.
+     */
+    void _fill( bool set, size_t n_threads ) {
+        const auto n_words = end_pos_/bit_allocator<W>::bits_per_word;
+
+        if( !alloc_reentrant )
+            mutex_.lock();
+        _parallel_for( n_threads, [this, set, n_words]( size_t begin, size_t end, size_t ) {
+            _fill_bits( data() + begin, end-begin, set );
+            if constexpr( track_lengths )
+                _fill_bits( data() + n_words + begin, end-begin, false );
+            if constexpr( owner_tags )
+                std::memset( _owners() + begin*bit_allocator<W>::bits_per_word, 0,
+                             ( end-begin )*bit_allocator<W>::bits_per_word*sizeof( _owner_t ));
+        } );
+        // all bits are a single allocation after fill()
+        if( set )
+            _mark_end( 0, end_pos_ );
+        if( !alloc_reentrant )
+            mutex_.unlock();
+    }
+
+    /**
+     * The free runs of a chunk of the bitmap, which are stitched together with those of the neighbouring chunks.
+     */
+    struct _chunk_runs {
+        size_t begin = 0;
+        size_t end = 0;
+        size_t prefix = 0;      // free bits at the beginning
+        size_t suffix = 0;      // free bits at the end
+        size_t largest = 0;     // the longest free run within the chunk
+        size_t first_fit = 0;   // the first free run of the requested length within the chunk, or `end`
+    };
+    /**
+     * Scan the bits [`begin`, `end`) for their free runs.
+     */
+    _chunk_runs _scan_runs( size_t begin, size_t end, size_t len, std::memory_order mo ) const noexcept {
+        _chunk_runs c{ begin, end, 0, 0, 0, end };
+        for( auto pos = begin; pos < end; ) {
+            const auto start = bit_allocator_[0].find_first_unset( pos, end, mo );
+            pos = bit_allocator_[0].find_first_set( start, end, mo );
+            if( start == begin )
+                c.prefix = pos-start;
+            if( pos == end )
+                c.suffix = pos-start;
+            if( pos-start >= len && c.first_fit == end )
+                c.first_fit = start;
+            c.largest = std::max( c.largest, pos-start );
+        }
+        return c;
+    }
+    /**
+     * Scan the bitmap in `n_threads` chunks in parallel.
+     * @return The free runs of each chunk, the unused ones being empty
+     */
+    std::unique_ptr<_chunk_runs[]> _scan_runs( size_t len, size_t n_threads, std::memory_order mo ) const {
+        n_threads = std::max<size_t>( n_threads, 1 );
+        auto chunks = std::make_unique<_chunk_runs[]>( n_threads );
+
+        if( !alloc_reentrant )
+            mutex_.lock();
+        _parallel_for( n_threads, [&]( size_t begin, size_t end, size_t t ) {
+            const auto bits_per_word = bit_allocator<W>::bits_per_word;
+            chunks[t] = _scan_runs( begin*bits_per_word, end*bits_per_word, len, mo );
+        } );
+        if( !alloc_reentrant )
+            mutex_.unlock();
+        return chunks;
     }
 
     const size_t end_pos_;
+    // the members that are not needed take no space, so the bitmap of the default allocator follows `end_pos_`
+    [[no_unique_address]] std::conditional_t<support_waiting, _wait_state, _no_wait_state> wait_;
+    // serializes the backends that are not reentrant
+    [[no_unique_address]] mutable std::conditional_t<alloc_reentrant, _no_mutex, _futex_mutex> mutex_;
+    [[no_unique_address]] mutable std::conditional_t<guard_in_header, guard_type, _no_guard> multi_word_guard_;
+    [[no_unique_address]] placement placement_;
     bit_allocator<W> bit_allocator_[1];
 };
 
@@ -0,0 +1,503 @@
+/*
+ * Copyright 2026 The atomic_bit_allocator contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <new>
+#include <ostream>
+#include <stdexcept>
+#include <vector>
+#include "atomic_bit_allocator.h"
+
+
+namespace jps {
+
+/**
+ * Whether words of type `W` hold the bits of a bitmap in its canonical order, where the bits are in little-endian
+ * integers of 64 bits, each from its most significant bit on, i.e. bit `i` is bit `63 - i%64` of the integer in the
+ * bytes from `i/64*8` on. The last integer is shortened to the bytes of the bits left, from its most significant byte
+ * on. As the bitmap is stored from the most significant bit of each word on, this is the case for 64-bit words on
+ * little-endian machines, which use the canonical bytes in place.
+ */
+template<typename W>
+inline constexpr bool is_canonical_layout = sizeof( W ) == 8 && std::endian::native == std::endian::little;
+
+template<typename T>
+constexpr T _byteswap( T v ) noexcept {
+    if constexpr( sizeof( T ) == 1 )
+        return v;
+    else if constexpr( sizeof( T ) == 2 )
+        return T( __builtin_bswap16( uint16_t( v )));
+    else if constexpr( sizeof( T ) == 4 )
+        return T( __builtin_bswap32( uint32_t( v )));
+    else if constexpr( sizeof( T ) == 8 )
+        return T( __builtin_bswap64( uint64_t( v )));
+    else {
+        static_assert( sizeof( T ) == 16 );
+        return T( T( __builtin_bswap64( uint64_t( v ))) << 64 | __builtin_bswap64( uint64_t( v >> 64 )));
+    }
+}
+
+/**
+ * Convert an integer between native and little-endian byte order.
+ */
+template<typename T>
+constexpr T _little_endian( T v ) noexcept {
+    if constexpr( std::endian::native == std::endian::little )
+        return v;
+    else
+        return _byteswap( v );
+}
+
+/**
+ * Return the integer of the `n_bytes` bytes, at most 8, in canonical order at `in`, as its most significant bits.
+ */
+inline uint64_t _load_group( const unsigned char* in, size_t n_bytes ) noexcept {
+    uint64_t v = 0;
+    std::memcpy( &v, in, n_bytes );
+    return _little_endian( v ) << ( 64 - 8*n_bytes );
+}
+
+/**
+ * Store the most significant `n_bytes` bytes, at least 1, of `v` in canonical order at `out`.
+ */
+inline void _store_group( unsigned char* out, uint64_t v, size_t n_bytes ) noexcept {
+    v = _little_endian( v >> ( 64 - 8*n_bytes ));
+    std::memcpy( out, &v, n_bytes );
+}
+
+/**
+ * Convert the first `n_bits` bits of `words` to `n_bits/8` bytes in canonical order at `out`, which may be `words`
+ * itself. `n_bits` has to be a multiple of 8.
+ */
+template<typename W>
+void to_canonical( const W* words, size_t n_bits, void* out ) noexcept {
+    static constexpr size_t bits_per_word = 8*sizeof( W );
+    static constexpr size_t unit_bytes = std::max<size_t>( sizeof( W ), 8 );
+    auto* bytes = static_cast<unsigned char*>( out );
+    const auto n_bytes = n_bits/8;
+    const auto n_words = ( n_bits + bits_per_word-1 )/bits_per_word;
+
+    // the integers and the words are converted a unit at a time, which is read before it is written
+    size_t unit = 0;
+    if constexpr( is_canonical_layout<W> ) {
+        unit = n_bytes/8*8;
+        if( static_cast<const void*>( words ) != out )
+            std::memmove( out, words, unit );
+    }
+    for( ; unit < n_bytes; unit += unit_bytes ) {
+        if constexpr( sizeof( W ) > 8 ) {
+            const auto word = words[unit/sizeof( W )];
+            _store_group( bytes+unit, uint64_t( word >> 64 ), std::min<size_t>( 8, n_bytes-unit ));
+            if( n_bytes-unit > 8 )
+                _store_group( bytes+unit+8, uint64_t( word ), std::min<size_t>( 8, n_bytes-unit-8 ));
+        }
+        else {
+            uint64_t v = 0;
+            for( auto w = unit/sizeof( W ); w < std::min( ( unit+8 )/sizeof( W ), n_words ); ++w )
+                v |= uint64_t( words[w] ) << ( 64 - ( w+1 - unit/sizeof( W ))*bits_per_word );
+            _store_group( bytes+unit, v, std::min<size_t>( 8, n_bytes-unit ));
+        }
+    }
+}
+
+/**
+ * Convert `n_bits/8` bytes in canonical order at `in`, which may be `words` itself, to the first `n_bits` bits of
+ * `words`. The bits of a last, partial word are unset. `n_bits` has to be a multiple of 8.
+ */
+template<typename W>
+void from_canonical( const void* in, size_t n_bits, W* words ) noexcept {
+    static constexpr size_t bits_per_word = 8*sizeof( W );
+    static constexpr size_t unit_bytes = std::max<size_t>( sizeof( W ), 8 );
+    const auto* bytes = static_cast<const unsigned char*>( in );
+    const auto n_bytes = n_bits/8;
+    const auto n_words = ( n_bits + bits_per_word-1 )/bits_per_word;
+
+    size_t unit = 0;
+    if constexpr( is_canonical_layout<W> ) {
+        unit = n_bytes/8*8;
+        if( in != static_cast<const void*>( words ))
+            std::memmove( words, in, unit );
+    }
+    for( ; unit < n_bytes; unit += unit_bytes ) {
+        if constexpr( sizeof( W ) > 8 ) {
+            const auto high = _load_group( bytes+unit, std::min<size_t>( 8, n_bytes-unit ));
+            const auto low = n_bytes-unit > 8 ? _load_group( bytes+unit+8, std::min<size_t>( 8, n_bytes-unit-8 )) : 0;
+            words[unit/sizeof( W )] = W( W( high ) << 64 | low );
+        }
+        else {
+            const auto v = _load_group( bytes+unit, std::min<size_t>( 8, n_bytes-unit ));
+            for( auto w = unit/sizeof( W ); w < std::min( ( unit+8 )/sizeof( W ), n_words ); ++w )
+                words[w] = W( v >> ( 64 - ( w+1 - unit/sizeof( W ))*bits_per_word ));
+        }
+    }
+}
+
+/**
+ * Load the bitmap of an allocator from `allocator.size()/8` bytes in canonical order, e.g. a file read into memory,
+ * converting them to the layout of its words. The bytes are only read, so a shared mapping of a file is not changed.
+ * Like `data()`, this is not synchronized with other threads, which is meant for freshly constructed allocators.
+ */
+template<typename BA>
+void load_canonical( BA& allocator, const void* bytes ) noexcept {
+    static_assert( !BA::tracks_lengths && !BA::has_owner_tags, "the companion regions are not part of the bitmap" );
+    from_canonical( bytes, allocator.size(), allocator.data() );
+}
+
+/**
+ * Store a consistent snapshot of an allocator's bitmap in canonical order, `allocator.size()/8` bytes into `out`,
+ * which must be aligned for the words of the allocator.
+ */
+template<typename BA>
+void store_canonical( const BA& allocator, void* out ) {
+    using W = typename BA::WordT;
+    static_assert( !BA::tracks_lengths && !BA::has_owner_tags, "the companion regions are not part of the bitmap" );
+
+    auto* words = static_cast<W*>( out );
+    allocator.snapshot( words );
+    to_canonical( words, allocator.size(), out );
+}
+
+/**
+ * Return the offset of the bitmap in the buffer of an allocator of type `BA`, where `attach_canonical` expects it.
+ */
+template<typename BA>
+size_t bitmap_offset() noexcept {
+    const BA probe;
+    return size_t( reinterpret_cast<const char*>( probe.data() ) - reinterpret_cast<const char*>( &probe ));
+}
+
+/**
+ * Construct an allocator of type `BA` in `buffer` around a bitmap in canonical order that is in place already,
+ * `bitmap_offset<BA>()` bytes into it, e.g. a file read or mapped there. If `is_canonical_layout<W>`, the bitmap is
+ * used as it is, and only its first bytes, which lie within the allocator object, are copied around the
+ * construction; otherwise it is converted in place once.
+ * @return The allocator
+ */
+template<typename BA>
+BA* attach_canonical( void* buffer, size_t buffer_len ) noexcept {
+    static_assert( !BA::tracks_lengths && !BA::has_owner_tags, "the companion regions are not part of the bitmap" );
+
+    // the constructor clears the bytes of the bitmap within the allocator object, and leaves the rest as it is
+    const auto offset = bitmap_offset<BA>();
+    char head[sizeof( BA )];
+    std::memcpy( head, static_cast<char*>( buffer ) + offset, sizeof( BA )-offset );
+    auto* allocator = new ( buffer ) BA( buffer_len );
+    std::memcpy( allocator->data(), head, sizeof( BA )-offset );
+    from_canonical( allocator->data(), allocator->size(), allocator->data() );
+    return allocator;
+}
+
+/*
+ * The compressed format of a bitmap: a header of 8 magic bytes, the format version, the word size it was written
+ * with, and the number of bits, followed by one container per chunk of `bitmap_chunk_bits` bits (the last one may be
+ * shorter). A container starts with its type:
+ *
+ *     zero    no payload, all bits of the chunk are unset
+ *     one     no payload, all bits of the chunk are set
+ *     runs    the number of runs of set bits as uint16, followed by the start and length-1 of each run as uint16,
+ *             relative to the chunk
+ *     raw     the bits of the chunk in canonical order
+ *
+ * All integers are stored in little-endian byte order, so a bitmap can be restored on any machine, and into an
+ * allocator of any word size.
+ */
+static constexpr size_t bitmap_chunk_bits = 65536;
+
+enum class bitmap_container : uint8_t {
+    zero = 0,
+    one = 1,
+    runs = 2,
+    raw = 3,
+};
+
+
+/**
+ * Return the number of runs of set bits in the `n_words` words of `words`.
+ */
+template<typename W>
+size_t _count_runs( const W* words, size_t n_words ) {
+    static constexpr size_t bits_per_word = 8*sizeof( W );
+
+    // a run starts at each set bit whose predecessor, the next more significant bit, is unset
+    size_t n_runs = 0;
+    W prev = 0;
+    for( auto w = 0ul; w < n_words; ++w ) {
+        const auto bits = words[w];
+        const auto predecessors = W( bits >> 1 | W( prev << ( bits_per_word-1 )));
+        n_runs += _popcount( W( bits & ~predecessors ));
+        prev = bits;
+    }
+    return n_runs;
+}
+
+/**
+ * Return the runs of set bits in the `n_bits` bits of `words`, as pairs of start and length.
+ */
+template<typename W>
+void _find_runs( const W* words, size_t n_bits, std::vector<std::pair<uint32_t, uint32_t>>& runs ) {
+    static constexpr size_t bits_per_word = 8*sizeof( W );
+
+    runs.clear();
+    size_t pos = 0;
+    while( pos < n_bits ) {
+        // skip unset bits
+        auto w = pos/bits_per_word;
+        auto bits = W( words[w] << pos%bits_per_word );
+        if( bits == 0 ) {
+            pos = ( w+1 )*bits_per_word;
+            continue;
+        }
+        const auto start = pos + _countl_zero( bits );
+
+        // find the end of the run
+        pos = start;
+        while( pos < n_bits ) {
+            w = pos/bits_per_word;
+            bits = W( ~W( words[w] << pos%bits_per_word ));
+            const auto ones = std::min<size_t>( _countl_zero( bits ), bits_per_word - pos%bits_per_word );
+            pos += ones;
+            if( ones == 0 || pos%bits_per_word != 0 )
+                break;
+        }
+        runs.emplace_back( uint32_t( start ), uint32_t( pos-start ));
+    }
+}
+
+/**
+ * Set the bits [`start`, `start+len`) of `words`.
+ */
+template<typename W>
+void _set_range( W* words, size_t start, size_t len ) {
+    static constexpr size_t bits_per_word = 8*sizeof( W );
+
+    const auto end = start+len;
+    auto w = start/bits_per_word;
+    const auto last_word = ( end-1 )/bits_per_word;
+    const auto first_mask = W( ~W( 0 )) >> start%bits_per_word;
+    const auto last_mask = W( W( ~W( 0 )) << ( bits_per_word - 1 - ( end-1 )%bits_per_word ));
+
+    if( w == last_word ) {
+        words[w] |= first_mask & last_mask;
+        return;
+    }
+    words[w++] |= first_mask;
+    std::memset( words+w, 0xff, ( last_word-w )*sizeof( W ));
+    words[last_word] |= last_mask;
+}
+
+
+/**
+ * Write the first `n_bits` bits of `words` in the compressed format. `n_bits` has to be a multiple of the word size.
+ */
+template<typename W>
+void write_bitmap( std::ostream& os, const W* words, size_t n_bits ) {
+    static constexpr size_t bits_per_word = 8*sizeof( W );
+    static_assert( bitmap_chunk_bits % bits_per_word == 0 );
+
+    const auto version = _little_endian( uint32_t( 2 ));
+    const auto word_size = _little_endian( uint32_t( sizeof( W )));
+    const auto bits = _little_endian( uint64_t( n_bits ));
+    os.write( "JPSBITMP", 8 );
+    os.write( reinterpret_cast<const char*>( &version ), sizeof( version ));
+    os.write( reinterpret_cast<const char*>( &word_size ), sizeof( word_size ));
+    os.write( reinterpret_cast<const char*>( &bits ), sizeof( bits ));
+
+    std::vector<std::pair<uint32_t, uint32_t>> runs;
+    std::vector<uint16_t> payload;
+    std::vector<unsigned char> canonical;
+    for( size_t chunk = 0; chunk < n_bits; chunk += bitmap_chunk_bits ) {
+        const auto* chunk_words = words + chunk/bits_per_word;
+        const auto chunk_bits = std::min( bitmap_chunk_bits, n_bits-chunk );
+        const auto n_words = chunk_bits/bits_per_word;
+
+        auto type = bitmap_container::raw;
+        if( std::all_of( chunk_words, chunk_words+n_words, []( W w ) { return w == W( 0 ); } ))
+            type = bitmap_container::zero;
+        else if( std::all_of( chunk_words, chunk_words+n_words, []( W w ) { return w == W( ~W( 0 )); } ))
+            type = bitmap_container::one;
+        else if(( 1 + 2*_count_runs( chunk_words, n_words ))*sizeof( uint16_t ) < n_words*sizeof( W ))
+            type = bitmap_container::runs;
+
+        os.put( char( type ));
+        switch( type ) {
+            case bitmap_container::zero:
+            case bitmap_container::one:
+                break;
+
+            case bitmap_container::runs:
+                _find_runs( chunk_words, chunk_bits, runs );
+                payload.clear();
+                payload.push_back( _little_endian( uint16_t( runs.size() )));
+                for( const auto& [start, len]: runs ) {
+                    payload.push_back( _little_endian( uint16_t( start )));
+                    payload.push_back( _little_endian( uint16_t( len-1 )));
+                }
+                os.write( reinterpret_cast<const char*>( payload.data() ),
+                          std::streamsize( payload.size()*sizeof( uint16_t )));
+                break;
+
+            case bitmap_container::raw:
+                if constexpr( is_canonical_layout<W> )
+                    os.write( reinterpret_cast<const char*>( chunk_words ), std::streamsize( n_words*sizeof( W )));
+                else {
+                    canonical.resize( chunk_bits/8 );
+                    to_canonical( chunk_words, chunk_bits, canonical.data() );
+                    os.write( reinterpret_cast<const char*>( canonical.data() ), std::streamsize( canonical.size() ));
+                }
+                break;
+        }
+    }
+}
+
+/**
+ * The header of a compressed bitmap.
+ */
+struct bitmap_header {
+    uint32_t version;
+    uint32_t word_size;     // of the allocator it was written from
+    uint64_t n_bits;
+};
+
+/**
+ * Read the header of a bitmap written by `write_bitmap`, and check that it can be restored into words of type `W`.
+ */
+template<typename W>
+bitmap_header read_bitmap_header( std::istream& is ) {
+    char magic[8];
+    bitmap_header header{};
+
+    is.read( magic, sizeof( magic ));
+    is.read( reinterpret_cast<char*>( &header.version ), sizeof( header.version ));
+    is.read( reinterpret_cast<char*>( &header.word_size ), sizeof( header.word_size ));
+    is.read( reinterpret_cast<char*>( &header.n_bits ), sizeof( header.n_bits ));
+    if( !is || std::memcmp( magic, "JPSBITMP", 8 ) != 0 )
+        throw std::runtime_error( "not a compressed bitmap" );
+
+    header.version = _little_endian( header.version );
+    header.word_size = _little_endian( header.word_size );
+    header.n_bits = _little_endian( header.n_bits );
+    if( header.version != 2 || header.n_bits % 8 != 0 )
+        throw std::runtime_error( "not a compressed bitmap of a known version" );
+    return header;
+}
+
+/**
+ * Read the containers of a bitmap, whose `header` was read already, into `words`. The bits of a last, partial word
+ * are unset.
+ */
+template<typename W>
+void read_bitmap( std::istream& is, W* words, const bitmap_header& header ) {
+    static constexpr size_t bits_per_word = 8*sizeof( W );
+    static_assert( bitmap_chunk_bits % bits_per_word == 0 );
+    const auto n_bits = header.n_bits;
+
+    std::vector<uint16_t> payload;
+    for( size_t chunk = 0; chunk < n_bits; chunk += bitmap_chunk_bits ) {
+        auto* chunk_words = words + chunk/bits_per_word;
+        const auto chunk_bits = std::min<size_t>( bitmap_chunk_bits, n_bits-chunk );
+        const auto n_words = ( chunk_bits + bits_per_word-1 )/bits_per_word;
+
+        const auto type = bitmap_container( is.get() );
+        switch( type ) {
+            case bitmap_container::zero:
+                std::memset( chunk_words, 0, n_words*sizeof( W ));
+                break;
+
+            case bitmap_container::one:
+                std::memset( chunk_words, 0, n_words*sizeof( W ));
+                _set_range( chunk_words, 0, chunk_bits );
+                break;
+
+            case bitmap_container::runs: {
+                uint16_t n_runs;
+                is.read( reinterpret_cast<char*>( &n_runs ), sizeof( n_runs ));
+                n_runs = _little_endian( n_runs );
+                payload.resize( 2*size_t( n_runs ));
+                is.read( reinterpret_cast<char*>( payload.data() ),
+                         std::streamsize( payload.size()*sizeof( uint16_t )));
+                for( auto& v: payload )
+                    v = _little_endian( v );
+
+                std::memset( chunk_words, 0, n_words*sizeof( W ));
+                for( auto r = 0ul; r < n_runs; ++r ) {
+                    const size_t start = payload[2*r];
+                    const size_t len = size_t( payload[2*r+1] ) + 1;
+                    if( start+len > chunk_bits )
+                        throw std::runtime_error( "corrupt compressed bitmap" );
+                    _set_range( chunk_words, start, len );
+                }
+                break;
+            }
+
+            case bitmap_container::raw:
+                // the canonical bytes fit into the words, whatever their size, and are converted in place
+                is.read( reinterpret_cast<char*>( chunk_words ), std::streamsize( chunk_bits/8 ));
+                from_canonical( chunk_words, chunk_bits, chunk_words );
+                break;
+
+            default:
+                throw std::runtime_error( "corrupt compressed bitmap" );
+        }
+        if( !is )
+            throw std::runtime_error( "truncated compressed bitmap" );
+    }
+}
+
+
+/**
+ * Write a consistent snapshot of an allocator's bitmap in the compressed format. The snapshot is taken into a
+ * temporary copy of the bitmap. Allocators that track lengths or owners are not supported, as their companion regions
+ * would be lost.
+ */
+template<typename BA>
+void export_bitmap( std::ostream& os, const BA& allocator ) {
+    using W = typename BA::WordT;
+    static_assert( !BA::tracks_lengths && !BA::has_owner_tags, "only the bitmap is exported, not its companions" );
+
+    std::vector<W> copy( allocator.size()/( 8*sizeof( W )));
+    allocator.snapshot( copy.data() );
+    write_bitmap( os, copy.data(), allocator.size() );
+}
+
+/**
+ * Construct an allocator of type `BA` in `buffer` and restore a bitmap written by `export_bitmap` straight into it.
+ * The allocator may be larger than the exported one, and of another word size; the additional bits are unset.
+ * @return The allocator
+ */
+template<typename BA>
+BA* import_bitmap( std::istream& is, void* buffer, size_t buffer_len ) {
+    using W = typename BA::WordT;
+    static_assert( !BA::tracks_lengths && !BA::has_owner_tags, "only the bitmap is imported, not its companions" );
+
+    const auto header = read_bitmap_header<W>( is );
+    auto* allocator = new ( buffer ) BA( buffer_len );
+    const auto n_words = ( header.n_bits + 8*sizeof( W )-1 )/( 8*sizeof( W ));
+    if( n_words*8*sizeof( W ) > allocator->size() )
+        throw std::runtime_error( "buffer too small for the compressed bitmap" );
+
+    read_bitmap( is, allocator->data(), header );
+    std::memset( allocator->data() + n_words, 0, allocator->size()/8 - n_words*sizeof( W ));
+    return allocator;
+}
+
+}
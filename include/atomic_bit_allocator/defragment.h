@@ -0,0 +1,372 @@
+/*
+ * Copyright 2026 The atomic_bit_allocator contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "atomic_bit_allocator.h"
+
+
+namespace jps {
+
+/**
+ * A move of the allocated range [`old_pos`, `old_pos+len`) to [`new_pos`, `new_pos+len`).
+ */
+struct relocation {
+    size_t old_pos;
+    size_t new_pos;
+    size_t len;
+};
+
+
+/**
+ * Plans the moves that free a run of at least `target_len` bits in a `serialized_bit_allocator` whose free space is
+ * too fragmented for it, and applies them one at a time.
+ *
+ * The planner works on a private copy of the bitmap. It picks the window of `target_len` bits, at word granularity,
+ * with the fewest allocated bits, and moves each run of allocated bits overlapping it to the next free range
+ * outside of it, searching on from the previous destination. A run may consist of several adjacent allocations,
+ * which keep their offsets within the run. All work is done in `step()`, with a bounded amount per call, so the
+ * planner can run in the background while other threads keep allocating and freeing. The runs at the edges of the
+ * sliding window are carried along rather than searched for, and the searches for runs and their destinations
+ * resume where the previous step stopped, so no step scans more words than its budget.
+ *
+ * The owner of the payload applies a move by `begin()`, which reserves the destination and copies the owner tags, if
+ * any, copying the payload, and `commit()`, which frees the source. The ranges of a move must stay allocated until
+ * then. As the bitmap changes while planning, `begin()` fails if another thread took the destination in the meantime.
+ * The copy is read a word at a time rather than as a `snapshot()`, so it may also show a change spanning multiple
+ * words only in part. `begin()` is the only check of a plan against the bitmap, which is why the owner has to know
+ * the sources to be its own allocations.
+ */
+template<typename BA>
+class defragmenter {
+    using W = typename BA::WordT;
+    using backend = _single_threaded_bit_allocator<W>;
+
+    static_assert( !BA::tracks_lengths, "the ends of track_lengths are not moved" );
+
+public:
+    enum class phase { copy, scan, plan, done, failed };
+
+    defragmenter( BA& ba, size_t target_len ) :
+            ba_( ba ),
+            target_len_( target_len ),
+            n_words_( ba.size()/backend::bits_per_word ),
+            window_words_(( target_len + backend::bits_per_word-1 )/backend::bits_per_word ),
+            words_( std::make_unique<backend[]>( n_words_ ))
+    {
+        if( target_len_ == 0 || window_words_ > n_words_ )
+            phase_ = phase::failed;
+    }
+
+    /**
+     * Do a bounded amount of planning: copy, scan or search up to `budget` words of the bitmap, depending on the
+     * phase.
+     * @return False once the plan is complete or cannot be made
+     */
+    bool step( size_t budget = 64 ) {
+        switch( phase_ ) {
+            case phase::copy:
+                _copy( budget );
+                break;
+            case phase::scan:
+                _scan( budget );
+                break;
+            case phase::plan:
+                _plan( std::max<size_t>( budget, 1 )*backend::bits_per_word );
+                break;
+            case phase::done:
+            case phase::failed:
+                break;
+        }
+        return phase_ != phase::done && phase_ != phase::failed;
+    }
+    /**
+     * Plan all at once.
+     * @return True if there is a plan
+     */
+    bool run() {
+        while( step( n_words_ ))
+            ;
+        return phase_ == phase::done;
+    }
+
+    [[nodiscard]] phase state() const noexcept { return phase_; }
+    /**
+     * The moves planned so far, which are complete in `phase::done`.
+     */
+    [[nodiscard]] const std::vector<relocation>& plan() const noexcept { return plan_; }
+    /**
+     * The start of the run of at least `target_len` bits that is free after the plan was applied.
+     */
+    [[nodiscard]] size_t window() const noexcept { return window_begin_*backend::bits_per_word; }
+    /**
+     * The number of bits to move.
+     */
+    [[nodiscard]] size_t cost() const noexcept { return cost_; }
+
+    /**
+     * Reserve the destination of `m` in the allocator.
+     * @return False if it is not free anymore
+     */
+    [[nodiscard]] bool begin( const relocation& m ) {
+        if( !ba_.reserve_range( m.new_pos, m.len ))
+            return false;
+        if constexpr( BA::has_owner_tags )
+            ba_.copy_owners( m.old_pos, m.new_pos, m.len );
+        return true;
+    }
+    /**
+     * Free the source of `m` after its payload was copied.
+     */
+    void commit( const relocation& m ) {
+        ba_.free( m.old_pos, m.len );
+    }
+    /**
+     * Give up on `m` after `begin()`, which frees its destination again.
+     */
+    void abort( const relocation& m ) {
+        ba_.free( m.new_pos, m.len );
+    }
+
+private:
+    /**
+     * Copy up to `budget` words, and count the allocated bits of the first window and the free bits along.
+     */
+    void _copy( size_t budget ) {
+        const auto end = std::min( copied_ + budget, n_words_ );
+        for( ; copied_ < end; ++copied_ ) {
+            words_[copied_] = std::atomic_ref<W>( ba_.data()[copied_] ).load( std::memory_order::relaxed );
+            const auto used = words_[copied_].usage();
+            if( copied_ < window_words_ )
+                window_used_ += used;
+            free_bits_ += backend::bits_per_word - used;
+        }
+
+        if( copied_ == n_words_ ) {
+            _keep( 0, window_used_, _cost( 0, window_used_ ));
+            phase_ = phase::scan;
+        }
+    }
+    /**
+     * Slide the window over the copy, and keep the last of the ones with the fewest bits to move.
+     */
+    void _scan( size_t budget ) {
+        const auto last_begin = n_words_ - window_words_;
+        for( auto i = 0ul; i < budget && scanned_ < last_begin; ++i ) {
+            // the run of allocated bits before the window grows by the word leaving it, or starts within that word
+            const auto left_word = scanned_*backend::bits_per_word;
+            if( words_[scanned_].usage() != backend::bits_per_word )
+                left_start_ = words_[0].find_last_unset( left_word, left_word + backend::bits_per_word );
+            ++scanned_;
+            window_used_ += words_[scanned_ + window_words_-1].usage();
+            window_used_ -= words_[scanned_-1].usage();
+            const auto cost = _cost( scanned_, window_used_ );
+            if( cost <= best_cost_ )
+                _keep( scanned_, window_used_, cost );
+        }
+
+        if( scanned_ == last_begin ) {
+            // the moved bits must fit outside of the window
+            const auto window_bits = window_words_*backend::bits_per_word;
+            phase_ = free_bits_ - ( window_bits - best_used_ ) < best_cost_ ? phase::failed : phase::plan;
+            cursor_ = plan_begin_;
+        }
+    }
+    /**
+     * Keep the window at `begin_word` as the best one so far, together with the runs crossing its edges, which
+     * `_cost` just carried along.
+     */
+    void _keep( size_t begin_word, size_t used, size_t cost ) noexcept {
+        const auto begin = begin_word*backend::bits_per_word;
+        const auto end = begin + window_words_*backend::bits_per_word;
+
+        window_begin_ = begin_word;
+        best_used_ = used;
+        best_cost_ = cost;
+        plan_begin_ = used != 0 && _is_set( begin ) ? left_start_ : begin;
+        plan_end_ = used != 0 && end < n_words_*backend::bits_per_word && _is_set( end-1 ) ? right_end_ : end;
+    }
+    /**
+     * Return the number of bits to move to free the window at `begin_word` with `used` allocated bits, including
+     * the parts of runs crossing its edges. The window must not move backwards, as the runs at its edges are carried
+     * along: `left_start_` by `_scan`, and `right_end_` here, which only moves forward, so sliding the window over the
+     * whole bitmap scans each bit at most once.
+     */
+    size_t _cost( size_t begin_word, size_t used ) noexcept {
+        const auto begin = begin_word*backend::bits_per_word;
+        const auto end = begin + window_words_*backend::bits_per_word;
+        const auto end_pos = n_words_*backend::bits_per_word;
+
+        if( used != 0 && _is_set( begin ))
+            used += begin - left_start_;
+        if( used != 0 && end < end_pos && _is_set( end-1 )) {
+            if( right_end_ <= end )
+                right_end_ = words_[0].find_first_unset( end, end_pos );
+            used += right_end_ - end;
+        }
+        return used;
+    }
+    bool _is_set( size_t pos ) const noexcept {
+        return words_[0].find_first_set( pos, pos+1 ) == pos;
+    }
+    /**
+     * Move the runs of allocated bits overlapping the window out of it, in the copy, until `budget` bits were
+     * scanned. Each run is found from `cursor_` on, and its destination from `dest_` on: the next fit, then the free
+     * space before it. Both searches resume in the next step where the budget ran out.
+     */
+    void _plan( size_t budget ) {
+        const auto end_pos = n_words_*backend::bits_per_word;
+
+        while( budget != 0 && phase_ == phase::plan ) {
+            switch( planning_ ) {
+                case planning::run:
+                    if( !_scan_to( true, cursor_, plan_end_, budget ))
+                        break;
+                    if( cursor_ == plan_end_ ) {
+                        phase_ = phase::done;
+                        break;
+                    }
+                    run_end_ = cursor_;
+                    planning_ = planning::run_end;
+                    break;
+
+                case planning::run_end:
+                    // a run crossing the edges of the window is moved as a whole
+                    if( !_scan_to( false, run_end_, plan_end_, budget ))
+                        break;
+                    search_ = dest_;
+                    search_end_ = end_pos;
+                    free_start_ = end_pos;
+                    wrapped_ = false;
+                    planning_ = planning::destination;
+                    break;
+
+                case planning::destination:
+                    if( _find_destination( budget ))
+                        planning_ = planning::run;
+                    break;
+            }
+        }
+    }
+    /**
+     * Search on for a free range outside of the window for the run [`cursor_`, `run_end_`), and move it there.
+     * @return True if the run was moved
+     */
+    bool _find_destination( size_t& budget ) {
+        const auto window_end = ( window_begin_ + window_words_ )*backend::bits_per_word;
+        const auto end_pos = n_words_*backend::bits_per_word;
+        const auto len = run_end_ - cursor_;
+
+        while( budget != 0 ) {
+            if( search_ >= search_end_ ) {
+                if( wrapped_ ) {
+                    phase_ = phase::failed;
+                    return false;
+                }
+                wrapped_ = true;
+                search_ = 0;
+                search_end_ = std::min( dest_ + len-1, end_pos );
+                free_start_ = end_pos;
+                continue;
+            }
+            if( window() <= search_ && search_ < window_end ) {
+                search_ = window_end;
+                free_start_ = end_pos;
+                continue;
+            }
+
+            const auto stop = search_ < window() ? std::min( search_end_, window() ) : search_end_;
+            if( free_start_ == end_pos ) {
+                if( !_scan_to( false, search_, stop, budget ))
+                    return false;
+                if( search_ == stop )
+                    continue;
+                free_start_ = search_;
+            }
+            if( free_start_ + len > stop ) {
+                search_ = stop;
+                free_start_ = end_pos;
+                continue;
+            }
+            if( !_scan_to( true, search_, free_start_ + len, budget ))
+                return false;
+            if( search_ != free_start_ + len ) {
+                free_start_ = end_pos;
+                continue;
+            }
+
+            [[maybe_unused]] const auto claimed = words_[0].claim_range( free_start_, len );
+            assert( claimed );
+            words_[0].free( cursor_, len );
+            plan_.push_back( { cursor_, free_start_, len } );
+            cost_ += len;
+            cursor_ = run_end_;
+            dest_ = free_start_ + len;
+            return true;
+        }
+        return false;
+    }
+    /**
+     * Move `pos` to the first bit in [`pos`, `end`) that is `set`, or to `end`, looking at no more bits than
+     * `budget`, which is charged for them.
+     * @return False if the budget ran out before
+     */
+    bool _scan_to( bool set, size_t& pos, size_t end, size_t& budget ) const noexcept {
+        const auto limit = end-pos > budget ? pos+budget : end;
+        const auto found = set ? words_[0].find_first_set( pos, limit ) : words_[0].find_first_unset( pos, limit );
+        budget -= std::min( budget, found-pos + 1 );
+        pos = found;
+        return found < limit || limit == end;
+    }
+
+    BA& ba_;
+    const size_t target_len_;
+    const size_t n_words_;
+    const size_t window_words_;
+    std::unique_ptr<backend[]> words_;
+    phase phase_ = phase::copy;
+
+    size_t copied_ = 0;
+    size_t free_bits_ = 0;
+    size_t scanned_ = 0;
+    size_t window_used_ = 0;
+    size_t best_used_ = 0;
+    size_t best_cost_ = 0;
+    size_t window_begin_ = 0;
+    size_t left_start_ = 0;     // the start of the run of allocated bits that ends at the window, if any
+    size_t right_end_ = 0;      // the end of the run of allocated bits that starts after the window, if found yet
+    size_t plan_begin_ = 0;     // the bits to make free: the best window with the runs crossing its edges
+    size_t plan_end_ = 0;
+
+    enum class planning { run, run_end, destination };
+    planning planning_ = planning::run;
+    size_t cursor_ = 0;         // the start of the next run, or of the run being moved
+    size_t run_end_ = 0;
+    size_t dest_ = 0;           // where the search for the next destination starts
+    size_t search_ = 0;         // how far the search for the current destination got
+    size_t search_end_ = 0;
+    size_t free_start_ = 0;     // the start of the free range under `search_`, or the end of the bitmap
+    bool wrapped_ = false;      // whether the search went on with the free space before `dest_`
+    size_t cost_ = 0;
+    std::vector<relocation> plan_;
+};
+
+}
@@ -0,0 +1,234 @@
+/*
+ * Copyright 2026 The atomic_bit_allocator contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "atomic_bit_allocator.h"
+
+
+namespace jps {
+
+/**
+ * The preamble of a shared-memory segment, which tells attaching processes what the segment holds.
+ */
+struct _shm_preamble {
+    static constexpr uint64_t magic_value = 0x4d5354494253504aull;     // "JPSBITSM" in little endian
+    static constexpr uint32_t format_version = 1;
+
+    uint64_t magic;
+    uint32_t version;
+    uint32_t word_size;
+    uint64_t allocator_size;    // the size of the allocator type, which differs for most configurations
+    uint64_t buffer_len;
+    std::atomic<uint32_t> ready;
+};
+
+
+/**
+ * A `serialized_bit_allocator` of type `BA` in memory shared with other processes, whose waiters in `co_alloc` would
+ * be kept in the memory of one of them, where the frees of the others do not see them, so `co_alloc` is not
+ * available.
+ */
+template<typename BA>
+struct process_shared : BA {
+    using BA::BA;
+
+    template<typename... Args>
+    void co_alloc( Args&&... ) = delete;
+};
+
+
+/**
+ * A `serialized_bit_allocator` of type `BA` in memory shared by several processes, either a named POSIX shared-memory
+ * object or an anonymous mapping that forked processes inherit.
+ *
+ * The segment starts with a preamble of a magic number, a format version, and the layout of `BA`, followed by the
+ * allocator and its bitmap. `create` constructs the allocator and marks the segment ready last, and `attach` waits
+ * for that, and rejects segments of another format or allocator type.
+ *
+ * The lock-free backends work across processes as they are, though their snapshots are only consistent with the
+ * changes of the calling process. The others serialize on a futex in the buffer, which is shared between processes
+ * as well. The flat-combining backend keeps pointers into the memory of a process, so it is rejected, and so are the
+ * waiters of `co_alloc`, so the allocator is a `process_shared<BA>`, which has no `co_alloc`.
+ */
+template<typename BA>
+class shared_bit_allocator {
+    static_assert( !BA::is_process_local, "the flat-combining backend keeps pointers into the memory of a process" );
+
+public:
+    /**
+     * The allocator starts on its own cache line after the preamble.
+     */
+    static constexpr size_t allocator_offset = 64;
+    static_assert( sizeof( _shm_preamble ) <= allocator_offset && alignof( BA ) <= allocator_offset );
+    static_assert( sizeof( process_shared<BA> ) == sizeof( BA ));
+
+    /**
+     * Create the shared-memory object `name` with an allocator in a buffer of `buffer_len` bytes. This fails if the
+     * object exists.
+     */
+    static shared_bit_allocator create( const std::string& name, size_t buffer_len, mode_t mode = 0600 ) {
+        const auto fd = shm_open( name.c_str(), O_CREAT | O_EXCL | O_RDWR, mode );
+        if( fd < 0 )
+            throw std::system_error( errno, std::generic_category(), "shm_open " + name );
+
+        const auto map_len = allocator_offset + buffer_len;
+        if( ftruncate( fd, off_t( map_len )) != 0 ) {
+            const auto error = errno;
+            close( fd );
+            shm_unlink( name.c_str() );
+            throw std::system_error( error, std::generic_category(), "ftruncate " + name );
+        }
+        void* map;
+        try {
+            map = _map( fd, map_len );
+        }
+        catch( ... ) {
+            shm_unlink( name.c_str() );
+            throw;
+        }
+        shared_bit_allocator shm( map, map_len );
+        close( fd );
+
+        shm._construct( buffer_len );
+        return shm;
+    }
+    /**
+     * Create an anonymous shared mapping with an allocator in a buffer of `buffer_len` bytes, which is shared with
+     * the processes forked afterwards.
+     */
+    static shared_bit_allocator create_anonymous( size_t buffer_len ) {
+        const auto map_len = allocator_offset + buffer_len;
+        shared_bit_allocator shm( _map( -1, map_len ), map_len );
+        shm._construct( buffer_len );
+        return shm;
+    }
+    /**
+     * Attach to the shared-memory object `name`, and wait up to `timeout` for its creator to finish the allocator.
+     */
+    static shared_bit_allocator attach( const std::string& name,
+                                        std::chrono::nanoseconds timeout = std::chrono::seconds( 1 )) {
+        const auto fd = shm_open( name.c_str(), O_RDWR, 0 );
+        if( fd < 0 )
+            throw std::system_error( errno, std::generic_category(), "shm_open " + name );
+
+        // the object is empty until its creator has sized it
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        struct stat st{};
+        while( fstat( fd, &st ) == 0 && size_t( st.st_size ) < allocator_offset &&
+               std::chrono::steady_clock::now() < deadline )
+            std::this_thread::sleep_for( std::chrono::microseconds( 100 ));
+        if( size_t( st.st_size ) < allocator_offset ) {
+            close( fd );
+            throw std::runtime_error( "shared bit allocator " + name + " was not created in time" );
+        }
+        shared_bit_allocator shm( _map( fd, size_t( st.st_size )), size_t( st.st_size ));
+        close( fd );
+
+        auto& preamble = shm._preamble();
+        for( auto now = std::chrono::steady_clock::now();
+             preamble.ready.load( std::memory_order::acquire ) == 0 && now < deadline;
+             now = std::chrono::steady_clock::now() )
+            _wait_for( preamble.ready, 0, deadline-now );
+        if( preamble.ready.load( std::memory_order::acquire ) == 0 )
+            throw std::runtime_error( "shared bit allocator " + name + " was not created in time" );
+
+        if( preamble.magic != _shm_preamble::magic_value || preamble.version != _shm_preamble::format_version )
+            throw std::runtime_error( "not a shared bit allocator of this version: " + name );
+        if( preamble.word_size != sizeof( typename BA::WordT ) || preamble.allocator_size != sizeof( BA ) ||
+            allocator_offset + preamble.buffer_len > shm.map_len_ )
+            throw std::runtime_error( "shared bit allocator " + name + " is of another type" );
+        return shm;
+    }
+    /**
+     * Remove the name of a shared-memory object; processes attached to it keep it.
+     */
+    static void unlink( const std::string& name ) noexcept {
+        shm_unlink( name.c_str() );
+    }
+
+    shared_bit_allocator( shared_bit_allocator&& other ) noexcept :
+            map_( std::exchange( other.map_, nullptr )),
+            map_len_( other.map_len_ )
+    {}
+    shared_bit_allocator& operator=( shared_bit_allocator&& other ) noexcept {
+        std::swap( map_, other.map_ );
+        std::swap( map_len_, other.map_len_ );
+        return *this;
+    }
+    ~shared_bit_allocator() {
+        if( map_ )
+            munmap( map_, map_len_ );
+    }
+
+    process_shared<BA>* get() const noexcept {
+        return reinterpret_cast<process_shared<BA>*>( static_cast<char*>( map_ ) + allocator_offset );
+    }
+    process_shared<BA>* operator->() const noexcept { return get(); }
+    process_shared<BA>& operator*() const noexcept { return *get(); }
+
+private:
+    shared_bit_allocator( void* map, size_t map_len ) noexcept : map_( map ), map_len_( map_len ) {}
+
+    static void* _map( int fd, size_t map_len ) {
+        void* p = mmap( nullptr, map_len, PROT_READ | PROT_WRITE, fd < 0 ? MAP_SHARED | MAP_ANONYMOUS : MAP_SHARED,
+                        fd, 0 );
+        if( p == MAP_FAILED ) {
+            const auto error = errno;
+            if( fd >= 0 )
+                close( fd );
+            throw std::system_error( error, std::generic_category(), "mmap" );
+        }
+        return p;
+    }
+    _shm_preamble& _preamble() const noexcept {
+        return *static_cast<_shm_preamble*>( map_ );
+    }
+    /**
+     * Construct the allocator in the zeroed mapping, and only then mark the segment ready.
+     */
+    void _construct( size_t buffer_len ) {
+        new ( get() ) process_shared<BA>( buffer_len );
+
+        // attaching processes may already be waiting on `ready`, which is zero in the fresh mapping
+        auto& preamble = _preamble();
+        preamble.magic = _shm_preamble::magic_value;
+        preamble.version = _shm_preamble::format_version;
+        preamble.word_size = uint32_t( sizeof( typename BA::WordT ));
+        preamble.allocator_size = sizeof( BA );
+        preamble.buffer_len = buffer_len;
+        preamble.ready.store( 1, std::memory_order::release );
+        _wake_all( preamble.ready );
+    }
+
+    void* map_;
+    size_t map_len_;
+};
+
+}
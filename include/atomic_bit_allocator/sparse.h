@@ -0,0 +1,252 @@
+/*
+ * Copyright 2026 The atomic_bit_allocator contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <system_error>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "atomic_bit_allocator.h"
+
+
+namespace jps {
+
+/**
+ * A lock-free bit allocator for very large, mostly unused bitmaps, e.g. of 2^36 bits and more.
+ *
+ * The bitmap is reserved as virtual memory, and a page of it is only committed when bits in it are allocated first.
+ * A summary of one bit per page tells which pages were touched. Scans take untouched pages as free without reading
+ * them, so the resident memory stays proportional to the part of the bitmap that is actually used. Pages stay
+ * committed once touched.
+ *
+ * A bitmap may also be persisted in a file, and reopened from it. Reopening neither reads nor trusts a stored
+ * summary: each page starts unvalidated, which scans take as touched, and is validated by a look at its words on
+ * the first scan that reaches it, or by `validate()`, which can run on a thread of its own. Allocations are served
+ * right away, and opening takes the same time for any size of the bitmap.
+ *
+ * Other than `serialized_bit_allocator`, this type owns its memory and is not constructed in a buffer. It requires
+ * `mmap` with `MAP_NORESERVE`.
+ */
+template<typename W = uint64_t>
+class sparse_bit_allocator {
+    using backend = _reentrant_lock_free_bit_allocator<W>;
+
+public:
+    using WordT = W;
+
+    explicit sparse_bit_allocator( size_t n_bits ) :
+            end_pos_( n_bits/backend::bits_per_word*backend::bits_per_word ),
+            bits_per_page_( size_t( sysconf( _SC_PAGESIZE ))*backend::bits_per_byte ),
+            n_pages_(( end_pos_ + bits_per_page_-1 )/bits_per_page_ ),
+            map_len_( end_pos_/backend::bits_per_byte ),
+            touched_( std::make_unique<std::atomic<uint64_t>[]>(( n_pages_+63 )/64 )),
+            validated_( std::make_unique<std::atomic<uint64_t>[]>(( n_pages_+63 )/64 ))
+    {
+        void* p = mmap( nullptr, map_len_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                        -1, 0 );
+        if( p == MAP_FAILED )
+            throw std::bad_alloc();
+        words_ = static_cast<backend*>( p );
+
+        // a fresh bitmap is known to be empty
+        for( auto i = 0ul; i < ( n_pages_+63 )/64; ++i )
+            validated_[i].store( ~uint64_t( 0 ), std::memory_order::relaxed );
+        validate_cursor_.store( n_pages_, std::memory_order::relaxed );
+    }
+    /**
+     * Open the bitmap of `n_bits` bits persisted in the file `fd`, which is extended to its size, so a new, empty
+     * file starts with a free bitmap. Changes are written to the file through a shared mapping, which the caller
+     * may `msync`. The file descriptor is not owned and may be closed right after. The file holds the words as
+     * they are in memory, which is only portable if `is_canonical_layout<W>`, see compress.h.
+     */
+    sparse_bit_allocator( int fd, size_t n_bits ) :
+            end_pos_( n_bits/backend::bits_per_word*backend::bits_per_word ),
+            bits_per_page_( size_t( sysconf( _SC_PAGESIZE ))*backend::bits_per_byte ),
+            n_pages_(( end_pos_ + bits_per_page_-1 )/bits_per_page_ ),
+            map_len_( end_pos_/backend::bits_per_byte ),
+            touched_( std::make_unique<std::atomic<uint64_t>[]>(( n_pages_+63 )/64 )),
+            validated_( std::make_unique<std::atomic<uint64_t>[]>(( n_pages_+63 )/64 ))
+    {
+        struct stat st{};
+        if( fstat( fd, &st ) != 0 || ( size_t( st.st_size ) < map_len_ && ftruncate( fd, off_t( map_len_ )) != 0 ))
+            throw std::system_error( errno, std::generic_category(), "sparse_bit_allocator" );
+
+        // the pages of the file are only read when scanned
+        void* p = mmap( nullptr, map_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_NORESERVE, fd, 0 );
+        if( p == MAP_FAILED )
+            throw std::system_error( errno, std::generic_category(), "sparse_bit_allocator" );
+        words_ = static_cast<backend*>( p );
+    }
+    ~sparse_bit_allocator() {
+        munmap( words_, map_len_ );
+    }
+    sparse_bit_allocator( const sparse_bit_allocator& ) = delete;
+    sparse_bit_allocator& operator=( const sparse_bit_allocator& ) = delete;
+
+    [[nodiscard]] size_t size() const noexcept {
+        return end_pos_;
+    }
+
+    /**
+     * Allocate a range of `len` bits, first fit.
+     * @return The position of the range, or `size()` if there is none
+     */
+    [[nodiscard]] size_t alloc( size_t len, std::memory_order mo = std::memory_order::acquire ) noexcept {
+        if( len == 0 || len > end_pos_ )
+            return end_pos_;
+
+        // [run_start, pos) is known to be free
+        size_t run_start = 0;
+        size_t pos = 0;
+        while( true ) {
+            if( pos - run_start >= len ) {
+                _touch( run_start, len );
+                if( words_[0].claim_range( run_start, len, mo ))
+                    return run_start;
+
+                // lost to another thread, which touched the pages before; pairs with the fence in _touch
+                std::atomic_thread_fence( std::memory_order::acquire );
+                pos = run_start;
+                continue;
+            }
+            if( pos >= end_pos_ )
+                return end_pos_;
+
+            const auto page = pos/bits_per_page_;
+            const auto page_end = std::min(( page+1 )*bits_per_page_, end_pos_ );
+            if( !_is_validated( page ))
+                _validate( page );
+            if( !_is_touched( page )) {
+                pos = page_end;
+                continue;
+            }
+
+            const auto set = words_[0].find_first_set( pos, page_end, mo );
+            if( set == page_end || set - run_start >= len ) {
+                pos = set;
+                continue;
+            }
+            run_start = pos = words_[0].find_first_unset( set, page_end, mo );
+        }
+    }
+    void free( size_t start_pos, size_t len, std::memory_order mo = std::memory_order::release ) noexcept {
+        words_[0].free( start_pos, len, mo );
+    }
+
+    /**
+     * Return the number of allocated bits, counting the touched pages only.
+     */
+    [[nodiscard]] size_t usage( std::memory_order mo = std::memory_order::relaxed ) const noexcept {
+        size_t u = 0;
+        const auto words_per_page = bits_per_page_/backend::bits_per_word;
+        for( auto page = 0ul; page < n_pages_; ++page ) {
+            if( !_is_touched( page ))
+                continue;
+            const auto end_word = std::min(( page+1 )*words_per_page, end_pos_/backend::bits_per_word );
+            for( auto w = page*words_per_page; w < end_word; ++w )
+                u += words_[w].usage( mo );
+        }
+        return u;
+    }
+    /**
+     * Validate the summary of up to `budget` pages that no scan has reached yet, e.g. in a loop on a background
+     * thread after opening a persisted bitmap. Concurrent calls work on different pages.
+     * @return False once all pages are validated
+     */
+    bool validate( size_t budget = 64 ) noexcept {
+        for( auto i = 0ul; i < budget; ++i ) {
+            const auto page = validate_cursor_.fetch_add( 1, std::memory_order::relaxed );
+            if( page >= n_pages_ )
+                return false;
+            if( !_is_validated( page ))
+                _validate( page );
+        }
+        return validate_cursor_.load( std::memory_order::relaxed ) < n_pages_;
+    }
+    /**
+     * Return the number of pages whose summary bit is known, which are all of them unless the bitmap was opened.
+     */
+    [[nodiscard]] size_t validated_pages() const noexcept {
+        size_t n = 0;
+        for( auto i = 0ul; i < ( n_pages_+63 )/64; ++i )
+            n += std::popcount( validated_[i].load( std::memory_order::relaxed ));
+        // the bits beyond the last page of a fresh bitmap are set as well
+        return std::min( n, n_pages_ );
+    }
+    /**
+     * Return the number of pages of the bitmap that were touched and are therefore committed. Of an opened bitmap,
+     * these are the validated pages with allocated bits, and the pages touched since.
+     */
+    [[nodiscard]] size_t committed_pages() const noexcept {
+        size_t n = 0;
+        for( auto i = 0ul; i < ( n_pages_+63 )/64; ++i )
+            n += std::popcount( touched_[i].load( std::memory_order::relaxed ));
+        return n;
+    }
+
+protected:
+    /**
+     * Pages that are not validated yet are taken as touched.
+     */
+    [[nodiscard]] bool _is_touched( size_t page ) const noexcept {
+        return ( touched_[page/64].load( std::memory_order::relaxed ) |
+                 ~validated_[page/64].load( std::memory_order::acquire )) & uint64_t( 1 ) << page%64;
+    }
+    [[nodiscard]] bool _is_validated( size_t page ) const noexcept {
+        return validated_[page/64].load( std::memory_order::acquire ) & uint64_t( 1 ) << page%64;
+    }
+    /**
+     * Mark a page as touched if any of its bits is set, and then as validated. Bits set meanwhile touched their
+     * page before, see `_touch`, so the summary is never behind the bitmap.
+     */
+    void _validate( size_t page ) noexcept {
+        const auto page_start = page*bits_per_page_;
+        const auto page_end = std::min( page_start + bits_per_page_, end_pos_ );
+        if( words_[0].find_first_set( page_start, page_end, std::memory_order::relaxed ) != page_end )
+            touched_[page/64].fetch_or( uint64_t( 1 ) << page%64, std::memory_order::relaxed );
+        validated_[page/64].fetch_or( uint64_t( 1 ) << page%64, std::memory_order::release );
+    }
+    /**
+     * Mark the pages of a range as touched before any of its bits is set, so a thread that sees one of its bits
+     * does not take its page as free anymore.
+     */
+    void _touch( size_t start_pos, size_t len ) noexcept {
+        const auto last_page = ( start_pos+len-1 )/bits_per_page_;
+        for( auto page = start_pos/bits_per_page_; page <= last_page; ++page )
+            // not `_is_touched()`, a page being validated right now must not miss the bits set here
+            if( !( touched_[page/64].load( std::memory_order::relaxed ) & uint64_t( 1 ) << page%64 ))
+                touched_[page/64].fetch_or( uint64_t( 1 ) << page%64, std::memory_order::relaxed );
+        std::atomic_thread_fence( std::memory_order::release );
+    }
+
+    const size_t end_pos_;
+    const size_t bits_per_page_;
+    const size_t n_pages_;
+    const size_t map_len_;
+    backend* words_;
+    std::unique_ptr<std::atomic<uint64_t>[]> touched_;
+    std::unique_ptr<std::atomic<uint64_t>[]> validated_;
+    std::atomic<size_t> validate_cursor_{ 0 };      // the next page for validate()
+};
+
+}
@@ -0,0 +1,276 @@
+/*
+ * Copyright 2026 The atomic_bit_allocator contributors
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "atomic_bit_allocator.h"
+
+
+namespace jps {
+
+/**
+ * Flags of a `trace_record`.
+ */
+enum trace_flags : uint8_t {
+    trace_len_saturated = 1,    // the length did not fit, `len` holds its maximum instead
+};
+
+/**
+ * A single entry of an allocation trace.
+ */
+struct trace_record {
+    uint64_t timestamp;     // nanoseconds of std::chrono::steady_clock
+    uint64_t pos;
+    uint32_t len;
+    uint16_t thread;        // index of the recording thread's ring, which exited threads hand on
+    trace_op op;
+    uint8_t flags;          // of `trace_flags`
+};
+static_assert( sizeof( trace_record ) == 24 );
+
+
+/**
+ * Write a trace in its binary format: a header of 8 magic bytes, the format version, the record size, and the number
+ * of records, followed by the records. All integers are stored in native byte order.
+ */
+inline void write_trace( std::ostream& os, const std::vector<trace_record>& records ) {
+    const uint32_t version = 1;
+    const uint32_t record_size = sizeof( trace_record );
+    const uint64_t count = records.size();
+
+    os.write( "JPSTRACE", 8 );
+    os.write( reinterpret_cast<const char*>( &version ), sizeof( version ));
+    os.write( reinterpret_cast<const char*>( &record_size ), sizeof( record_size ));
+    os.write( reinterpret_cast<const char*>( &count ), sizeof( count ));
+    os.write( reinterpret_cast<const char*>( records.data() ), std::streamsize( count*sizeof( trace_record )));
+}
+
+/**
+ * Read a trace written by `write_trace`.
+ */
+inline std::vector<trace_record> read_trace( std::istream& is ) {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+
+    is.read( magic, sizeof( magic ));
+    is.read( reinterpret_cast<char*>( &version ), sizeof( version ));
+    is.read( reinterpret_cast<char*>( &record_size ), sizeof( record_size ));
+    is.read( reinterpret_cast<char*>( &count ), sizeof( count ));
+    if( !is || std::memcmp( magic, "JPSTRACE", 8 ) != 0 || version != 1 || record_size != sizeof( trace_record ))
+        throw std::runtime_error( "not an allocation trace" );
+
+    std::vector<trace_record> records( count );
+    is.read( reinterpret_cast<char*>( records.data() ), std::streamsize( count*sizeof( trace_record )));
+    if( !is )
+        throw std::runtime_error( "truncated allocation trace" );
+    return records;
+}
+
+
+/**
+ * A recorder for `serialized_bit_allocator` that appends every allocation and free to a ring buffer of the calling
+ * thread. Each thread keeps its last `capacity` records, `capacity*32` bytes; recording does not synchronize with
+ * other threads, and drops the record if the thread's ring cannot be allocated.
+ *
+ * The ring of an exited thread is handed back and taken over by the next thread that starts recording, so there are
+ * only as many rings as threads recording at the same time. Its records stay until they are overwritten. The thread
+ * index of a record is the index of its ring, so the threads sharing one over time never overlap.
+ *
+ * All allocators using the same recorder type share its rings, use `Tag` to keep the traces of different
+ * allocators apart.
+ */
+template<size_t capacity = 65536, typename Tag = void>
+class trace_recorder {
+public:
+    static void record( trace_op op, size_t pos, size_t len ) noexcept {
+        auto* r = _local_ring();
+        if( r == nullptr )
+            return;
+
+        trace_record rec;
+        rec.timestamp = uint64_t( std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch() ).count() );
+        rec.pos = pos;
+        rec.len = uint32_t( std::min<size_t>( len, UINT32_MAX ));
+        rec.thread = r->thread;
+        rec.op = op;
+        rec.flags = len > UINT32_MAX ? trace_len_saturated : 0;
+
+        const auto head = r->head.load( std::memory_order::relaxed );
+        r->slots[head % capacity].store( head, rec );
+        r->head.store( head+1, std::memory_order::release );
+    }
+
+    /**
+     * Gather the records of all threads in the order of their timestamps. Threads may keep recording meanwhile;
+     * records they overwrote while being gathered are left out, and so are the ones recorded after.
+     */
+    static std::vector<trace_record> collect() {
+        std::vector<trace_record> records;
+
+        std::lock_guard lock( _registry().mutex );
+        for( const auto& r: _registry().rings ) {
+            const auto head = r->head.load( std::memory_order::acquire );
+            for( auto i = head > capacity ? head-capacity : 0; i < head; ++i ) {
+                trace_record rec;
+                if( r->slots[i % capacity].load( i, rec ))
+                    records.push_back( rec );
+            }
+        }
+
+        std::stable_sort( records.begin(), records.end(), []( const trace_record& a, const trace_record& b ) {
+            return a.timestamp < b.timestamp;
+        } );
+        return records;
+    }
+
+    static void write( std::ostream& os ) {
+        write_trace( os, collect() );
+    }
+
+    /**
+     * Return the number of rings, which is the largest number of threads that recorded at the same time.
+     */
+    static size_t n_rings() {
+        std::lock_guard lock( _registry().mutex );
+        return _registry().rings.size();
+    }
+
+    /**
+     * Drop all records recorded so far.
+     */
+    static void clear() {
+        std::lock_guard lock( _registry().mutex );
+        for( auto& r: _registry().rings )
+            r->head.store( 0, std::memory_order::release );
+    }
+
+private:
+    /**
+     * A record behind a sequence lock, so it can be read while its thread overwrites it. The sequence is odd while
+     * the record is written, and `2*( index+1 )` once the record of that index of the ring is complete.
+     */
+    struct slot {
+        static constexpr size_t n_words = sizeof( trace_record )/sizeof( uint64_t );
+
+        void store( size_t index, const trace_record& rec ) noexcept {
+            uint64_t words[n_words];
+            std::memcpy( words, &rec, sizeof( rec ));
+
+            seq.store( 2*index + 1, std::memory_order::relaxed );
+            std::atomic_thread_fence( std::memory_order::release );
+            for( auto i = 0ul; i < n_words; ++i )
+                words_[i].store( words[i], std::memory_order::relaxed );
+            seq.store( 2*( index+1 ), std::memory_order::release );
+        }
+        /**
+         * Read the record of `index`.
+         * @return False if the slot holds another record, or one that is being written
+         */
+        bool load( size_t index, trace_record& rec ) const noexcept {
+            const auto before = seq.load( std::memory_order::acquire );
+            uint64_t words[n_words];
+            for( auto i = 0ul; i < n_words; ++i )
+                words[i] = words_[i].load( std::memory_order::relaxed );
+            std::atomic_thread_fence( std::memory_order::acquire );
+            if( before != 2*( index+1 ) || seq.load( std::memory_order::relaxed ) != before )
+                return false;
+
+            std::memcpy( &rec, words, sizeof( rec ));
+            return true;
+        }
+
+        std::atomic<uint64_t> seq{ 0 };
+        std::atomic<uint64_t> words_[n_words];
+    };
+    static_assert( sizeof( trace_record ) % sizeof( uint64_t ) == 0 && std::is_trivially_copyable_v<trace_record> );
+
+    struct ring {
+        std::atomic<size_t> head{ 0 };
+        uint16_t thread = 0;
+        slot slots[capacity];
+    };
+    struct registry {
+        std::mutex mutex;
+        std::vector<std::unique_ptr<ring>> rings;
+        std::vector<ring*> unused;      // the rings of exited threads
+    };
+    /**
+     * The ring of a thread, which is handed back when the thread exits.
+     */
+    struct local_ring {
+        ring* r = nullptr;
+
+        ~local_ring() {
+            if( r == nullptr )
+                return;
+            auto& reg = _registry();
+            std::lock_guard lock( reg.mutex );
+            reg.unused.push_back( r );
+        }
+    };
+
+    static registry& _registry() {
+        static registry r;
+        return r;
+    }
+    /**
+     * Return the ring of the calling thread, or nullptr if there is none and no new one can be allocated.
+     */
+    static ring* _local_ring() noexcept {
+        // the rings are owned by the registry, so the records outlive their threads
+        static thread_local local_ring local;
+        if( local.r != nullptr )
+            return local.r;
+
+        try {
+            auto& reg = _registry();
+            std::lock_guard lock( reg.mutex );
+            if( !reg.unused.empty() ) {
+                // the ring keeps its thread index, and the records of the previous thread
+                local.r = reg.unused.back();
+                reg.unused.pop_back();
+            }
+            else if( reg.rings.size() <= UINT16_MAX ) {
+                // so the ring can be handed back without allocating
+                reg.unused.reserve( reg.rings.size()+1 );
+                reg.rings.push_back( std::make_unique<ring>() );
+                reg.rings.back()->thread = uint16_t( reg.rings.size()-1 );
+                local.r = reg.rings.back().get();
+            }
+        }
+        catch( ... ) {
+            // the record is dropped, and the next one tries again
+        }
+        return local.r;
+    }
+};
+
+}
@@ -0,0 +1,181 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace jps::baseline {
+
+/*
+ * The baselines share the interface of `serialized_bit_allocator`: `alloc( len )` returns a position or `size()`
+ * on failure, and `free( pos, len )` returns a range.
+ */
+
+/**
+ * A first-fit bitmap allocator over a `std::vector<bool>` guarded by a single mutex.
+ */
+class mutex_vector_bool {
+public:
+    explicit mutex_vector_bool( size_t n_bits, [[maybe_unused]] size_t max_len ) : bits_( n_bits, false ) {}
+
+    [[nodiscard]] size_t alloc( size_t len ) {
+        std::lock_guard lock( mutex_ );
+
+        size_t run = 0;
+        for( auto i = 0ul; i < bits_.size(); ++i ) {
+            run = bits_[i] ? 0 : run+1;
+            if( run == len ) {
+                const auto pos = i+1-len;
+                for( auto j = pos; j <= i; ++j )
+                    bits_[j] = true;
+                return pos;
+            }
+        }
+        return bits_.size();
+    }
+    void free( size_t pos, size_t len ) {
+        std::lock_guard lock( mutex_ );
+        for( auto j = pos; j < pos+len; ++j )
+            bits_[j] = false;
+    }
+    [[nodiscard]] size_t size() const { return bits_.size(); }
+
+private:
+    std::mutex mutex_;
+    std::vector<bool> bits_;
+};
+
+
+/**
+ * A lock-free free list of slot indices (Treiber stack). The head carries a tag against the ABA problem.
+ *
+ * A free list cannot serve ranges, so every request occupies one slot of `max_len` bits regardless of its
+ * length. The capacity in number of concurrent allocations is therefore `n_bits/max_len`.
+ */
+class treiber_free_list {
+public:
+    treiber_free_list( size_t n_bits, size_t max_len ) :
+            slot_len_( max_len ),
+            n_slots_( n_bits/max_len ),
+            next_( std::make_unique<std::atomic<uint32_t>[]>( n_slots_ )),
+            head_( 0 )
+    {
+        for( auto i = n_slots_; i > 0; --i )
+            push( i-1 );
+    }
+
+    [[nodiscard]] size_t alloc( [[maybe_unused]] size_t len ) {
+        const auto i = pop();
+        return i == n_slots_ ? size() : i*slot_len_;
+    }
+    void free( size_t pos, [[maybe_unused]] size_t len ) {
+        push( pos/slot_len_ );
+    }
+    [[nodiscard]] size_t size() const { return n_slots_*slot_len_; }
+
+    size_t pop() {
+        auto h = head_.load( std::memory_order::acquire );
+        do {
+            const auto top = uint32_t( h );
+            if( top == 0 )
+                return n_slots_;
+
+            const auto next = next_[top-1].load( std::memory_order::relaxed );
+            if( head_.compare_exchange_weak( h, _make( h, next ),
+                                             std::memory_order::acquire, std::memory_order::acquire ))
+                return top-1;
+        } while( true );
+    }
+    void push( size_t i ) {
+        auto h = head_.load( std::memory_order::relaxed );
+        do {
+            next_[i].store( uint32_t( h ), std::memory_order::relaxed );
+        } while( !head_.compare_exchange_weak( h, _make( h, uint32_t( i+1 )),
+                                               std::memory_order::release, std::memory_order::relaxed ));
+    }
+
+private:
+    static uint64_t _make( uint64_t prev, uint32_t top ) {
+        return (( prev >> 32 ) + 1 ) << 32 | top;
+    }
+
+    const size_t slot_len_;
+    const size_t n_slots_;
+    std::unique_ptr<std::atomic<uint32_t>[]> next_;
+    alignas( 128 ) std::atomic<uint64_t> head_;
+};
+
+
+/**
+ * A Treiber-stack free list with a per-thread cache in front of it. Threads move slots between their cache and
+ * the shared list in batches, so most operations do not touch shared memory at all.
+ */
+class cached_free_list {
+public:
+    static constexpr size_t batch = 32;
+
+    cached_free_list( size_t n_bits, size_t max_len ) :
+            shared_( n_bits, max_len ),
+            slot_len_( max_len ),
+            instance_( _next_instance().fetch_add( 1 ))
+    {}
+
+    [[nodiscard]] size_t alloc( [[maybe_unused]] size_t len ) {
+        auto& c = _cache();
+        if( c.slots.empty() ) {
+            for( auto i = 0ul; i < batch; ++i ) {
+                const auto p = shared_.alloc( 1 );
+                if( p == shared_.size() )
+                    break;
+                c.slots.push_back( p );
+            }
+            if( c.slots.empty() )
+                return size();
+        }
+
+        const auto p = c.slots.back();
+        c.slots.pop_back();
+        return p;
+    }
+    void free( size_t pos, [[maybe_unused]] size_t len ) {
+        auto& c = _cache();
+        c.slots.push_back( pos );
+        if( c.slots.size() >= 2*batch ) {
+            for( auto i = 0ul; i < batch; ++i ) {
+                shared_.free( c.slots.back(), slot_len_ );
+                c.slots.pop_back();
+            }
+        }
+    }
+    [[nodiscard]] size_t size() const { return shared_.size(); }
+
+private:
+    struct cache {
+        size_t instance = ~size_t( 0 );
+        std::vector<size_t> slots;
+    };
+
+    cache& _cache() {
+        // a thread's cache belongs to one instance at a time; slots of a destroyed instance are dropped
+        static thread_local cache c;
+        if( c.instance != instance_ ) {
+            c.instance = instance_;
+            c.slots.clear();
+        }
+        return c;
+    }
+    static std::atomic<size_t>& _next_instance() {
+        static std::atomic<size_t> n{ 0 };
+        return n;
+    }
+
+    treiber_free_list shared_;
+    const size_t slot_len_;
+    const size_t instance_;
+};
+
+}
@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "atomic_bit_allocator/atomic_bit_allocator.h"
+#include "baselines.h"
+#include "experiment.h"
+#include "options.h"
+#include "report.h"
+#include "topology.h"
+
+using namespace std::chrono_literals;
+
+
+/**
+ * Give a `serialized_bit_allocator` the constructor of the baselines.
+ */
+template<typename BA>
+class serialized {
+public:
+    serialized( size_t n_bits, [[maybe_unused]] size_t max_len ) :
+            buffer_( sizeof( BA )/sizeof( uint64_t ) + ( n_bits+63 )/64 ),
+            bit_allocator_( new ( buffer_.data() ) BA( buffer_.size()*sizeof( uint64_t )))
+    {}
+
+    [[nodiscard]] size_t alloc( size_t len ) { return bit_allocator_->alloc( len ); }
+    void free( size_t pos, size_t len ) { bit_allocator_->free( pos, len ); }
+    [[nodiscard]] size_t size() const { return bit_allocator_->size(); }
+
+private:
+    std::vector<uint64_t> buffer_;
+    BA* bit_allocator_;
+};
+
+
+template<typename Allocator>
+class workload : public jps::experiment {
+public:
+    workload( size_t n_workers, size_t n_bits, size_t max_alloc, std::chrono::milliseconds run_time ) :
+            jps::experiment( n_workers, run_time, 0.1s ),
+            max_alloc_( max_alloc ),
+            allocator_( n_bits, max_alloc ),
+            state_( n_workers )
+    {
+        for( auto i = 0ul; i < n_workers; ++i )
+            state_[i].rng = 0x9e3779b97f4a7c15ull*( i+1 );
+    }
+
+    size_t run( const std::string& name ) {
+        if( name == "churn" ) return jps::experiment::run( &workload::churn );
+        if( name == "fill" )  return jps::experiment::run( &workload::fill );
+        if( name == "mix" )   return jps::experiment::run( &workload::mix );
+        if( name == "lived" ) return jps::experiment::run( &workload::lived );
+        throw std::invalid_argument( "unknown workload: " + name );
+    }
+
+    /*
+     * Steady-state churn: allocate and immediately free again.
+     */
+    void churn() {
+        auto& s = state_[get_worker_id()];
+        const auto n = _len( s );
+        const auto p = allocator_.alloc( n );
+        if( p != allocator_.size() )
+            allocator_.free( p, n );
+    }
+
+    /*
+     * Fill-to-full: allocate until allocation fails, then free everything again. Each call is one operation.
+     */
+    void fill() {
+        auto& s = state_[get_worker_id()];
+        if( !s.draining ) {
+            const auto n = _len( s );
+            const auto p = allocator_.alloc( n );
+            if( p == allocator_.size() )
+                s.draining = true;
+            else
+                s.live.emplace_back( p, n );
+        }
+        else {
+            allocator_.free( s.live.back().first, s.live.back().second );
+            s.live.pop_back();
+            s.draining = !s.live.empty();
+        }
+    }
+
+    /*
+     * Random-size mix: every worker keeps its last `n_live` allocations of random sizes alive.
+     */
+    void mix() {
+        static constexpr size_t n_live = 16;
+
+        auto& s = state_[get_worker_id()];
+        const auto n = _len( s );
+        const auto p = allocator_.alloc( n );
+        if( p == allocator_.size() )
+            return;
+
+        if( s.live.size() < n_live )
+            s.live.emplace_back( p, n );
+        else {
+            auto& victim = s.live[s.cursor++ % n_live];
+            allocator_.free( victim.first, victim.second );
+            victim = { p, n };
+        }
+    }
+
+    /*
+     * Long-lived versus short-lived: every worker holds `n_long` allocations of maximum size that are replaced
+     * only every `long_period` operations, and churns short-lived allocations of random sizes in between.
+     */
+    void lived() {
+        static constexpr size_t n_long = 16;
+        static constexpr size_t long_period = 1024;
+
+        auto& s = state_[get_worker_id()];
+        if( s.live.size() < n_long ) {
+            const auto p = allocator_.alloc( max_alloc_ );
+            if( p != allocator_.size() )
+                s.live.emplace_back( p, max_alloc_ );
+            return;
+        }
+        if( ++s.cursor % long_period == 0 ) {
+            auto& victim = s.live[( s.cursor/long_period ) % n_long];
+            allocator_.free( victim.first, victim.second );
+            const auto p = allocator_.alloc( max_alloc_ );
+            if( p != allocator_.size() )
+                victim = { p, max_alloc_ };
+            else {
+                victim = s.live.back();
+                s.live.pop_back();
+            }
+            return;
+        }
+
+        churn();
+    }
+
+private:
+    struct alignas( 128 ) worker_state {
+        uint64_t rng = 0;
+        size_t cursor = 0;
+        bool draining = false;
+        std::vector<std::pair<size_t, size_t>> live;
+    };
+
+    size_t _len( worker_state& s ) const {
+        // xorshift64
+        s.rng ^= s.rng << 13;
+        s.rng ^= s.rng >> 7;
+        s.rng ^= s.rng << 17;
+        return 1 + s.rng % max_alloc_;
+    }
+
+    const size_t max_alloc_;
+    Allocator allocator_;
+    std::vector<worker_state> state_;
+};
+
+
+struct sweep {
+    size_t min_workers;
+    size_t max_workers;
+    size_t n_bits;
+    size_t max_alloc;
+    std::chrono::milliseconds run_time;
+    size_t repeat;
+    jps::report::format format;
+};
+
+template<typename Allocator>
+void loop_tests( const char* allocator, const std::string& name, const sweep& s, const jps::topology& topo,
+                 jps::affinity a, jps::report& results ) {
+    const auto cpus = topo.placement( a );
+    const auto max_workers = s.max_workers ? s.max_workers : topo.max_workers( a );
+    const auto run_time_us = double( std::chrono::duration_cast<std::chrono::microseconds>( s.run_time ).count() );
+
+    for( auto t = s.min_workers; t <= max_workers; ++t ) {
+        size_t n_ops = 0;
+        for( auto r = 0u; r < s.repeat; ++r ) {
+            workload<Allocator> test( t, s.n_bits, s.max_alloc, s.run_time );
+            test.pin( cpus );
+            n_ops += test.run( name );
+        }
+        const auto ops_per_us = double( n_ops ) / ( double( s.repeat ) * run_time_us );
+
+        results.add_row( { name, allocator, jps::to_string( a ), t, s.max_alloc, s.n_bits,
+                           size_t( s.run_time.count() ), s.repeat, ops_per_us } );
+        if( s.format == jps::report::format::text )
+            std::cout << "\t" << name << "\t" << allocator << "\t" << t << "\t" << ops_per_us << std::endl;
+    }
+}
+
+/**
+ * The allocators with the state of `alloc_wait` and `alloc_drain` in their header.
+ */
+template<template<typename> typename bit_allocator>
+using waiting_bit_allocator = jps::serialized_bit_allocator<uint64_t, bit_allocator, false, jps::no_recorder,
+                                                            jps::first_fit, false, void, true>;
+
+/**
+ * Measure the latency from freeing bits of a full allocator until a consumer waiting for them has got them, either
+ * parked in `alloc_wait` or polling `alloc` with sleeps in between.
+ */
+template<typename BA>
+void wakeup_latency( const char* allocator, const std::string& waiting, size_t rounds, jps::report& results ) {
+    static constexpr auto poll_interval = 100us;
+
+    std::vector<uint64_t> buffer( sizeof( BA )/sizeof( uint64_t ) + 1 );
+    auto* bit_allocator = new ( buffer.data() ) BA( buffer.size()*sizeof( uint64_t ));
+    if( bit_allocator->alloc( bit_allocator->size() ) == bit_allocator->size() )
+        throw std::logic_error( "cannot fill the allocator" );
+
+    std::atomic<size_t> round{ 0 };
+    std::atomic<std::chrono::steady_clock::rep> woken{ 0 };
+    std::thread consumer( [&]() {
+        for( auto r = 1ul; r <= rounds; ++r ) {
+            round.store( r, std::memory_order::release );
+
+            // the only free bit is always bit 0
+            if( waiting == "alloc_wait" )
+                (void) bit_allocator->alloc_wait( 1 );
+            else
+                while( bit_allocator->alloc( 1 ) == bit_allocator->size() )
+                    std::this_thread::sleep_for( poll_interval );
+            woken.store( std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order::release );
+
+            while( round.load( std::memory_order::acquire ) == r )
+                std::this_thread::yield();
+        }
+    } );
+
+    std::vector<double> latencies_us;
+    for( auto r = 1ul; r <= rounds; ++r ) {
+        while( round.load( std::memory_order::acquire ) != r )
+            std::this_thread::yield();
+        // give the consumer time to go to sleep
+        std::this_thread::sleep_for( 1ms );
+
+        woken.store( 0, std::memory_order::relaxed );
+        const auto freed = std::chrono::steady_clock::now().time_since_epoch().count();
+        bit_allocator->free( 0, 1 );
+        std::chrono::steady_clock::rep t;
+        while(( t = woken.load( std::memory_order::acquire )) == 0 )
+            std::this_thread::yield();
+        latencies_us.push_back( double( std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::duration( t-freed )).count() )/1000. );
+
+        round.store( 0, std::memory_order::release );
+    }
+    consumer.join();
+
+    std::sort( latencies_us.begin(), latencies_us.end() );
+    const auto percentile = [&]( double q ) { return latencies_us[size_t( q*double( latencies_us.size()-1 ))]; };
+    results.add_row( { allocator, waiting, rounds, percentile( 0.5 ), percentile( 0.99 ), latencies_us.back() } );
+}
+
+/**
+ * Measure the latency of large allocations while other threads keep churning small ones on a mostly full
+ * allocator, either retrying `alloc` or with `alloc_drain`. Retries give up after a timeout, as the churn may never
+ * leave a large enough hole.
+ */
+template<typename BA>
+void large_latency( const char* allocator, const std::string& waiting, size_t rounds, jps::report& results ) {
+    static constexpr auto n_bits = 4096ul;
+    static constexpr auto n_churners = 2ul;
+    static constexpr auto n_live = 760ul;         // per churner, fills about 93% of the bits
+    static constexpr auto large_len = 256ul;
+    static constexpr auto timeout = 100ms;
+
+    std::vector<uint64_t> buffer( sizeof( BA )/sizeof( uint64_t ) + n_bits/64 );
+    auto* bit_allocator = new ( buffer.data() ) BA( buffer.size()*sizeof( uint64_t ));
+
+    std::atomic<bool> stop{ false };
+    std::atomic<size_t> churn_ops{ 0 };
+    std::vector<std::thread> churners;
+    for( auto t = 0ul; t < n_churners; ++t ) {
+        churners.emplace_back( [&, t]() {
+            std::vector<std::pair<size_t, size_t>> live( n_live, { 0, 0 } );
+            uint64_t rng = 0x9e3779b97f4a7c15ull*( t+1 );
+            size_t ops = 0;
+            for( auto i = 0ul; !stop.load( std::memory_order::relaxed ); ++i ) {
+                rng ^= rng << 13;
+                rng ^= rng >> 7;
+                rng ^= rng << 17;
+
+                auto& victim = live[i % live.size()];
+                if( victim.second )
+                    bit_allocator->free( victim.first, victim.second );
+
+                const auto n = 1 + rng % 4;
+                const auto p = bit_allocator->alloc( n );
+                victim = { p, p == bit_allocator->size() ? 0 : n };
+                ++ops;
+            }
+            for( const auto& [p, n]: live )
+                if( n )
+                    bit_allocator->free( p, n );
+            churn_ops.fetch_add( ops, std::memory_order::relaxed );
+        } );
+    }
+    // let the churn fill and fragment the allocator
+    std::this_thread::sleep_for( 10ms );
+
+    size_t timeouts = 0;
+    std::vector<double> latencies_us;
+    const auto start = std::chrono::steady_clock::now();
+    for( auto r = 0ul; r < rounds; ++r ) {
+        const auto t0 = std::chrono::steady_clock::now();
+        auto p = bit_allocator->size();
+        if( waiting == "alloc_drain" )
+            p = bit_allocator->alloc_drain( large_len, timeout );
+        else
+            while(( p = bit_allocator->alloc( large_len )) == bit_allocator->size() &&
+                  std::chrono::steady_clock::now()-t0 < timeout )
+                std::this_thread::yield();
+        latencies_us.push_back( double( std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now()-t0 ).count() )/1000. );
+
+        if( p == bit_allocator->size() )
+            ++timeouts;
+        else
+            bit_allocator->free( p, large_len );
+        std::this_thread::sleep_for( 1ms );
+    }
+    stop.store( true, std::memory_order::relaxed );
+    for( auto& c: churners )
+        c.join();
+    const auto elapsed_us = double( std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now()-start ).count() );
+
+    std::sort( latencies_us.begin(), latencies_us.end() );
+    const auto percentile = [&]( double q ) { return latencies_us[size_t( q*double( latencies_us.size()-1 ))]; };
+    results.add_row( { allocator, waiting, rounds, percentile( 0.5 ), percentile( 0.99 ), latencies_us.back(),
+                       timeouts, double( churn_ops.load() )/elapsed_us } );
+}
+
+
+int main( int argc, char* argv[] ) {
+    const auto topo = jps::topology::detect();
+
+    jps::options opts( argc, argv );
+    sweep s{};
+    s.min_workers = opts.get<size_t>( "min-workers", 1, "smallest number of workers in the sweep" );
+    s.max_workers = opts.get<size_t>( "max-workers", 0, "largest number of workers, 0 = detected from the machine" );
+    s.n_bits = opts.get<size_t>( "bits", 65536, "number of bits (slots) managed by each allocator" );
+    s.max_alloc = opts.get<size_t>( "max-alloc", 8, "largest allocation length" );
+    s.run_time = std::chrono::milliseconds( opts.get<size_t>( "run-time", 500, "run time per measurement in ms" ));
+    s.repeat = opts.get<size_t>( "repeat", 1, "number of repetitions per measurement" );
+    const auto a = jps::affinity_from_string( opts.get( "affinity", "compact", "none|compact|scatter|core|numa" ));
+    const auto workloads = opts.get( "workload", "all", "churn|fill|mix|lived|all" );
+    const auto allocators = opts.get( "allocator", "all",
+            "mutex_based|lock_free|mutex_vector_bool|treiber_free_list|cached_free_list|all" );
+    s.format = jps::report::format_from_string( opts.get( "format", "text", "text|csv|json" ));
+    const auto output = opts.get( "output", "", "write csv/json results to this file instead of stdout" );
+    const auto wakeup_rounds = opts.get<size_t>( "wakeup-rounds", 0,
+            "instead of the workloads, measure the free-to-wakeup latency of blocked consumers in this many rounds" );
+    const auto large_rounds = opts.get<size_t>( "large-rounds", 0,
+            "instead of the workloads, measure the latency of large allocations under churn in this many rounds" );
+    if( opts.help() )
+        return 0;
+
+    auto selected = [&]( const char* allocator ) { return allocators == "all" || allocators == allocator; };
+
+    if( wakeup_rounds ) {
+        jps::report latencies( { "allocator", "waiting", "rounds", "median_us", "p99_us", "max_us" } );
+        for( const auto* waiting: { "alloc_wait", "poll_100us" } ) {
+            if( selected( "mutex_based" ))
+                wakeup_latency<waiting_bit_allocator<jps::_single_threaded_bit_allocator>>(
+                        "mutex_based", waiting, wakeup_rounds, latencies );
+            if( selected( "lock_free" ))
+                wakeup_latency<waiting_bit_allocator<jps::_reentrant_lock_free_bit_allocator>>(
+                        "lock_free", waiting, wakeup_rounds, latencies );
+        }
+        if( output.empty() )
+            latencies.write( std::cout, s.format );
+        else {
+            std::ofstream out( output );
+            latencies.write( out, s.format );
+        }
+        return 0;
+    }
+
+    if( large_rounds ) {
+        jps::report latencies( { "allocator", "waiting", "rounds", "median_us", "p99_us", "max_us", "timeouts",
+                                 "churn_ops_per_us" } );
+        for( const auto* waiting: { "alloc_drain", "alloc_retry" } ) {
+            if( selected( "mutex_based" ))
+                large_latency<waiting_bit_allocator<jps::_single_threaded_bit_allocator>>(
+                        "mutex_based", waiting, large_rounds, latencies );
+            if( selected( "lock_free" ))
+                large_latency<waiting_bit_allocator<jps::_reentrant_lock_free_bit_allocator>>(
+                        "lock_free", waiting, large_rounds, latencies );
+        }
+        if( output.empty() )
+            latencies.write( std::cout, s.format );
+        else {
+            std::ofstream out( output );
+            latencies.write( out, s.format );
+        }
+        return 0;
+    }
+
+    std::vector<std::string> names{ "churn", "fill", "mix", "lived" };
+    if( workloads != "all" )
+        names = { workloads };
+
+    if( s.format == jps::report::format::text )
+        std::cout << "\t#workload\t#allocator\t#worker\t#ops/us" << std::endl;
+
+    jps::report results( { "workload", "allocator", "affinity", "workers", "max_alloc", "bits",
+                           "run_time_ms", "repeat", "ops_per_us" } );
+    for( const auto& name: names ) {
+        if( selected( "mutex_based" ))
+            loop_tests<serialized<jps::serialized_bit_allocator<uint64_t, jps::_single_threaded_bit_allocator>>>(
+                    "mutex_based", name, s, topo, a, results );
+        if( selected( "lock_free" ))
+            loop_tests<serialized<jps::serialized_bit_allocator<uint64_t, jps::_reentrant_lock_free_bit_allocator>>>(
+                    "lock_free", name, s, topo, a, results );
+        if( selected( "mutex_vector_bool" ))
+            loop_tests<jps::baseline::mutex_vector_bool>( "mutex_vector_bool", name, s, topo, a, results );
+        if( selected( "treiber_free_list" ))
+            loop_tests<jps::baseline::treiber_free_list>( "treiber_free_list", name, s, topo, a, results );
+        if( selected( "cached_free_list" ))
+            loop_tests<jps::baseline::cached_free_list>( "cached_free_list", name, s, topo, a, results );
+    }
+
+    if( s.format != jps::report::format::text ) {
+        if( output.empty() )
+            results.write( std::cout, s.format );
+        else {
+            std::ofstream out( output );
+            results.write( out, s.format );
+        }
+    }
+
+    return 0;
+}
@@ -11,6 +11,7 @@
 #include <atomic>
 #include <latch>
 #include <barrier>
+#include "topology.h"
 
 
 namespace jps {
@@ -28,6 +29,14 @@ public:
             worker_scores_( n_workers )
     {}
 
+    /**
+     * Pin worker `i` to the CPU `cpus[i % cpus.size()]` when the experiment runs. An empty list leaves the workers
+     * unpinned.
+     */
+    void pin( std::vector<unsigned> cpus ) {
+        cpus_ = std::move( cpus );
+    }
+
     template<typename TestFunction>
     size_t run( const TestFunction& test_function ) {
         // start workers
@@ -35,6 +44,7 @@ public:
             worker_scores_[i].hits.store( 0, std::memory_order_release );
             workers_.emplace_back( [&]( size_t worker_id ) {
                 _get_worker_id() = worker_id;
+                _pin( worker_id );
 
                 // synchronize with other workers
                 sync_.arrive_and_wait();
@@ -58,6 +68,7 @@ public:
             worker_scores_[i].hits.store( 0, std::memory_order_seq_cst );
             workers_.emplace_back( [&]( size_t worker_id ) {
                 _get_worker_id() = worker_id;
+                _pin( worker_id );
 
                 // synchronize with other workers
                 sync_.arrive_and_wait();
@@ -79,6 +90,7 @@ public:
             worker_scores_[i].hits.store( 0, std::memory_order_release );
             workers_.emplace_back( [&]( size_t worker_id ) {
                 _get_worker_id() = worker_id;
+                _pin( worker_id );
 
                 // synchronize with other workers
                 sync_.arrive_and_wait();
@@ -102,6 +114,10 @@ protected:
     }
 
 private:
+    void _pin( size_t worker_id ) const {
+        if( !cpus_.empty() )
+            pin_this_thread( cpus_[worker_id % cpus_.size()] );
+    }
     static size_t& _get_worker_id() {
         static thread_local size_t worker_id;
         return worker_id;
@@ -140,6 +156,7 @@ private:
 
     std::barrier<> sync_;
     std::vector<std::thread> workers_;
+    std::vector<unsigned> cpus_;
     std::chrono::duration<long double, std::nano> run_time_;
     std::chrono::duration<long double, std::nano> warmup_time_;
 
@@ -0,0 +1,97 @@
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+#include "atomic_bit_allocator/atomic_bit_allocator.h"
+#include "atomic_bit_allocator/compress.h"
+#include "options.h"
+#include "report.h"
+
+
+/**
+ * Fill the chunks of a bitmap at random: empty, full, or fragmented with runs of random lengths.
+ */
+void fill( uint64_t* words, size_t n_bits, double empty, double full ) {
+    uint64_t rng = 0x9e3779b97f4a7c15ull;
+    auto next = [&]() {
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        return rng;
+    };
+
+    for( size_t chunk = 0; chunk < n_bits; chunk += jps::bitmap_chunk_bits ) {
+        auto* chunk_words = words + chunk/64;
+        const auto n_words = std::min( jps::bitmap_chunk_bits, n_bits-chunk )/64;
+        const auto p = double( next() % 1000 )/1000.;
+
+        if( p < empty )
+            std::memset( chunk_words, 0, n_words*sizeof( uint64_t ));
+        else if( p < empty+full )
+            std::memset( chunk_words, 0xff, n_words*sizeof( uint64_t ));
+        else
+            for( auto w = 0ul; w < n_words; ++w )
+                chunk_words[w] = next() & next();
+    }
+}
+
+int main( int argc, char* argv[] ) {
+    using BA = jps::serialized_bit_allocator<uint64_t>;
+
+    jps::options opts( argc, argv );
+    const auto size_mb = opts.get<size_t>( "size-mb", 256, "size of the bitmap in MiB" );
+    const auto empty = opts.get<double>( "empty", 0.6, "share of empty chunks" );
+    const auto full = opts.get<double>( "full", 0.3, "share of full chunks, the others are fragmented" );
+    const auto format = jps::report::format_from_string( opts.get( "format", "text", "text|csv|json" ));
+    const auto output = opts.get( "output", "", "write the results to this file instead of stdout" );
+    if( opts.help() )
+        return 0;
+
+    const auto n_bits = size_mb*1024*1024*8;
+    std::vector<uint64_t> buffer( sizeof( BA )/sizeof( uint64_t ) - 1 + n_bits/64 );
+    auto* bit_allocator = new ( buffer.data() ) BA( buffer.size()*sizeof( uint64_t ));
+    fill( bit_allocator->data(), bit_allocator->size(), empty, full );
+
+    const auto t0 = std::chrono::steady_clock::now();
+    std::stringstream ss;
+    jps::export_bitmap( ss, *bit_allocator );
+    const auto t1 = std::chrono::steady_clock::now();
+    const auto compressed = ss.str();
+
+    // restore into memory that is mapped already, as a restored bitmap usually replaces one in place
+    std::istringstream in( compressed );
+    std::vector<uint64_t> restored_buffer( buffer.size() );
+    const auto t2 = std::chrono::steady_clock::now();
+    auto* restored = jps::import_bitmap<BA>( in, restored_buffer.data(), restored_buffer.size()*sizeof( uint64_t ));
+    const auto t3 = std::chrono::steady_clock::now();
+
+    if( std::memcmp( restored->data(), bit_allocator->data(), bit_allocator->size()/8 ) != 0 )
+        throw std::runtime_error( "the restored bitmap differs" );
+
+    // the uncompressed, canonical bytes are the words as they are on little endian
+    std::vector<uint64_t> canonical( bit_allocator->size()/64 );
+    jps::store_canonical( *bit_allocator, canonical.data() );
+    std::memset( restored->data(), 0, bit_allocator->size()/8 );
+    const auto t4 = std::chrono::steady_clock::now();
+    jps::load_canonical( *restored, canonical.data() );
+    const auto t5 = std::chrono::steady_clock::now();
+    if( std::memcmp( restored->data(), bit_allocator->data(), bit_allocator->size()/8 ) != 0 )
+        throw std::runtime_error( "the loaded bitmap differs" );
+
+    const auto ms = []( auto d ) { return double( std::chrono::duration_cast<std::chrono::microseconds>( d ).count() )/1000.; };
+    const auto raw_bytes = bit_allocator->size()/8;
+    jps::report results( { "size_mb", "empty", "full", "compressed_bytes", "ratio", "export_ms", "import_ms",
+                           "import_gb_per_s", "canonical_load_ms" } );
+    results.add_row( { size_mb, empty, full, size_t( compressed.size() ), double( raw_bytes )/double( compressed.size() ),
+                       ms( t1-t0 ), ms( t3-t2 ), double( raw_bytes )/( ms( t3-t2 )*1e6 ), ms( t5-t4 ) } );
+
+    if( output.empty() )
+        results.write( std::cout, format );
+    else {
+        std::ofstream out( output );
+        results.write( out, format );
+    }
+
+    return 0;
+}
@@ -5,10 +5,19 @@
 #include <chrono>
 #include <bitset>
 #include <cstring>
+#include <thread>
 #include <vector>
+#include <fstream>
 #include <iostream>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
 #include "atomic_bit_allocator/atomic_bit_allocator.h"
+#include "atomic_bit_allocator/shared.h"
 #include "experiment.h"
+#include "options.h"
+#include "report.h"
+#include "topology.h"
 
 using namespace std::chrono_literals;
 
@@ -17,7 +26,8 @@ template<typename bit_allocator = jps::serialized_bit_allocator<uint64_t, jps::_
 class ThroughPutMeasurement : public jps::experiment
 {
 public:
-    ThroughPutMeasurement( size_t n_workers, size_t buffer_size = 1024, size_t max_allocation = 8, auto run_time = 1.0s ) :
+    ThroughPutMeasurement( size_t n_workers, size_t buffer_size = 1024, size_t max_allocation = 8,
+                           std::chrono::milliseconds run_time = 1s ) :
             jps::experiment( n_workers, run_time, 0.1s ),
             MAX_ALLOC( max_allocation ),
             buffer( buffer_size ),
@@ -27,52 +37,285 @@ public:
     size_t run() {
         return jps::experiment::run( &ThroughPutMeasurement::shoot );
     }
+    /**
+     * Run while another thread takes snapshots of the bitmap in a loop.
+     */
+    size_t run_with_snapshots() {
+        std::atomic<bool> done{ false };
+        std::thread snapshotter( [&]() {
+            using W = typename bit_allocator::WordT;
+            std::vector<W> copy( bit_allocator_->size()/( 8*sizeof( W )));
+            while( !done.load( std::memory_order::relaxed )) {
+                bit_allocator_->snapshot( copy.data() );
+                ++snapshots;
+            }
+        } );
+
+        const auto n_ops = run();
+        done.store( true, std::memory_order::relaxed );
+        snapshotter.join();
+        return n_ops;
+    }
     void shoot() {
         static thread_local auto i = 0ul;
-        const auto n = MAX_ALLOC > 1 ?
-                       ( i*this->get_worker_id() ) % ( MAX_ALLOC-1 ) + 1
-                                     :
-                       1;
+        // cycle through the lengths 1 to MAX_ALLOC, each worker at an offset of its own
+        const auto n = ( i++ + this->get_worker_id() ) % MAX_ALLOC + 1;
         const auto p = bit_allocator_->alloc( n );
 
         bit_allocator_->free( p, n );
     }
 
     const size_t MAX_ALLOC;
+    size_t snapshots = 0;
 
     std::vector<uint8_t> buffer;
     bit_allocator* bit_allocator_;
 };
 
 
-size_t min_workers = 1;
-size_t max_workers = 24;
-size_t repeat = 1;
+/**
+ * The throughput of workers in forked processes, which share the allocator in an anonymous shared mapping.
+ */
+template<typename bit_allocator>
+class ProcessThroughPutMeasurement
+{
+public:
+    ProcessThroughPutMeasurement( size_t n_workers, size_t buffer_size = 1024, size_t max_allocation = 8,
+                                  std::chrono::milliseconds run_time = 1s ) :
+            n_workers_( n_workers ),
+            run_time_( run_time ),
+            MAX_ALLOC( max_allocation ),
+            shm_( jps::shared_bit_allocator<bit_allocator>::create_anonymous( buffer_size )),
+            control_len_( sizeof( control ) + ( n_workers-1 )*sizeof( worker_score )),
+            control_( new ( mmap( nullptr, control_len_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 ))
+                      control() )
+    {
+        for( auto i = 1ul; i < n_workers_; ++i )
+            new ( &control_->scores[i] ) worker_score();
+    }
+    ~ProcessThroughPutMeasurement() {
+        munmap( control_, control_len_ );
+    }
+
+    void pin( std::vector<unsigned> cpus ) {
+        cpus_ = std::move( cpus );
+    }
+
+    size_t run() {
+        std::vector<pid_t> workers;
+        for( auto worker_id = 0ul; worker_id < n_workers_; ++worker_id ) {
+            const auto pid = fork();
+            if( pid == 0 ) {
+                _work( worker_id );
+                _exit( 0 );
+            }
+            workers.push_back( pid );
+        }
+
+        while( control_->started.load( std::memory_order::acquire ) != n_workers_ )
+            std::this_thread::yield();
+        control_->go.store( true, std::memory_order::release );
+
+        // let the processes warm up, then let them do their job
+        std::this_thread::sleep_for( 0.1s );
+        const auto warmup_result = _hits();
+        std::this_thread::sleep_for( run_time_ );
+        const auto result = _hits() - warmup_result;
+
+        control_->stop.store( true, std::memory_order::release );
+        for( const auto pid: workers )
+            waitpid( pid, nullptr, 0 );
+        return result;
+    }
+
+private:
+    struct alignas( 128 ) worker_score {
+        std::atomic<size_t> hits{ 0 };
+    };
+    struct control {
+        std::atomic<size_t> started{ 0 };
+        std::atomic<bool> go{ false };
+        std::atomic<bool> stop{ false };
+        worker_score scores[1];     // of all workers, like the words of an allocator
+    };
+
+    void _work( size_t worker_id ) {
+        if( !cpus_.empty() )
+            jps::pin_this_thread( cpus_[worker_id % cpus_.size()] );
+        control_->started.fetch_add( 1, std::memory_order::release );
+        while( !control_->go.load( std::memory_order::acquire ))
+            std::this_thread::yield();
+
+        auto& hits = control_->scores[worker_id].hits;
+        for( auto i = 0ul; !control_->stop.load( std::memory_order::relaxed ); ++i ) {
+            // cycle through the lengths 1 to MAX_ALLOC like the threads do
+            const auto n = ( i + worker_id ) % MAX_ALLOC + 1;
+            const auto p = shm_->alloc( n );
+            shm_->free( p, n );
+            hits.fetch_add( 1, std::memory_order::relaxed );
+        }
+    }
+    size_t _hits() const {
+        size_t result = 0;
+        for( auto i = 0ul; i < n_workers_; ++i )
+            result += control_->scores[i].hits.load( std::memory_order::relaxed );
+        return result;
+    }
+
+    const size_t n_workers_;
+    const std::chrono::milliseconds run_time_;
+    const size_t MAX_ALLOC;
+    std::vector<unsigned> cpus_;
+
+    jps::shared_bit_allocator<bit_allocator> shm_;
+    const size_t control_len_;
+    control* control_;
+};
+
+
+struct sweep {
+    size_t min_workers;
+    size_t max_workers;
+    size_t buffer_size;
+    size_t max_alloc;
+    std::chrono::milliseconds run_time;
+    size_t repeat;
+    bool snapshot;
+    std::string modes;
+    jps::report::format format;
+};
 
 template<typename BA = jps::serialized_bit_allocator<uint64_t, jps::_single_threaded_bit_allocator>>
-void loop_tests() {
-    std::cout << "\t#worker\t#maxlen\t#ops/us" << std::endl;
-    for( auto max_alloc = 1; max_alloc <= 8; max_alloc *= 2 ) {
-        for( auto t = min_workers; t <= max_workers; ++t ) {
+void loop_tests( const char* backend, const char* mode, const sweep& s, const jps::topology& topo, jps::affinity a,
+                 jps::report& results ) {
+    const auto cpus = topo.placement( a );
+    const auto max_workers = s.max_workers ? s.max_workers : topo.max_workers( a );
+    const auto run_time_us = double( std::chrono::duration_cast<std::chrono::microseconds>( s.run_time ).count() );
+
+    if( s.format == jps::report::format::text ) {
+        std::cout << "=== " << backend << " (" << jps::to_string( a ) << ", " << mode << ")" << std::endl;
+        std::cout << "\t#worker\t#maxlen\t#ops/us\t#min\t#max" << ( s.snapshot ? "\t#snapshots/s" : "" ) << std::endl;
+    }
+    for( auto max_alloc = 1ul; max_alloc <= s.max_alloc; max_alloc *= 2 ) {
+        for( auto t = s.min_workers; t <= max_workers; ++t ) {
             size_t n_ops = 0;
-            for( auto r = 0u; r < repeat; ++r ) {
-                ThroughPutMeasurement<BA> test( t, 8192, max_alloc, 500ms );
-                n_ops += test.run();
+            size_t n_snapshots = 0;
+            double min_ops = 0.;
+            double max_ops = 0.;
+            for( auto r = 0u; r < s.repeat; ++r ) {
+                size_t ops = 0;
+                if( std::string( mode ) == "processes" ) {
+                    if constexpr( !BA::is_process_local ) {
+                        ProcessThroughPutMeasurement<BA> test( t, s.buffer_size, max_alloc, s.run_time );
+                        test.pin( cpus );
+                        ops = test.run();
+                    }
+                }
+                else {
+                    ThroughPutMeasurement<BA> test( t, s.buffer_size, max_alloc, s.run_time );
+                    test.pin( cpus );
+                    ops = s.snapshot ? test.run_with_snapshots() : test.run();
+                    n_snapshots += test.snapshots;
+                }
+                const auto ops_per_us = double( ops ) / run_time_us;
+
+                n_ops += ops;
+                min_ops = r == 0 ? ops_per_us : std::min( min_ops, ops_per_us );
+                max_ops = r == 0 ? ops_per_us : std::max( max_ops, ops_per_us );
+            }
+            const auto ops_per_us = double( n_ops ) / ( double( s.repeat ) * run_time_us );
+            const auto snapshots_per_s = double( n_snapshots ) * 1e6 / ( double( s.repeat ) * run_time_us );
+
+            results.add_row( { backend, jps::to_string( a ), mode, t, max_alloc, s.buffer_size,
+                               size_t( s.run_time.count() ), s.repeat, ops_per_us, min_ops, max_ops,
+                               snapshots_per_s } );
+            if( s.format == jps::report::format::text ) {
+                std::cout << "\t" << t << "\t" << max_alloc << "\t" << ops_per_us
+                          << "\t" << min_ops << "\t" << max_ops;
+                if( s.snapshot )
+                    std::cout << "\t" << snapshots_per_s;
+                std::cout << std::endl;
             }
-            // ops/100ms = ops/repeat  ==>  ops/s = 10*ops/repeat  ==>  ops/us = 10*ops/repeat/1'000'000 = ops/repeat/100'000
-            std::cout << "\t" << t << "\t" << max_alloc << "\t" << double( n_ops ) / ( repeat * 500'000. ) << std::endl;
         }
     }
+    if( s.format == jps::report::format::text )
+        std::cout << std::endl;
+}
+
+/**
+ * Run the sweep with threads and with processes as workers, unless deselected. Flat combining publishes requests by
+ * pointers into the memory of a process, so it is only measured with threads.
+ */
+template<typename BA>
+void loop_modes( const char* backend, const sweep& s, const jps::topology& topo, jps::affinity a,
+                 jps::report& results ) {
+    if( s.modes == "all" || s.modes == "threads" )
+        loop_tests<BA>( backend, "threads", s, topo, a, results );
+    if( !BA::is_process_local && ( s.modes == "all" || s.modes == "processes" ))
+        loop_tests<BA>( backend, "processes", s, topo, a, results );
 }
 
-int main( [[maybe_unused]] int argc, [[maybe_unused]] char* argv[] ) {
-    std::cout << "=== mutex_based" << std::endl;
-    loop_tests<jps::serialized_bit_allocator<uint64_t, jps::_single_threaded_bit_allocator>>();
-    std::cout << std::endl;
+int main( int argc, char* argv[] ) {
+    const auto topo = jps::topology::detect();
+
+    jps::options opts( argc, argv );
+    sweep s{};
+    s.min_workers = opts.get<size_t>( "min-workers", 1, "smallest number of workers in the sweep" );
+    s.max_workers = opts.get<size_t>( "max-workers", 0, "largest number of workers, 0 = detected from the machine" );
+    s.buffer_size = opts.get<size_t>( "buffer-size", 8192, "size of the bitmap buffer in bytes" );
+    s.max_alloc = opts.get<size_t>( "max-alloc", 8, "largest allocation length, doubled from 1 in the sweep" );
+    s.run_time = std::chrono::milliseconds( opts.get<size_t>( "run-time", 500, "run time per measurement in ms" ));
+    s.repeat = opts.get<size_t>( "repeat", 1, "number of repetitions per measurement" );
+    const auto affinities = opts.get( "affinity", "compact", "none|compact|scatter|core|numa|all" );
+    const auto backends = opts.get( "backend", "all",
+                                    "mutex_based|lock_free|lock_free_128|adaptive|flat_combining|all" );
+    s.snapshot = opts.flag( "snapshot", "take snapshots of the bitmap in a loop on another thread while measuring" );
+    s.modes = opts.get( "mode", "threads", "run the workers as threads|processes|all" );
+    s.format = jps::report::format_from_string( opts.get( "format", "text", "text|csv|json" ));
+    const auto output = opts.get( "output", "", "write csv/json results to this file instead of stdout" );
+    if( opts.help() )
+        return 0;
+
+    if( s.format == jps::report::format::text )
+        std::cout << "# " << topo.n_cpus() << " cpus, " << topo.n_cores() << " cores, "
+                  << topo.n_packages() << " packages, " << topo.n_nodes() << " numa nodes" << std::endl;
 
-    std::cout << "=== lock_free" << std::endl;
-    loop_tests<jps::serialized_bit_allocator<uint64_t, jps::_reentrant_lock_free_bit_allocator>>();
-    std::cout << std::endl;
+    std::vector<jps::affinity> policies;
+    if( affinities == "all" )
+        policies = { jps::affinity::none, jps::affinity::compact, jps::affinity::scatter,
+                     jps::affinity::core, jps::affinity::numa };
+    else
+        policies = { jps::affinity_from_string( affinities ) };
+
+    jps::report results( { "backend", "affinity", "mode", "workers", "max_alloc", "buffer_size",
+                           "run_time_ms", "repeat", "ops_per_us", "min_ops_per_us", "max_ops_per_us",
+                           "snapshots_per_s" } );
+    for( const auto a: policies ) {
+        if( backends == "all" || backends == "mutex_based" )
+            loop_modes<jps::serialized_bit_allocator<uint64_t, jps::_single_threaded_bit_allocator>>(
+                    "mutex_based", s, topo, a, results );
+        if( backends == "all" || backends == "lock_free" )
+            loop_modes<jps::serialized_bit_allocator<uint64_t, jps::_reentrant_lock_free_bit_allocator>>(
+                    "lock_free", s, topo, a, results );
+        if( backends == "all" || backends == "lock_free_128" )
+            loop_modes<jps::serialized_bit_allocator<jps::uint128_t, jps::_reentrant_lock_free_bit_allocator>>(
+                    "lock_free_128", s, topo, a, results );
+        if( backends == "all" || backends == "adaptive" )
+            loop_modes<jps::serialized_bit_allocator<uint64_t, jps::_adaptive_bit_allocator>>(
+                    "adaptive", s, topo, a, results );
+        if( backends == "all" || backends == "flat_combining" )
+            loop_modes<jps::serialized_bit_allocator<uint64_t, jps::_flat_combining_bit_allocator>>(
+                    "flat_combining", s, topo, a, results );
+    }
+
+    if( s.format != jps::report::format::text ) {
+        if( output.empty() )
+            results.write( std::cout, s.format );
+        else {
+            std::ofstream out( output );
+            results.write( out, s.format );
+        }
+    }
 
     return 0;
 }
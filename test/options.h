@@ -0,0 +1,101 @@
+#pragma once
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+
+namespace jps {
+
+/**
+ * A minimal command line parser for the benchmarks. Options are given as `--name=value` or `--name value`;
+ * a `--name` without a value is a flag.
+ */
+class options {
+public:
+    options( int argc, char* argv[] ) : program_( argc > 0 ? argv[0] : "" ) {
+        for( auto i = 1; i < argc; ++i ) {
+            std::string arg = argv[i];
+            if( arg.size() < 3 || arg.compare( 0, 2, "--" ) != 0 )
+                throw std::invalid_argument( "unexpected argument: " + arg );
+
+            arg = arg.substr( 2 );
+            const auto eq = arg.find( '=' );
+            if( eq != std::string::npos )
+                values_[arg.substr( 0, eq )] = arg.substr( eq+1 );
+            else if( i+1 < argc && std::string( argv[i+1] ).compare( 0, 2, "--" ) != 0 )
+                values_[arg] = argv[++i];
+            else
+                values_[arg] = "";
+        }
+    }
+
+    /**
+     * Declare an option for the usage message and return its value, or the default if it was not given.
+     */
+    template<typename T>
+    T get( const std::string& name, const T& default_value, const std::string& help ) {
+        std::stringstream ss;
+        ss << default_value;
+        usage_.push_back( "  --" + name + "=<" + ss.str() + ">\t" + help );
+
+        const auto it = values_.find( name );
+        if( it == values_.end() )
+            return default_value;
+
+        consumed_.push_back( name );
+        T value;
+        std::stringstream in( it->second );
+        if( !( in >> value ) || !in.eof() )
+            throw std::invalid_argument( "invalid value for --" + name + ": " + it->second );
+        return value;
+    }
+    std::string get( const std::string& name, const char* default_value, const std::string& help ) {
+        usage_.push_back( "  --" + name + "=<" + default_value + ">\t" + help );
+
+        const auto it = values_.find( name );
+        if( it == values_.end() )
+            return default_value;
+
+        consumed_.push_back( name );
+        return it->second;
+    }
+    bool flag( const std::string& name, const std::string& help ) {
+        usage_.push_back( "  --" + name + "\t" + help );
+        if( values_.count( name ) == 0 )
+            return false;
+
+        consumed_.push_back( name );
+        return true;
+    }
+
+    /**
+     * Print the usage message and return true if `--help` was given, throw on unknown options.
+     */
+    bool help( std::ostream& os = std::cout ) {
+        if( values_.count( "help" )) {
+            os << "usage: " << program_ << " [options]" << std::endl;
+            for( const auto& u: usage_ )
+                os << u << std::endl;
+            return true;
+        }
+
+        for( const auto& [name, value]: values_ ) {
+            if( std::find( consumed_.begin(), consumed_.end(), name ) == consumed_.end() )
+                throw std::invalid_argument( "unknown option: --" + name );
+        }
+        return false;
+    }
+
+private:
+    std::string program_;
+    std::map<std::string, std::string> values_;
+    std::vector<std::string> usage_;
+    std::vector<std::string> consumed_;
+};
+
+}
@@ -0,0 +1,258 @@
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "atomic_bit_allocator/atomic_bit_allocator.h"
+#include "atomic_bit_allocator/trace.h"
+#include "options.h"
+#include "report.h"
+
+using namespace std::chrono_literals;
+
+using recorder = jps::trace_recorder<1 << 20>;
+
+
+/**
+ * Record a trace of a random-size mix: every worker keeps its last 16 allocations alive.
+ */
+void generate( const std::string& file, size_t n_workers, size_t n_ops, size_t n_bits, size_t max_alloc ) {
+    using BA = jps::serialized_bit_allocator<uint64_t, jps::_reentrant_lock_free_bit_allocator, false, recorder>;
+
+    std::vector<uint64_t> buffer( sizeof( BA )/sizeof( uint64_t ) + ( n_bits+63 )/64 );
+    auto* bit_allocator = new ( buffer.data() ) BA( buffer.size()*sizeof( uint64_t ));
+
+    std::vector<std::thread> workers;
+    for( auto t = 0ul; t < n_workers; ++t ) {
+        workers.emplace_back( [=]() {
+            std::vector<std::pair<size_t, size_t>> live( 16, { 0, 0 } );
+            uint64_t rng = 0x9e3779b97f4a7c15ull*( t+1 );
+            for( auto i = 0ul; i < n_ops; ++i ) {
+                rng ^= rng << 13;
+                rng ^= rng >> 7;
+                rng ^= rng << 17;
+
+                auto& victim = live[i % live.size()];
+                if( victim.second )
+                    bit_allocator->free( victim.first, victim.second );
+
+                const auto n = 1 + rng % max_alloc;
+                const auto p = bit_allocator->alloc( n );
+                victim = { p, p == bit_allocator->size() ? 0 : n };
+            }
+            for( const auto& [p, n]: live )
+                if( n )
+                    bit_allocator->free( p, n );
+        } );
+    }
+    for( auto& w: workers )
+        w.join();
+
+    std::ofstream out( file, std::ios::binary );
+    recorder::write( out );
+}
+
+
+/**
+ * Re-execute a trace against a backend and sample the fragmentation of the free space while doing so.
+ *
+ * The positions of the replay generally differ from the recorded ones, so allocations are tracked by their recorded
+ * position. Frees of allocations that failed in the replay, or that were recorded before the trace starts, are
+ * skipped.
+ */
+template<typename BA>
+class replay {
+public:
+    replay( const std::vector<jps::trace_record>& trace, size_t n_bits, size_t sample_every ) :
+            trace_( trace ),
+            sample_every_( sample_every ),
+            buffer_( sizeof( BA )/sizeof( uint64_t ) + ( n_bits+63 )/64 ),
+            bit_allocator_( new ( buffer_.data() ) BA( buffer_.size()*sizeof( uint64_t )))
+    {}
+
+    /**
+     * Replay all records in order of their timestamps on the calling thread.
+     */
+    void sequential() {
+        for( auto i = 0ul; i < trace_.size(); ++i )
+            _apply( i );
+    }
+
+    /**
+     * Replay each recorded thread on a thread of its own, but in the exact interleaving of the trace.
+     */
+    void interleaved() {
+        std::vector<std::vector<size_t>> per_thread;
+        for( auto i = 0ul; i < trace_.size(); ++i ) {
+            if( per_thread.size() <= trace_[i].thread )
+                per_thread.resize( trace_[i].thread+1 );
+            per_thread[trace_[i].thread].push_back( i );
+        }
+
+        std::atomic<size_t> next{ 0 };
+        std::vector<std::thread> threads;
+        for( const auto& records: per_thread ) {
+            threads.emplace_back( [&]() {
+                for( const auto i: records ) {
+                    while( next.load( std::memory_order::acquire ) != i )
+                        std::this_thread::yield();
+                    _apply( i );
+                    next.store( i+1, std::memory_order::release );
+                }
+            } );
+        }
+        for( auto& th: threads )
+            th.join();
+    }
+
+    void write( const char* backend, const char* placement, const char* mode, jps::report& results ) const {
+        for( const auto& s: samples_ ) {
+            const auto free_bits = bit_allocator_->size() - s.usage;
+            results.add_row( { backend, placement, mode, s.ops, size_t( s.elapsed.count()/1000 ), s.usage,
+                               s.largest_free,
+                               free_bits ? 1. - double( s.largest_free )/double( free_bits ) : 0.,
+                               s.elapsed.count() ? double( s.ops )/( double( s.elapsed.count() )/1000. ) : 0. } );
+        }
+    }
+
+    [[nodiscard]] size_t failed() const { return failed_; }
+
+private:
+    struct sample {
+        size_t ops;
+        std::chrono::nanoseconds elapsed;
+        size_t usage;
+        size_t largest_free;
+    };
+
+    void _apply( size_t i ) {
+        const auto start = std::chrono::steady_clock::now();
+
+        const auto& r = trace_[i];
+        if( r.flags & jps::trace_len_saturated ) {
+            // the length is not known, the range is lost for the replay like a failed allocation
+            if( r.op == jps::trace_op::alloc )
+                ++failed_;
+        }
+        else if( r.op == jps::trace_op::alloc ) {
+            const auto p = bit_allocator_->alloc( r.len );
+            if( p != bit_allocator_->size() )
+                live_[r.pos] = p;
+            else
+                ++failed_;
+        }
+        else {
+            const auto it = live_.find( r.pos );
+            if( it != live_.end() ) {
+                bit_allocator_->free( it->second, r.len );
+                live_.erase( it );
+            }
+        }
+
+        // the time for sampling is not part of the throughput
+        elapsed_ += std::chrono::steady_clock::now() - start;
+        if(( i+1 ) % sample_every_ == 0 || i+1 == trace_.size() )
+            samples_.push_back( { i+1, elapsed_, bit_allocator_->usage(), bit_allocator_->largest_free_range() } );
+    }
+
+    const std::vector<jps::trace_record>& trace_;
+    const size_t sample_every_;
+    std::vector<uint64_t> buffer_;
+    BA* bit_allocator_;
+
+    std::unordered_map<size_t, size_t> live_;
+    size_t failed_ = 0;
+    std::chrono::nanoseconds elapsed_{ 0 };
+    std::vector<sample> samples_;
+};
+
+
+template<typename BA>
+void run( const char* backend, const char* placement, const std::string& modes,
+          const std::vector<jps::trace_record>& trace, size_t n_bits, size_t sample_every,
+          jps::report::format format, jps::report& results ) {
+    for( const auto* mode: { "sequential", "interleaved" } ) {
+        if( modes != "all" && modes != mode )
+            continue;
+
+        replay<BA> r( trace, n_bits, sample_every );
+        if( std::string( mode ) == "sequential" )
+            r.sequential();
+        else
+            r.interleaved();
+        r.write( backend, placement, mode, results );
+
+        if( format == jps::report::format::text )
+            std::cout << "=== " << backend << ", " << placement << " (" << mode << "): " << r.failed()
+                      << " failed allocations" << std::endl;
+    }
+}
+
+/**
+ * Replay on both backends with the placement policy `P`, unless deselected.
+ */
+template<typename P>
+void run_placement( const char* placement, const std::string& placements, const std::string& backends,
+                    const std::string& modes, const std::vector<jps::trace_record>& trace, size_t n_bits,
+                    size_t sample_every, jps::report::format format, jps::report& results ) {
+    if( placements != "all" && placements != placement )
+        return;
+
+    using mutex_based = jps::serialized_bit_allocator<uint64_t, jps::_single_threaded_bit_allocator, false,
+                                                      jps::no_recorder, P>;
+    using lock_free = jps::serialized_bit_allocator<uint64_t, jps::_reentrant_lock_free_bit_allocator, false,
+                                                    jps::no_recorder, P>;
+
+    if( backends == "all" || backends == "mutex_based" )
+        run<mutex_based>( "mutex_based", placement, modes, trace, n_bits, sample_every, format, results );
+    if( backends == "all" || backends == "lock_free" )
+        run<lock_free>( "lock_free", placement, modes, trace, n_bits, sample_every, format, results );
+}
+
+int main( int argc, char* argv[] ) {
+    jps::options opts( argc, argv );
+    const auto file = opts.get( "trace", "trace.bin", "the trace file to replay or generate" );
+    const auto generate_ops = opts.get<size_t>( "generate", 0, "record a trace of this many ops per worker first" );
+    const auto n_workers = opts.get<size_t>( "workers", 4, "number of workers when generating a trace" );
+    const auto max_alloc = opts.get<size_t>( "max-alloc", 8, "largest allocation length when generating a trace" );
+    auto n_bits = opts.get<size_t>( "bits", 0, "number of bits to replay on, 0 = as large as the trace requires" );
+    const auto sample_every = opts.get<size_t>( "sample", 10000, "sample the fragmentation every this many ops" );
+    const auto backends = opts.get( "backend", "all", "mutex_based|lock_free|all" );
+    const auto modes = opts.get( "mode", "all", "sequential|interleaved|all" );
+    const auto placements = opts.get( "placement", "first_fit", "first_fit|next_fit|best_fit|top_down|all" );
+    const auto format = jps::report::format_from_string( opts.get( "format", "text", "text|csv|json" ));
+    const auto output = opts.get( "output", "", "write the results to this file instead of stdout" );
+    if( opts.help() )
+        return 0;
+
+    if( generate_ops )
+        generate( file, n_workers, generate_ops, n_bits ? n_bits : 65536, max_alloc );
+
+    std::ifstream in( file, std::ios::binary );
+    const auto trace = jps::read_trace( in );
+    if( n_bits == 0 )
+        for( const auto& r: trace )
+            n_bits = std::max( n_bits, size_t( r.pos + r.len ));
+
+    jps::report results( { "backend", "placement", "mode", "ops", "elapsed_us", "usage", "largest_free_range",
+                           "fragmentation", "ops_per_us" } );
+    run_placement<jps::first_fit>( "first_fit", placements, backends, modes, trace, n_bits, sample_every, format,
+                                   results );
+    run_placement<jps::next_fit>( "next_fit", placements, backends, modes, trace, n_bits, sample_every, format,
+                                  results );
+    run_placement<jps::best_fit>( "best_fit", placements, backends, modes, trace, n_bits, sample_every, format,
+                                  results );
+    run_placement<jps::top_down>( "top_down", placements, backends, modes, trace, n_bits, sample_every, format,
+                                  results );
+
+    if( output.empty() )
+        results.write( std::cout, format );
+    else {
+        std::ofstream out( output );
+        results.write( out, format );
+    }
+
+    return 0;
+}
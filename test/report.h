@@ -0,0 +1,108 @@
+#pragma once
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <variant>
+#include <vector>
+
+
+namespace jps {
+
+/**
+ * A table of benchmark results that can be written as human-readable text, CSV, or JSON.
+ *
+ * The CSV and JSON outputs are meant to be collected over time to track regressions, so each row carries all
+ * parameters of its measurement rather than relying on the grouping of the text output.
+ */
+class report {
+public:
+    using value = std::variant<std::string, size_t, double>;
+
+    enum class format { text, csv, json };
+
+    static format format_from_string( const std::string& s ) {
+        if( s == "text" ) return format::text;
+        if( s == "csv" )  return format::csv;
+        if( s == "json" ) return format::json;
+        throw std::invalid_argument( "unknown output format: " + s );
+    }
+
+    explicit report( std::vector<std::string> columns ) : columns_( std::move( columns )) {}
+
+    void add_row( std::vector<value> row ) {
+        if( row.size() != columns_.size() )
+            throw std::invalid_argument( "row does not match the columns of the report" );
+        rows_.push_back( std::move( row ));
+    }
+
+    void write( std::ostream& os, format f ) const {
+        switch( f ) {
+            case format::text:
+                _write_header( os );
+                for( auto r = 0ul; r < rows_.size(); ++r )
+                    _write_row( os, r );
+                break;
+
+            case format::csv:
+                for( auto c = 0ul; c < columns_.size(); ++c )
+                    os << ( c ? "," : "" ) << columns_[c];
+                os << "\n";
+                for( const auto& row: rows_ ) {
+                    for( auto c = 0ul; c < row.size(); ++c )
+                        os << ( c ? "," : "" ) << _text( row[c] );
+                    os << "\n";
+                }
+                break;
+
+            case format::json:
+                os << "[\n";
+                for( auto r = 0ul; r < rows_.size(); ++r ) {
+                    os << "  {";
+                    for( auto c = 0ul; c < columns_.size(); ++c ) {
+                        os << ( c ? ", " : "" ) << "\"" << columns_[c] << "\": ";
+                        if( std::holds_alternative<std::string>( rows_[r][c] ))
+                            os << "\"" << std::get<std::string>( rows_[r][c] ) << "\"";
+                        else
+                            os << _text( rows_[r][c] );
+                    }
+                    os << ( r+1 < rows_.size() ? "},\n" : "}\n" );
+                }
+                os << "]\n";
+                break;
+        }
+        os.flush();
+    }
+
+    [[nodiscard]] size_t size() const { return rows_.size(); }
+
+private:
+    void _write_row( std::ostream& os, size_t r ) const {
+        for( auto c = 0ul; c < columns_.size(); ++c )
+            os << "\t" << _text( rows_[r][c] );
+        os << std::endl;
+    }
+    void _write_header( std::ostream& os ) const {
+        for( const auto& c: columns_ )
+            os << "\t#" << c;
+        os << std::endl;
+    }
+
+    static std::string _text( const value& v ) {
+        if( std::holds_alternative<std::string>( v ))
+            return std::get<std::string>( v );
+        if( std::holds_alternative<size_t>( v ))
+            return std::to_string( std::get<size_t>( v ));
+
+        std::ostringstream ss;
+        ss << std::setprecision( 6 ) << std::get<double>( v );
+        return ss.str();
+    }
+
+    std::vector<std::string> columns_;
+    std::vector<std::vector<value>> rows_;
+};
+
+}
@@ -4,10 +4,18 @@
 
 #include <chrono>
 #include <bitset>
+#include <cstdio>
 #include <cstring>
+#include <coroutine>
+#include <deque>
+#include <mutex>
 #include <vector>
 #include <iostream>
+#include <sys/wait.h>
 #include "atomic_bit_allocator/atomic_bit_allocator.h"
+#include "atomic_bit_allocator/shared.h"
+#include "atomic_bit_allocator/sparse.h"
+#include "atomic_bit_allocator/trace.h"
 
 using namespace std::chrono_literals;
 
@@ -30,12 +38,22 @@ struct alignas(128) aligned_ctr {
     std::atomic<size_t> ctr;
 };
 
-template<size_t T>
+template<typename W>
+using backoff_bit_allocator = jps::_reentrant_lock_free_bit_allocator<W, jps::exponential_backoff>;
+
+template<typename W>
+using few_slots_bit_allocator = jps::_flat_combining_bit_allocator<W, 4>;
+
+template<typename W, template<typename> typename bit_allocator = jps::_reentrant_lock_free_bit_allocator>
+using waiting_bit_allocator = jps::serialized_bit_allocator<W, bit_allocator, false, jps::no_recorder, jps::first_fit,
+                                                            false, void, true>;
+
+template<size_t T, typename BA = jps::serialized_bit_allocator<uint8_t>, size_t max_attempts = 0>
 void stress_test( const size_t num_ops ) {
     const auto MAX_ALLOC = 16;
-    bit_allocator_buffer<uint8_t, MAX_ALLOC*MAX_ALLOC*T> buffer;
-    std::memset( &buffer, 0, sizeof( buffer ));
-    auto* ballocator = new ( &buffer ) jps::serialized_bit_allocator<uint8_t>( sizeof( buffer ));
+    // the header size depends on the backend
+    std::vector<uint8_t> buffer( sizeof( BA ) + MAX_ALLOC*MAX_ALLOC*T );
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size() );
 
     // manage workers
     std::vector<std::thread> workers;
@@ -52,7 +70,16 @@ void stress_test( const size_t num_ops ) {
         for( auto i = 0ul; i < num_ops; ++i ) {
             // allocate some bits and interpret it as a lock into the ctrs vector
             const auto n = ( i*thread_id ) % ( MAX_ALLOC-1 ) + 1;
-            const auto p = ballocator->alloc( n );
+            size_t p;
+            if constexpr( max_attempts == 0 )
+                p = ballocator->alloc( n );
+            else {
+                // give up on contention and try again with another length
+                const auto r = ballocator->try_alloc( n, max_attempts );
+                if( r.status != jps::alloc_status::success )
+                    continue;
+                p = r.pos;
+            }
 
             // increment locked ctrs values
             for( auto c = p; c < p+n; ++c ) {
@@ -89,8 +116,479 @@ void stress_test( const size_t num_ops ) {
 }
 
 
+/**
+ * Have more threads allocate than fit into the bitmap at once, so they block in alloc_wait until others free their
+ * bits. A lost wakeup hangs this test.
+ */
+template<size_t T, typename BA>
+void wait_test( const size_t num_ops ) {
+    const auto MAX_ALLOC = 16;
+    // the header holds the state of the waiters, and the bitmap a single word
+    std::vector<uint64_t> buffer( sizeof( BA )/sizeof( uint64_t ));
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( uint64_t ));
+
+    std::vector<aligned_ctr> ctrs( ballocator->size() );
+    std::atomic<size_t> total_sum{ 0 };
+
+    std::vector<std::thread> workers;
+    for( auto thread_id = 0u; thread_id < T; ++thread_id ) {
+        workers.emplace_back( [&, thread_id]() {
+            uint64_t local_val = 0;
+
+            for( auto i = 0ul; i < num_ops; ++i ) {
+                const auto n = ( i*( thread_id+1 )) % MAX_ALLOC + 1;
+                const auto p = ballocator->alloc_wait( n );
+                if( p == ballocator->size() )
+                    throw std::exception();
+
+                for( auto c = p; c < p+n; ++c ) {
+                    ctrs[c].ctr.store( ctrs[c].ctr.load() + 1 );
+                    local_val += 1;
+                }
+
+                ballocator->free( p, n );
+            }
+
+            total_sum.fetch_add( local_val );
+        } );
+    }
+    for( auto& w: workers )
+        w.join();
+
+    size_t locked_sum = 0;
+    for( auto& c: ctrs )
+        locked_sum += c.ctr.load();
+    if( locked_sum != total_sum )
+        throw std::exception();
+}
+
+
+/**
+ * A coroutine that starts right away and nobody waits for.
+ */
+struct detached_task {
+    struct promise_type {
+        detached_task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+/**
+ * A thread pool resuming coroutines in the order they are scheduled.
+ */
+class thread_pool {
+public:
+    struct executor {
+        void operator()( std::coroutine_handle<> h ) const noexcept {
+            std::lock_guard lock( pool->mutex_ );
+            pool->ready_.push_back( h );
+        }
+        thread_pool* pool;
+    };
+
+    executor get_executor() { return { this }; }
+
+    /**
+     * Resume scheduled coroutines until `done()` returns true.
+     */
+    template<typename F>
+    void run( size_t n_threads, F done ) {
+        std::vector<std::thread> threads;
+        for( auto t = 0ul; t < n_threads; ++t ) {
+            threads.emplace_back( [&]() {
+                while( !done() ) {
+                    std::coroutine_handle<> h;
+                    {
+                        std::lock_guard lock( mutex_ );
+                        if( !ready_.empty() ) {
+                            h = ready_.front();
+                            ready_.pop_front();
+                        }
+                    }
+                    if( h )
+                        h.resume();
+                    else
+                        std::this_thread::yield();
+                }
+            } );
+        }
+        for( auto& t: threads )
+            t.join();
+    }
+
+private:
+    std::mutex mutex_;
+    std::deque<std::coroutine_handle<>> ready_;
+};
+
+/**
+ * Run more coroutines than fit into the bitmap at once on a thread pool, so they get suspended in co_alloc until
+ * others free their bits. A lost wakeup hangs this test.
+ */
+template<size_t C, size_t T>
+void co_alloc_test( const size_t num_ops ) {
+    using BA = waiting_bit_allocator<uint64_t>;
+
+    const auto MAX_ALLOC = 16;
+    std::vector<uint64_t> buffer( sizeof( BA )/sizeof( uint64_t ));
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( uint64_t ));
+
+    std::vector<aligned_ctr> ctrs( ballocator->size() );
+    std::atomic<size_t> total_sum{ 0 };
+    std::atomic<size_t> finished{ 0 };
+
+    thread_pool pool;
+    auto coroutine = [&]( size_t id ) -> detached_task {
+        uint64_t local_val = 0;
+
+        for( auto i = 0ul; i < num_ops; ++i ) {
+            const auto n = ( i*( id+1 )) % MAX_ALLOC + 1;
+            const auto p = co_await ballocator->co_alloc( n, pool.get_executor() );
+            if( p == ballocator->size() )
+                throw std::exception();
+
+            for( auto c = p; c < p+n; ++c ) {
+                ctrs[c].ctr.store( ctrs[c].ctr.load() + 1 );
+                local_val += 1;
+            }
+
+            ballocator->free( p, n );
+        }
+
+        total_sum.fetch_add( local_val );
+        finished.fetch_add( 1 );
+    };
+    for( auto id = 0ul; id < C; ++id )
+        coroutine( id );
+
+    pool.run( T, [&]() { return finished.load() == C; } );
+
+    size_t locked_sum = 0;
+    for( auto& c: ctrs )
+        locked_sum += c.ctr.load();
+    if( locked_sum != total_sum )
+        throw std::exception();
+}
+
+
+/**
+ * Take snapshots while threads allocate and free ranges of the same length, which mostly span two words. A
+ * consistent snapshot only contains complete ranges, so its number of set bits is a multiple of that length.
+ */
+template<size_t T>
+void snapshot_test( const size_t num_snapshots ) {
+    using W = uint8_t;
+    using BA = jps::serialized_bit_allocator<W>;
+
+    const auto LEN = 5;
+    bit_allocator_buffer<W, 4*T> buffer;
+    std::memset( &buffer, 0, sizeof( buffer ));
+    auto* ballocator = new ( &buffer ) BA( sizeof( buffer ));
+
+    std::atomic<bool> stop{ false };
+    std::vector<std::thread> workers;
+    for( auto t = 0u; t < T; ++t ) {
+        workers.emplace_back( [&]() {
+            while( !stop.load( std::memory_order::relaxed )) {
+                const auto p = ballocator->alloc( LEN );
+                if( p != ballocator->size() )
+                    ballocator->free( p, LEN );
+            }
+        } );
+    }
+
+    std::vector<W> copy( ballocator->size()/8 );
+    for( auto i = 0ul; i < num_snapshots; ++i ) {
+        ballocator->snapshot( copy.data() );
+
+        size_t n = 0;
+        for( const auto w: copy )
+            n += std::popcount( w );
+        if( n % LEN != 0 )
+            throw std::exception();
+    }
+
+    stop.store( true );
+    for( auto& w: workers )
+        w.join();
+}
+
+
+/**
+ * Allocate ranges that often span pages in a sparse allocator of a few pages, and track the owner of each bit.
+ */
+template<size_t T>
+void sparse_test( const size_t num_ops ) {
+    const auto bits_per_page = size_t( sysconf( _SC_PAGESIZE ))*8;
+    jps::sparse_bit_allocator<uint64_t> ballocator( 4*bits_per_page );
+    std::vector<std::atomic<uint32_t>> owners( ballocator.size() );
+
+    std::vector<std::thread> workers;
+    for( auto thread_id = 1u; thread_id <= T; ++thread_id ) {
+        workers.emplace_back( [&, thread_id]() {
+            uint64_t rng = 0x9e3779b97f4a7c15ull*thread_id;
+            for( auto i = 0ul; i < num_ops; ++i ) {
+                rng ^= rng << 13;
+                rng ^= rng >> 7;
+                rng ^= rng << 17;
+
+                const auto n = 1 + rng % ( bits_per_page/4 );
+                const auto p = ballocator.alloc( n );
+                if( p == ballocator.size() )
+                    continue;
+
+                for( auto c = p; c < p+n; ++c )
+                    if( owners[c].exchange( thread_id ) != 0 )
+                        throw std::exception();
+                for( auto c = p; c < p+n; ++c )
+                    if( owners[c].exchange( 0 ) != thread_id )
+                        throw std::exception();
+
+                ballocator.free( p, n );
+            }
+        } );
+    }
+    for( auto& w: workers )
+        w.join();
+
+    if( ballocator.usage() != 0 || ballocator.committed_pages() > 4 )
+        throw std::exception();
+}
+
+/**
+ * Reopen a persisted sparse allocator with a bit allocated in each page, and allocate while another thread validates
+ * the pages in the background.
+ */
+template<size_t T>
+void sparse_open_test( const size_t num_ops ) {
+    const auto bits_per_page = size_t( sysconf( _SC_PAGESIZE ))*8;
+    const auto n_pages = 16ul;
+    auto* file = std::tmpfile();
+    {
+        jps::sparse_bit_allocator<uint64_t> persisted( fileno( file ), n_pages*bits_per_page );
+        for( auto page = 0ul; page < n_pages; ++page )
+            if( persisted.alloc( 1 ) != page*bits_per_page || persisted.alloc( bits_per_page-1 ) == persisted.size() )
+                throw std::exception();
+        for( auto page = 0ul; page < n_pages; ++page )
+            persisted.free( page*bits_per_page+1, bits_per_page-1 );
+    }
+
+    jps::sparse_bit_allocator<uint64_t> ballocator( fileno( file ), n_pages*bits_per_page );
+    std::vector<std::atomic<uint32_t>> owners( ballocator.size() );
+    for( auto page = 0ul; page < n_pages; ++page )
+        owners[page*bits_per_page] = ~0u;
+
+    std::vector<std::thread> workers;
+    workers.emplace_back( [&]() {
+        while( ballocator.validate( 1 ))
+            std::this_thread::yield();
+    } );
+    for( auto thread_id = 1u; thread_id <= T; ++thread_id ) {
+        workers.emplace_back( [&, thread_id]() {
+            uint64_t rng = 0x9e3779b97f4a7c15ull*thread_id;
+            for( auto i = 0ul; i < num_ops; ++i ) {
+                rng ^= rng << 13;
+                rng ^= rng >> 7;
+                rng ^= rng << 17;
+
+                const auto n = 1 + rng % ( bits_per_page/4 );
+                const auto p = ballocator.alloc( n );
+                if( p == ballocator.size() )
+                    continue;
+
+                for( auto c = p; c < p+n; ++c )
+                    if( owners[c].exchange( thread_id ) != 0 )
+                        throw std::exception();
+                for( auto c = p; c < p+n; ++c )
+                    if( owners[c].exchange( 0 ) != thread_id )
+                        throw std::exception();
+
+                ballocator.free( p, n );
+            }
+        } );
+    }
+    for( auto& w: workers )
+        w.join();
+
+    if( ballocator.usage() != n_pages || ballocator.validated_pages() != n_pages ||
+        ballocator.committed_pages() != n_pages )
+        throw std::exception();
+    std::fclose( file );
+}
+
+template<size_t T>
+void track_lengths_test( const size_t num_ops ) {
+    using BA = jps::serialized_bit_allocator<uint8_t, jps::_reentrant_lock_free_bit_allocator, false, jps::no_recorder,
+                                             jps::first_fit, true>;
+    std::vector<uint8_t> buffer( sizeof( BA ) + 2*64 );
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size() );
+
+    // neighbouring allocations share the words of the companion bitmap
+    std::vector<std::thread> workers;
+    for( auto thread_id = 1u; thread_id <= T; ++thread_id ) {
+        workers.emplace_back( [&, thread_id]() {
+            uint64_t rng = 0x9e3779b97f4a7c15ull*thread_id;
+            for( auto i = 0ul; i < num_ops; ++i ) {
+                rng ^= rng << 13;
+                rng ^= rng >> 7;
+                rng ^= rng << 17;
+
+                const auto n = 1 + rng % 12;
+                const auto p = ballocator->alloc( n );
+                if( p == ballocator->size() )
+                    continue;
+                if( ballocator->size_of( p ) != n )
+                    throw std::exception();
+                ballocator->free( p );
+            }
+        } );
+    }
+    for( auto& w: workers )
+        w.join();
+
+    if( ballocator->usage() != 0 || ballocator->size_of( 0 ) != 0 )
+        throw std::exception();
+}
+
+template<size_t T>
+void owner_tags_test( const size_t num_ops ) {
+    using BA = jps::serialized_bit_allocator<uint8_t, jps::_reentrant_lock_free_bit_allocator, false, jps::no_recorder,
+                                             jps::first_fit, false, uint8_t>;
+    std::vector<uint8_t> buffer( sizeof( BA ) + 64 + 8*64 );
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size() );
+
+    // each worker is an owner that dies with its last allocations alive, while the others carry on
+    std::vector<std::thread> workers;
+    for( auto thread_id = 1u; thread_id <= T; ++thread_id ) {
+        workers.emplace_back( [&, thread_id]() {
+            std::vector<std::pair<size_t, size_t>> live( 8, { 0, 0 } );
+            uint64_t rng = 0x9e3779b97f4a7c15ull*thread_id;
+            for( auto i = 0ul; i < num_ops*thread_id/T; ++i ) {
+                rng ^= rng << 13;
+                rng ^= rng >> 7;
+                rng ^= rng << 17;
+
+                auto& victim = live[i % live.size()];
+                if( victim.second ) {
+                    if( ballocator->owner_of( victim.first ) != thread_id )
+                        throw std::exception();
+                    ballocator->free( victim.first, victim.second );
+                }
+
+                const auto n = 1 + rng % 12;
+                const auto p = ballocator->alloc_for( uint8_t( thread_id ), n );
+                victim = { p, p == ballocator->size() ? 0 : n };
+            }
+
+            size_t alive = 0;
+            for( const auto& v: live )
+                alive += v.second;
+            if( ballocator->release_all( uint8_t( thread_id )) != alive )
+                throw std::exception();
+        } );
+    }
+    for( auto& w: workers )
+        w.join();
+
+    if( ballocator->usage() != 0 )
+        throw std::exception();
+}
+
+struct trace_test_tag {};
+
+/**
+ * Collect the records of a small ring while its thread keeps overwriting them, each record with the next position.
+ */
+void trace_collect_test( const size_t num_collects ) {
+    using recorder = jps::trace_recorder<64, trace_test_tag>;
+
+    std::atomic<bool> done{ false };
+    std::thread recording( [&]() {
+        for( auto i = 0ul; !done.load( std::memory_order::relaxed ); ++i )
+            recorder::record( jps::trace_op::alloc, i, 1 );
+    } );
+    for( auto c = 0ul; c < num_collects; ++c ) {
+        const auto records = recorder::collect();
+        if( records.size() > 64 )
+            throw std::exception();
+        for( auto i = 1ul; i < records.size(); ++i )
+            if( records[i].pos != records[i-1].pos+1 )
+                throw std::exception();
+    }
+    done.store( true, std::memory_order::relaxed );
+    recording.join();
+}
+
+template<size_t P, typename BA>
+void process_test( const size_t num_ops ) {
+    auto shm = jps::shared_bit_allocator<BA>::create_anonymous( 256 );
+    auto* ballocator = shm.get();
+
+    // the process owning each bit, shared as well
+    auto* owner = static_cast<std::atomic<uint8_t>*>( mmap( nullptr, ballocator->size(), PROT_READ | PROT_WRITE,
+                                                            MAP_SHARED | MAP_ANONYMOUS, -1, 0 ));
+    if( owner == MAP_FAILED )
+        throw std::exception();
+
+    std::vector<pid_t> children;
+    for( auto process_id = 1u; process_id <= P; ++process_id ) {
+        const auto pid = fork();
+        if( pid == 0 ) {
+            uint64_t rng = 0x9e3779b97f4a7c15ull*process_id;
+            for( auto i = 0ul; i < num_ops; ++i ) {
+                rng ^= rng << 13;
+                rng ^= rng >> 7;
+                rng ^= rng << 17;
+
+                const auto n = 1 + rng % 8;
+                const auto p = ballocator->alloc( n );
+                if( p == ballocator->size() )
+                    continue;
+                for( auto b = p; b < p+n; ++b )
+                    if( owner[b].exchange( uint8_t( process_id )) != 0 )
+                        _exit( 1 );
+                for( auto b = p; b < p+n; ++b )
+                    owner[b].store( 0 );
+                ballocator->free( p, n );
+            }
+            _exit( 0 );
+        }
+        children.push_back( pid );
+    }
+    for( const auto pid: children ) {
+        int status = 0;
+        if( waitpid( pid, &status, 0 ) != pid || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+            throw std::exception();
+    }
+
+    munmap( owner, ballocator->size() );
+
+    if( ballocator->usage() != 0 )
+        throw std::exception();
+}
+
+
 int main( [[maybe_unused]] int argc, [[maybe_unused]] char* argv[] ) {
     stress_test<16>( 1000000 );
+    stress_test<16, jps::serialized_bit_allocator<uint8_t, backoff_bit_allocator>, 4>( 100000 );
+    stress_test<16, jps::serialized_bit_allocator<uint8_t, jps::_adaptive_bit_allocator>>( 100000 );
+    stress_test<16, jps::serialized_bit_allocator<uint8_t, jps::_flat_combining_bit_allocator>>( 100000 );
+    stress_test<16, jps::serialized_bit_allocator<uint8_t, few_slots_bit_allocator>>( 100000 );
+    stress_test<16, jps::serialized_bit_allocator<jps::uint128_t>>( 100000 );
+    wait_test<16, waiting_bit_allocator<uint64_t>>( 20000 );
+    wait_test<16, waiting_bit_allocator<uint64_t, jps::_single_threaded_bit_allocator>>( 20000 );
+    co_alloc_test<64, 4>( 2000 );
+    snapshot_test<8>( 20000 );
+    sparse_test<8>( 500 );
+    sparse_open_test<8>( 500 );
+    track_lengths_test<8>( 100000 );
+    owner_tags_test<8>( 100000 );
+    trace_collect_test( 10000 );
+    process_test<4, jps::serialized_bit_allocator<uint64_t, jps::_single_threaded_bit_allocator>>( 100000 );
+    process_test<4, jps::serialized_bit_allocator<uint64_t>>( 100000 );
 
     return 0;
 }
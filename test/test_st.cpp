@@ -4,8 +4,19 @@
 
 #include <chrono>
 #include <bitset>
+#include <cstdio>
 #include <cstring>
+#include <coroutine>
+#include <deque>
+#include <sstream>
+#include <thread>
+#include <vector>
 #include "atomic_bit_allocator/atomic_bit_allocator.h"
+#include "atomic_bit_allocator/compress.h"
+#include "atomic_bit_allocator/defragment.h"
+#include "atomic_bit_allocator/shared.h"
+#include "atomic_bit_allocator/sparse.h"
+#include "atomic_bit_allocator/trace.h"
 
 using namespace std::chrono_literals;
 
@@ -406,6 +417,1387 @@ void simple_tests_uint64() {
 }
 
 
+template<size_t N_>
+void range_end_tests_uint8() {
+    using W = uint8_t;
+
+    bit_allocator_buffer<W, N_> buffer;
+    std::memset( &buffer, 0, sizeof( buffer ));
+    auto* ballocator = new ( &buffer ) jps::serialized_bit_allocator<W>( sizeof( buffer ));
+
+    // leave a gap of 3 bits at the end of the first word that is followed by an allocated bit
+    [[maybe_unused]] const auto p1 = ballocator->alloc( 5 );
+    const auto p2 = ballocator->alloc( 3 );
+    [[maybe_unused]] const auto p3 = ballocator->alloc( 1 );
+    assert( p1 == 0 && p2 == 5 && p3 == 8 );
+    ballocator->free( p2, 3 );
+    assert( buffer.buf[0] == 0b11111000 );
+    assert( buffer.buf[1] == 0b10000000 );
+
+    // the gap is too small, so the range has to start after p3
+    [[maybe_unused]] const auto p4 = ballocator->alloc( 4 );
+    assert( p4 == 9 );
+    assert( buffer.buf[0] == 0b11111000 );
+    assert( buffer.buf[1] == 0b11111000 );
+
+    // but it fits exactly 3 bits
+    [[maybe_unused]] const auto p5 = ballocator->alloc( 3 );
+    assert( p5 == 5 );
+    assert( buffer.buf[0] == 0b11111111 );
+}
+
+
+/**
+ * Regression test: a scan ending inside a word after its start word inspects that word as well, and does not report
+ * positions at or beyond its end.
+ */
+template<typename W, template<typename> typename bit_allocator>
+void scan_end_tests() {
+    using backend = bit_allocator<W>;
+    constexpr size_t bits = backend::bits_per_word;
+
+    std::vector<backend> words( 3 );
+    words[0] = W( 0 );
+    words[1] = W( W( 1 ) << ( bits-3 ));        // the bit at bits+2
+    words[2] = W( 0 );
+    assert( words[0].find_first_set( 1, bits+3 ) == bits+2 );
+    assert( words[0].find_first_set( 1, bits+2 ) == bits+2 );
+    assert( words[0].find_first_set( bits+3, 3*bits ) == 3*bits );
+    assert( words[0].find_first_set( 5, 5 ) == 5 );
+
+    words[0] = W( ~W( 0 ));
+    words[1] = W( ~W( 0 ) << ( bits-2 ));       // the bits from bits+2 on are unset
+    assert( words[0].find_first_unset( 1, bits+1 ) == bits+1 );
+    assert( words[0].find_first_unset( 1, bits+5 ) == bits+2 );
+    assert( words[0].find_unset_range( 0, bits+3, 2 ) + 2 > bits+3 );
+}
+
+
+/**
+ * Regression test: full words narrower than `int` are recognized as full, not promoted to an int with unset bits.
+ */
+template<typename W, template<typename> typename bit_allocator>
+void full_word_scan_tests() {
+    using backend = bit_allocator<W>;
+    [[maybe_unused]] constexpr size_t bits = backend::bits_per_word;
+
+    std::vector<backend> words( 4 );
+    for( auto& w: words )
+        w = W( ~W( 0 ));
+    assert( words[0].find_first_unset( 0, 4*bits ) == 4*bits );
+    assert( words[0].find_first_unset( 3, 4*bits ) == 4*bits );
+    assert( words[0].find_unset_range( 0, 4*bits, 1 ) + 1 > 4*bits );
+
+    words[2] = W( W( ~W( 0 )) >> 1 );           // the bit at 2*bits is unset
+    assert( words[0].find_first_unset( 3, 4*bits ) == 2*bits );
+}
+
+
+template<template<typename> typename bit_allocator>
+void try_alloc_tests() {
+    using W = uint16_t;
+
+    bit_allocator_buffer<W, 4> buffer;
+    std::memset( &buffer, 0, sizeof( buffer ));
+    auto* ballocator = new ( &buffer ) jps::serialized_bit_allocator<W, bit_allocator>( sizeof( buffer ));
+    assert( ballocator->size() == 16 );
+
+    [[maybe_unused]] const auto r1 = ballocator->try_alloc( 10, 1 );
+    assert( r1.status == jps::alloc_status::success && r1.pos == 0 );
+    assert( ballocator->data()[0] == 0b11111111'11000000 );
+
+    [[maybe_unused]] const auto r2 = ballocator->try_alloc( 10, 1 );
+    assert( r2.status == jps::alloc_status::full && r2.pos == ballocator->size() );
+    assert( ballocator->data()[0] == 0b11111111'11000000 );
+
+    const auto r3 = ballocator->try_alloc( 6, 1 );
+    assert( r3.status == jps::alloc_status::success && r3.pos == 10 );
+    assert( ballocator->data()[0] == 0b11111111'11111111 );
+
+    // without a single attempt, the allocation cannot succeed
+    ballocator->free( r3.pos, 6 );
+    [[maybe_unused]] const auto r4 = ballocator->try_alloc( 1, 0 );
+    assert( r4.status == jps::alloc_status::contended && r4.pos == ballocator->size() );
+    assert( ballocator->data()[0] == 0b11111111'11000000 );
+}
+
+
+template<typename W, template<typename> typename bit_allocator = jps::_reentrant_lock_free_bit_allocator>
+using waiting_bit_allocator = jps::serialized_bit_allocator<W, bit_allocator, false, jps::no_recorder, jps::first_fit,
+                                                            false, void, true>;
+
+template<typename BA>
+concept can_alloc_wait = requires( BA& ba ) { ba.alloc_wait( size_t( 1 )); };
+
+template<template<typename> typename bit_allocator>
+void alloc_wait_tests() {
+    using W = uint8_t;
+    using BA = waiting_bit_allocator<W, bit_allocator>;
+
+    // only the allocators that support waiting have a header beyond the size of the bitmap
+    static_assert( sizeof( jps::serialized_bit_allocator<uint64_t> ) == 2*sizeof( uint64_t ));
+    static_assert( sizeof( jps::serialized_bit_allocator<W> ) == sizeof( bit_allocator_buffer<W, 1> ));
+    static_assert( can_alloc_wait<BA> && !can_alloc_wait<jps::serialized_bit_allocator<W, bit_allocator>> );
+
+    std::vector<W> buffer( sizeof( BA ));
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size() );
+    assert( ballocator->size() == 8 );
+
+    // a free range is returned right away
+    const auto p = ballocator->alloc_wait( 8, 0ms );
+    assert( p == 0 );
+    assert( ballocator->data()[0] == 0b11111111 );
+
+    // without, the call times out
+    [[maybe_unused]] const auto start = std::chrono::steady_clock::now();
+    [[maybe_unused]] const auto q = ballocator->alloc_wait( 1, 10ms );
+    assert( q == ballocator->size() );
+    assert( std::chrono::steady_clock::now() - start >= 10ms );
+
+    // a waiter gets the bits freed by another thread
+    std::thread releaser( [=]() {
+        std::this_thread::sleep_for( 5ms );
+        ballocator->free( 2, 3 );
+    } );
+    [[maybe_unused]] const auto r = ballocator->alloc_wait( 3 );
+    assert( r == 2 );
+    releaser.join();
+
+    ballocator->free( p, 8 );
+    assert( ballocator->data()[0] == 0 );
+}
+
+template<template<typename> typename bit_allocator>
+void alloc_drain_tests() {
+    using W = uint8_t;
+    using BA = waiting_bit_allocator<W, bit_allocator>;
+
+    const auto n_bits = 64ul;
+    std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/8 );
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+
+    // a free range is returned right away
+    [[maybe_unused]] size_t q;
+    q = ballocator->alloc_drain( 8, 0ms );
+    assert( q == 0 );
+
+    // leave a hole of 4 bits after every allocation of 4 bits
+    for( auto p = 8ul; p < n_bits; p += 4 ) {
+        q = ballocator->alloc( 4 );
+        assert( q == p );
+    }
+    for( auto p = 12ul; p < n_bits; p += 8 )
+        ballocator->free( p, 4 );
+    assert( ballocator->usage() == 36 );
+    q = ballocator->alloc( 16 );
+    assert( q == ballocator->size() );
+
+    // the holes of the reserved window are given back on timeout
+    q = ballocator->alloc_drain( 16, 10ms );
+    assert( q == ballocator->size() );
+    assert( ballocator->usage() == 36 );
+    q = ballocator->alloc( 4 );
+    assert( q == 12 );
+    ballocator->free( 12, 4 );
+
+    // of the equally used windows, the last one is drained
+    std::thread releaser( [=]() {
+        std::this_thread::sleep_for( 5ms );
+        ballocator->free( 56, 4 );
+        std::this_thread::sleep_for( 5ms );
+        ballocator->free( 48, 4 );
+    } );
+    q = ballocator->alloc_drain( 16 );
+    assert( q == 48 );
+    releaser.join();
+    assert( ballocator->usage() == 44 );
+
+    ballocator->free( 48, 16 );
+    assert( ballocator->usage() == 28 );
+}
+
+/**
+ * A coroutine that starts right away and nobody waits for.
+ */
+struct detached_task {
+    struct promise_type {
+        detached_task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+template<typename BA, typename executor>
+detached_task co_alloc_task( BA* ballocator, size_t len, executor ex, size_t& pos ) {
+    pos = co_await ballocator->co_alloc( len, ex );
+}
+
+void co_alloc_tests() {
+    using W = uint8_t;
+    using BA = waiting_bit_allocator<W>;
+
+    // the header only holds the size of the bitmap and the state of the waiting threads, not the coroutines
+    std::vector<W> buffer( sizeof( BA ));
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size() );
+    assert( ballocator->size() == 8 );
+
+    std::deque<std::coroutine_handle<>> ready;
+    auto ex = [&]( std::coroutine_handle<> h ) noexcept { ready.push_back( h ); };
+
+    // free bits are allocated right away
+    size_t p1 = 99, p2 = 99, p3 = 99;
+    co_alloc_task( ballocator, 8, ex, p1 );
+    assert( p1 == 0 && ready.empty() );
+    assert( ballocator->data()[0] == 0b11111111 );
+
+    // otherwise, the coroutines wait
+    co_alloc_task( ballocator, 4, ex, p2 );
+    co_alloc_task( ballocator, 8, ex, p3 );
+    assert( p2 == 99 && p3 == 99 && ready.empty() );
+
+    // only the waiter that fits is handed to the executor, with its bits allocated already
+    ballocator->free( 0, 4 );
+    assert( ready.size() == 1 );
+    assert( ballocator->data()[0] == 0b11111111 );
+    ready.front().resume();
+    ready.pop_front();
+    assert( p2 == 0 && p3 == 99 );
+
+    ballocator->free( 4, 4 );
+    assert( ready.empty() );
+
+    ballocator->free( 0, 4 );
+    assert( ready.size() == 1 );
+    ready.front().resume();
+    ready.pop_front();
+    assert( p3 == 0 );
+    assert( ballocator->data()[0] == 0b11111111 );
+
+    // requests that never fit complete right away
+    size_t p4 = 99;
+    co_alloc_task( ballocator, ballocator->size()+1, ex, p4 );
+    assert( p4 == ballocator->size() && ready.empty() );
+    ballocator->free( p3, 8 );
+    assert( ready.empty() && ballocator->usage() == 0 );
+}
+
+template<template<typename> typename bit_allocator>
+void snapshot_tests() {
+    using W = uint8_t;
+
+    bit_allocator_buffer<W, 32> buffer;
+    std::memset( &buffer, 0, sizeof( buffer ));
+    auto* ballocator = new ( &buffer ) jps::serialized_bit_allocator<W, bit_allocator>( sizeof( buffer ));
+    assert( ballocator->size() >= 32 );
+
+    [[maybe_unused]] size_t p;
+    p = ballocator->alloc( 3 );
+    assert( p == 0 );
+    p = ballocator->alloc( 10 );
+    assert( p == 3 );
+    p = ballocator->alloc( 1 );
+    assert( p == 13 );
+
+    std::vector<W> copy( ballocator->size()/8 );
+    ballocator->snapshot( copy.data() );
+    assert( copy[0] == 0b11111111 && copy[1] == 0b11111100 && copy[2] == 0 && copy[3] == 0 );
+    assert( std::memcmp( copy.data(), ballocator->data(), copy.size() ) == 0 );
+
+    // the multi-word free is counted by the lock-free backend, and the snapshots leave the gate open
+    const auto& guard = jps::_process_guard( ballocator );
+    [[maybe_unused]] const auto before = guard.state_.load();
+    ballocator->free( 3, 10 );
+    ballocator->snapshot( copy.data() );
+    assert( copy[0] == 0b11100000 && copy[1] == 0b00000100 );
+    [[maybe_unused]] const auto after = guard.state_.load();
+    assert(( after >> 32 ) - ( before >> 32 ) == ( bit_allocator<W>::is_reentrant() ? 1 : 0 ));
+    assert(( after & jps::_multi_word_guard::in_flight_mask ) == 0 );
+}
+
+void compress_tests() {
+    using W = uint64_t;
+    using BA = jps::serialized_bit_allocator<W>;
+
+    // one chunk of each container type, and a partial one
+    const auto n_bits = 4*jps::bitmap_chunk_bits + 128;
+    std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/64 );
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+    assert( ballocator->size() == n_bits );
+
+    [[maybe_unused]] size_t p;
+    p = ballocator->alloc( 65536 );
+    assert( p == 0 );
+    p = ballocator->alloc( 65536 );
+    assert( p == 65536 );
+    ballocator->free( 0, 65536 );
+    for( auto p = 2*65536ul; p < 3*65536; p += 1000 )
+        ballocator->free( ballocator->alloc( 900 ) + 100, 200 );
+    auto* words = ballocator->data();
+    for( auto w = 3*1024ul; w < 4*1024; ++w )
+        words[w] = 0x9e3779b97f4a7c15ull*w;
+    words[4*1024] = 0xf0f0;
+
+    std::stringstream ss;
+    jps::export_bitmap( ss, *ballocator );
+    [[maybe_unused]] const auto compressed = ss.str().size();
+    assert( compressed < n_bits/8/2 );
+
+    // restore into a larger buffer
+    std::vector<W> restored_buffer( buffer.size()+2, ~W( 0 ));
+    auto* restored = jps::import_bitmap<BA>( ss, restored_buffer.data(), restored_buffer.size()*sizeof( W ));
+    assert( restored->size() == n_bits + 128 );
+    assert( std::memcmp( restored->data(), ballocator->data(), n_bits/8 ) == 0 );
+    assert( restored->data()[n_bits/64] == 0 && restored->data()[n_bits/64 + 1] == 0 );
+    assert( restored->usage() == ballocator->usage() );
+
+    // a bitmap does not fit into a smaller allocator
+    std::stringstream again;
+    jps::export_bitmap( again, *restored );
+    [[maybe_unused]] bool thrown = false;
+    try {
+        (void) jps::import_bitmap<BA>( again, buffer.data(), buffer.size()*sizeof( W ));
+    }
+    catch( const std::runtime_error& ) {
+        thrown = true;
+    }
+    assert( thrown );
+
+    // but into one of another word size
+    again.seekg( 0 );
+    std::vector<uint32_t> narrow_buffer( 2*restored_buffer.size() + 8 );
+    [[maybe_unused]] auto* narrow = jps::import_bitmap<jps::serialized_bit_allocator<uint32_t>>(
+            again, narrow_buffer.data(), narrow_buffer.size()*sizeof( uint32_t ));
+    assert( narrow->usage() == restored->usage() );
+    for( auto chunk = 0ul; chunk < n_bits; chunk += 256 )
+        assert( narrow->count_in_range( chunk, 256 ) == restored->count_in_range( chunk, 256 ));
+    assert( narrow->is_allocated( 65536, 65536 ));
+    assert( narrow->is_allocated( 4*65536+48, 4 ) && narrow->is_free( 4*65536, 48 ));
+}
+
+void canonical_tests() {
+    using W = uint64_t;
+    using BA = jps::serialized_bit_allocator<W>;
+    using NA = jps::serialized_bit_allocator<uint8_t>;
+
+    // the same allocations in allocators of different word sizes have the same canonical bytes
+    std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + 4 );
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+    std::vector<uint8_t> narrow_buffer( sizeof( NA ) - 1 + 32 );
+    auto* narrow = new ( narrow_buffer.data() ) NA( narrow_buffer.size() );
+    assert( ballocator->size() == 256 && narrow->size() == 256 );
+    for( const auto& [p, n]: { std::pair{ 3ul, 7ul }, { 60ul, 70ul }} ) {
+        [[maybe_unused]] const auto reserved = ballocator->reserve_range( p, n );
+        [[maybe_unused]] const auto narrow_reserved = narrow->reserve_range( p, n );
+        assert( reserved && narrow_reserved );
+    }
+
+    alignas( W ) uint8_t stored[32];
+    alignas( W ) uint8_t narrow_stored[32];
+    jps::store_canonical( *ballocator, stored );
+    jps::store_canonical( *narrow, narrow_stored );
+    assert( std::memcmp( stored, narrow_stored, sizeof( stored )) == 0 );
+    assert( stored[7] == 0b00011111 && stored[6] == 0b11000000 && stored[0] == 0b00001111 );
+    assert( stored[23] == 0b11000000 && stored[22] == 0 && stored[16] == 0 );
+    // canonical bytes are the bytes of 64-bit words on little endian
+    static_assert( jps::is_canonical_layout<W> == ( std::endian::native == std::endian::little ));
+    static_assert( !jps::is_canonical_layout<uint8_t> && !jps::is_canonical_layout<jps::uint128_t> );
+    if constexpr( jps::is_canonical_layout<W> )
+        assert( std::memcmp( stored, ballocator->data(), sizeof( stored )) == 0 );
+
+    // loading converts to the layout of any word size, and leaves the canonical bytes as they are
+    std::vector<W> loaded_buffer( buffer.size() );
+    auto* loaded = new ( loaded_buffer.data() ) BA( loaded_buffer.size()*sizeof( W ));
+    jps::load_canonical( *loaded, stored );
+    assert( std::memcmp( loaded->data(), ballocator->data(), sizeof( stored )) == 0 );
+    assert( loaded->usage() == 77 && std::memcmp( stored, narrow_stored, sizeof( stored )) == 0 );
+    using HA = jps::serialized_bit_allocator<uint32_t>;
+    std::vector<uint32_t> halves_buffer( sizeof( HA )/sizeof( uint32_t ) - 1 + 8 );
+    auto* halves = new ( halves_buffer.data() ) HA( halves_buffer.size()*sizeof( uint32_t ));
+    assert( halves->size() == 256 );
+    jps::load_canonical( *halves, narrow_stored );
+    assert( halves->data()[0] == 0x1fc00000 && halves->data()[4] == 0xc0000000 );
+    using WA = jps::serialized_bit_allocator<jps::uint128_t>;
+    std::vector<jps::uint128_t> wide_buffer( sizeof( WA )/sizeof( jps::uint128_t ) - 1 + 2 );
+    auto* wide = new ( wide_buffer.data() ) WA( wide_buffer.size()*sizeof( jps::uint128_t ));
+    assert( wide->size() == 256 );
+    jps::load_canonical( *wide, stored );
+    assert( wide->usage() == 77 && wide->is_allocated( 60, 70 ) && wide->is_free( 130, 126 ));
+
+    // a bitmap in canonical order that is in place already is attached to without copying it
+    std::vector<W> attached_buffer( buffer.size() );
+    const auto offset = jps::bitmap_offset<BA>();
+    std::memcpy( reinterpret_cast<char*>( attached_buffer.data() ) + offset, stored, sizeof( stored ));
+    [[maybe_unused]] auto* attached =
+            jps::attach_canonical<BA>( attached_buffer.data(), attached_buffer.size()*sizeof( W ));
+    assert( reinterpret_cast<char*>( attached->data() ) == reinterpret_cast<char*>( attached_buffer.data() ) + offset );
+    assert( attached->size() == 256 && attached->usage() == 77 );
+    assert( std::memcmp( attached->data(), ballocator->data(), sizeof( stored )) == 0 );
+    // or converted in place for other word sizes
+    std::vector<uint8_t> attached_narrow_buffer( narrow_buffer.size() );
+    std::memcpy( attached_narrow_buffer.data() + jps::bitmap_offset<NA>(), stored, sizeof( stored ));
+    [[maybe_unused]] auto* attached_narrow =
+            jps::attach_canonical<NA>( attached_narrow_buffer.data(), attached_narrow_buffer.size() );
+    assert( std::memcmp( attached_narrow->data(), narrow->data(), sizeof( stored )) == 0 );
+
+    // the last integer is shortened to the bytes left, and restored into the most significant bits of a word
+    std::vector<uint8_t> short_buffer( sizeof( NA ) - 1 + 3 );
+    auto* short_narrow = new ( short_buffer.data() ) NA( short_buffer.size() );
+    assert( short_narrow->size() == 24 );
+    [[maybe_unused]] const auto short_reserved = short_narrow->reserve_range( 2, 18 );
+    assert( short_reserved );
+    uint8_t short_stored[3];
+    jps::store_canonical( *short_narrow, short_stored );
+    assert( short_stored[2] == 0b00111111 && short_stored[1] == 0xff && short_stored[0] == 0b11110000 );
+    std::stringstream ss;
+    jps::export_bitmap( ss, *short_narrow );
+    std::vector<W> restored_buffer( buffer.size() );
+    [[maybe_unused]] auto* restored =
+            jps::import_bitmap<BA>( ss, restored_buffer.data(), restored_buffer.size()*sizeof( W ));
+    assert( restored->data()[0] == 0x3ffff000'00000000ull && restored->usage() == 18 );
+}
+
+void sparse_tests() {
+    jps::sparse_bit_allocator<uint64_t> ballocator( size_t( 1 ) << 36 );
+    const auto bits_per_page = size_t( sysconf( _SC_PAGESIZE ))*8;
+    assert( ballocator.size() == size_t( 1 ) << 36 );
+    assert( ballocator.committed_pages() == 0 );
+
+    // allocations only commit the pages they touch
+    [[maybe_unused]] size_t q;
+    q = ballocator.alloc( 10 );
+    assert( q == 0 );
+    assert( ballocator.committed_pages() == 1 );
+    const auto p = ballocator.alloc( bits_per_page );
+    assert( p == 10 );
+    assert( ballocator.committed_pages() == 2 );
+    q = ballocator.alloc( 5 );
+    assert( q == 10+bits_per_page );
+    assert( ballocator.usage() == 15+bits_per_page );
+
+    // untouched pages are free without reading them
+    q = ballocator.alloc( 3*bits_per_page );
+    assert( q == 15+bits_per_page );
+    assert( ballocator.committed_pages() == 5 );
+
+    // freed ranges are reused, and their pages stay committed
+    ballocator.free( p, bits_per_page );
+    q = ballocator.alloc( 20 );
+    assert( q == p );
+    assert( ballocator.committed_pages() == 5 );
+    assert( ballocator.usage() == 35+3*bits_per_page );
+
+    // the range at the very end
+    q = ballocator.alloc( ballocator.size() );
+    assert( q == ballocator.size() );
+    q = ballocator.alloc( 0 );
+    assert( q == ballocator.size() );
+}
+
+void sparse_open_tests() {
+    const auto bits_per_page = size_t( sysconf( _SC_PAGESIZE ))*8;
+    const auto n_bits = 64*bits_per_page;
+    auto* file = std::tmpfile();
+    assert( file );
+
+    size_t p;
+    [[maybe_unused]] size_t q;
+    {
+        jps::sparse_bit_allocator<uint64_t> ballocator( fileno( file ), n_bits );
+        assert( ballocator.size() == n_bits );
+        // a new file is an empty bitmap, known only after the pages were looked at
+        assert( ballocator.validated_pages() == 0 );
+        p = ballocator.alloc( 10 );
+        assert( p == 0 );
+        assert( ballocator.validated_pages() == 1 );
+        q = ballocator.alloc( 2*bits_per_page );
+        assert( q == 10 );
+        ballocator.free( p, 10 );
+    }
+
+    // reopening serves allocations right away, and only validates the pages scanned
+    jps::sparse_bit_allocator<uint64_t> ballocator( fileno( file ), n_bits );
+    assert( ballocator.validated_pages() == 0 );
+    p = ballocator.alloc( 10 );
+    assert( p == 0 );
+    assert( ballocator.validated_pages() == 1 );
+    p = ballocator.alloc( 20 );
+    assert( p == q+2*bits_per_page );
+    assert( ballocator.validated_pages() == 3 );
+    assert( ballocator.usage() == 30+2*bits_per_page );
+
+    // the rest is validated in the background, or here, in steps
+    auto steps = 0ul;
+    while( ballocator.validate( 8 ))
+        ++steps;
+    assert( steps == 7 );
+    assert( ballocator.validated_pages() == 64 );
+    assert( ballocator.committed_pages() == 3 );
+    p = ballocator.alloc( 61*bits_per_page );
+    assert( p == q+2*bits_per_page+20 );
+    assert( ballocator.committed_pages() == 64 );
+
+    std::fclose( file );
+}
+
+template<template<typename> typename bit_allocator>
+void bulk_tests() {
+    using W = uint8_t;
+
+    bit_allocator_buffer<W, 32> buffer;
+    std::memset( &buffer, 0, sizeof( buffer ));
+    auto* ballocator = new ( &buffer ) jps::serialized_bit_allocator<W, bit_allocator>( sizeof( buffer ));
+
+    // reserve known ranges
+    [[maybe_unused]] bool reserved;
+    reserved = ballocator->reserve_range( 2, 3 );
+    assert( reserved );
+    assert( ballocator->data()[0] == 0b00111000 );
+    reserved = ballocator->reserve_range( 6, 20 );
+    assert( reserved );
+    assert( ballocator->data()[0] == 0b00111011 && ballocator->data()[1] == 0b11111111 && ballocator->data()[2] == 0b11111111 );
+    assert( ballocator->data()[3] == 0b11000000 );
+
+    // a reservation overlapping others fails without altering any bit
+    reserved = ballocator->reserve_range( 0, 3 );
+    assert( !reserved );
+    reserved = ballocator->reserve_range( 24, 10 );
+    assert( !reserved );
+    assert( ballocator->data()[0] == 0b00111011 && ballocator->data()[3] == 0b11000000 && ballocator->data()[4] == 0 );
+    reserved = ballocator->reserve_range( ballocator->size()-1, 2 );
+    assert( !reserved );
+    reserved = ballocator->reserve_range( 40, 0 );
+    assert( !reserved );
+    [[maybe_unused]] size_t p;
+    p = ballocator->alloc( 1 );
+    assert( p == 0 );
+
+    // release several allocations at once
+    ballocator->release_range( 0, 24 );
+    assert( ballocator->data()[0] == 0 && ballocator->data()[1] == 0 && ballocator->data()[2] == 0 && ballocator->data()[3] == 0b11000000 );
+
+    ballocator->fill();
+    assert( ballocator->usage() == ballocator->size() );
+    p = ballocator->alloc( 1 );
+    assert( p == ballocator->size() );
+    ballocator->reset();
+    assert( ballocator->usage() == 0 );
+    p = ballocator->alloc( 1 );
+    assert( p == 0 );
+}
+
+void parallel_fill_tests() {
+    using W = uint64_t;
+    using BA = jps::serialized_bit_allocator<W>;
+
+    // large enough for the non-temporal stores
+    std::vector<W> buffer(( jps::_non_temporal_threshold + 1000 )/sizeof( W ));
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+
+    for( const auto n_threads: { 1ul, 3ul, 7ul } ) {
+        ballocator->fill( n_threads );
+        assert( ballocator->usage() == ballocator->size() );
+        ballocator->reset( n_threads );
+        assert( ballocator->usage() == 0 );
+    }
+
+    // above the parallel threshold, the chunks go to the worker pool, which is reused by every call
+    ballocator->fill();
+    ballocator->release_range( ballocator->size()/3 - 500, 1000 );
+    for( auto i = 0; i < 100; ++i ) {
+        assert( ballocator->usage( 7 ) == ballocator->size() - 1000 );
+        assert( ballocator->largest_free_range( 7 ) == 1000 );
+    }
+}
+
+template<template<typename> class bit_allocator>
+void parallel_scan_tests() {
+    using W = uint64_t;
+    using BA = jps::serialized_bit_allocator<W, bit_allocator>;
+
+    const auto n_bits = 16384ul;
+    std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/64 );
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+    assert( ballocator->size() == n_bits );
+
+    // with 3 threads, the chunks are 88 words long and start at the bits 5632 and 11264
+    ballocator->fill();
+    ballocator->release_range( 100, 50 );
+    ballocator->release_range( 5600, 100 );       // crosses the first border
+    ballocator->release_range( 5000, 60 );
+    assert( ballocator->usage( 3 ) == ballocator->usage() );
+    assert( ballocator->largest_free_range( 3 ) == 100 );
+    assert( ballocator->find_unset_range( 80, 3 ) == 5600 );
+    assert( ballocator->find_unset_range( 55, 3 ) == 5000 );
+    assert( ballocator->find_unset_range( 101, 3 ) == ballocator->size() );
+
+    // a run over a complete chunk and both borders
+    ballocator->release_range( 5700, 6000 );
+    for( [[maybe_unused]] const auto n_threads: { 1ul, 2ul, 3ul, 7ul } ) {
+        assert( ballocator->usage( n_threads ) == ballocator->usage() );
+        assert( ballocator->largest_free_range( n_threads ) == ballocator->largest_free_range() );
+        assert( ballocator->find_unset_range( 6100, n_threads ) == 5600 );
+        assert( ballocator->find_unset_range( 10, n_threads ) == 100 );
+    }
+
+    [[maybe_unused]] size_t p;
+    p = ballocator->alloc_parallel( 6100, 3 );
+    assert( p == 5600 );
+    p = ballocator->alloc_parallel( 6100, 3 );
+    assert( p == ballocator->size() );
+    assert( ballocator->largest_free_range( 3 ) == 60 );
+
+    ballocator->reset();
+    assert( ballocator->largest_free_range( 3 ) == n_bits );
+    assert( ballocator->find_unset_range( n_bits, 3 ) == 0 );
+}
+
+template<typename W, template<typename> class bit_allocator>
+void placement_tests() {
+    const auto n_bits = 512ul;
+    [[maybe_unused]] size_t p;
+
+    {
+        using BA = jps::serialized_bit_allocator<W, bit_allocator, false, jps::no_recorder, jps::top_down>;
+        std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/( 8*sizeof( W )));
+        auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+        assert( ballocator->size() == n_bits );
+
+        p = ballocator->alloc( 10 );
+        assert( p == 502 );
+        p = ballocator->alloc( 10 );
+        assert( p == 492 );
+        ballocator->free( 502, 10 );
+        p = ballocator->alloc( 5 );
+        assert( p == 507 );
+        p = ballocator->template alloc<jps::first_fit>( 5 );
+        assert( p == 0 );
+
+        // a free range over several words
+        ballocator->fill();
+        ballocator->release_range( 70, 30 );
+        p = ballocator->alloc( 20 );
+        assert( p == 80 );
+        p = ballocator->alloc( 10 );
+        assert( p == 70 );
+        p = ballocator->alloc( 1 );
+        assert( p == ballocator->size() );
+        [[maybe_unused]] const auto r = ballocator->try_alloc( 1, 1 );
+        assert( r.status == jps::alloc_status::full );
+    }
+
+    {
+        using BA = jps::serialized_bit_allocator<W, bit_allocator>;
+        std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/( 8*sizeof( W )));
+        auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+
+        // long-lived allocations at the top, churn at the bottom
+        p = ballocator->template alloc<jps::top_down>( 8 );
+        assert( p == 504 );
+        p = ballocator->alloc( 8 );
+        assert( p == 0 );
+        p = ballocator->template alloc<jps::best_fit>( 8 );
+        assert( p == 8 );
+    }
+
+    {
+        using BA = jps::serialized_bit_allocator<W, bit_allocator, false, jps::no_recorder, jps::next_fit>;
+        std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/( 8*sizeof( W )));
+        auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+        assert( ballocator->size() == n_bits );
+
+        p = ballocator->alloc( 10 );
+        assert( p == 0 );
+        p = ballocator->alloc( 10 );
+        assert( p == 10 );
+        ballocator->free( 0, 10 );
+        p = ballocator->alloc( 10 );
+        assert( p == 20 );
+        p = ballocator->alloc( 480 );
+        assert( p == 30 );
+
+        // wraps around
+        p = ballocator->alloc( 10 );
+        assert( p == 0 );
+        p = ballocator->alloc( 1 );
+        assert( p == 510 );
+        p = ballocator->alloc( 2 );
+        assert( p == ballocator->size() );
+    }
+
+    {
+        using BA = jps::serialized_bit_allocator<W, bit_allocator, false, jps::no_recorder, jps::best_fit>;
+        std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/( 8*sizeof( W )));
+        auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+        assert( ballocator->size() == n_bits );
+
+        ballocator->fill();
+        ballocator->release_range( 0, 20 );
+        ballocator->release_range( 100, 12 );
+        ballocator->release_range( 200, 10 );
+        p = ballocator->alloc( 10 );
+        assert( p == 200 );
+        p = ballocator->alloc( 10 );
+        assert( p == 100 );
+        p = ballocator->alloc( 10 );
+        assert( p == 0 );
+        p = ballocator->alloc( 11 );
+        assert( p == ballocator->size() );
+    }
+}
+
+template<template<typename> class bit_allocator>
+void alloc_near_tests() {
+    using W = uint64_t;
+    using BA = jps::serialized_bit_allocator<W, bit_allocator>;
+
+    const auto n_bits = 512ul;
+    std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/64 );
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+
+    ballocator->fill();
+    ballocator->release_range( 10, 8 );
+    ballocator->release_range( 100, 8 );
+    ballocator->release_range( 300, 8 );
+
+    // the closest range in either direction
+    [[maybe_unused]] size_t p;
+    p = ballocator->alloc_near( 90, 8 );
+    assert( p == 100 );
+    p = ballocator->alloc_near( 90, 8 );
+    assert( p == 10 );
+    p = ballocator->alloc_near( 290, 8, 5 );
+    assert( p == ballocator->size() );
+    p = ballocator->alloc_near( 320, 8, 20 );
+    assert( p == 300 );
+    p = ballocator->alloc_near( 320, 1 );
+    assert( p == ballocator->size() );
+
+    // ranges overlapping the hint, and hints beyond the end
+    ballocator->release_range( 200, 20 );
+    p = ballocator->alloc_near( 210, 4 );
+    assert( p == 210 );
+    p = ballocator->alloc_near( 209, 4 );
+    assert( p == 206 );
+    ballocator->release_range( 505, 7 );
+    p = ballocator->alloc_near( 1000, 4 );
+    assert( p == 508 );
+    p = ballocator->alloc_near( 1000, 3 );
+    assert( p == 505 );
+
+    // ranges starting right past the first ring, which ends 64 bits from the hint
+    ballocator->release_range( 165, 8 );
+    ballocator->release_range( 34, 8 );
+    p = ballocator->alloc_near( 100, 8 );
+    assert( p == 165 );
+    p = ballocator->alloc_near( 100, 8 );
+    assert( p == 34 );
+    p = ballocator->alloc_near( 100, 8 );
+    assert( p == ballocator->size() );
+}
+
+template<template<typename> class bit_allocator>
+void extend_tests() {
+    using W = uint8_t;
+    using BA = jps::serialized_bit_allocator<W, bit_allocator>;
+
+    const auto n_bits = 64ul;
+    std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/8 );
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+    assert( ballocator->size() == n_bits );
+
+    [[maybe_unused]] bool extended;
+    const auto p1 = ballocator->alloc( 3 );
+    extended = ballocator->try_extend( p1, 3, 3 );
+    assert( extended );
+    extended = ballocator->try_extend( p1, 3, 20 );     // over several words
+    assert( extended );
+    assert( ballocator->usage() == 20 );
+
+    const auto p2 = ballocator->alloc( 4 );
+    assert( p2 == p1+20 );
+    extended = ballocator->try_extend( p1, 20, 21 );
+    assert( !extended );
+    assert( ballocator->usage() == 24 );
+    extended = ballocator->try_extend( p2, 4, n_bits );
+    assert( !extended );
+    assert( ballocator->usage() == 24 );
+
+    ballocator->shrink( p1, 20, 5 );
+    assert( ballocator->usage() == 9 );
+    [[maybe_unused]] const auto p3 = ballocator->alloc( 15 );
+    assert( p3 == p1+5 );
+    ballocator->shrink( p2, 4, 4 );
+    ballocator->shrink( p2, 4, 0 );
+    assert( ballocator->usage() == 20 );
+    extended = ballocator->try_extend( p1+5, 15, n_bits-5 );
+    assert( extended );
+    assert( ballocator->usage() == n_bits );
+}
+
+template<template<typename> class bit_allocator>
+void track_lengths_tests() {
+    using W = uint64_t;
+    using BA = jps::serialized_bit_allocator<W, bit_allocator, false, jps::no_recorder, jps::first_fit, true>;
+
+    // the companion bitmap takes the same number of words
+    const auto n_bits = 256ul;
+    std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + 2*n_bits/64 );
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+    assert( ballocator->size() == n_bits );
+
+    const auto p1 = ballocator->alloc( 3 );
+    const auto p2 = ballocator->alloc( 70 );
+    const auto p3 = ballocator->alloc( 1 );
+    assert( ballocator->size_of( p1 ) == 3 );
+    assert( ballocator->size_of( p2 ) == 70 );
+    assert( ballocator->size_of( p3 ) == 1 );
+
+    ballocator->free( p2 );
+    assert( ballocator->usage() == 4 );
+    [[maybe_unused]] const auto q = ballocator->alloc( 70 );
+    assert( q == p2 );
+    assert( ballocator->size_of( p2 ) == 70 );
+
+    // resizing moves the end
+    [[maybe_unused]] const auto extended = ballocator->try_extend( p3, 1, 5 );
+    assert( extended );
+    assert( ballocator->size_of( p3 ) == 5 );
+    ballocator->shrink( p3, 5, 2 );
+    assert( ballocator->size_of( p3 ) == 2 );
+    ballocator->free( p3 );
+    assert( ballocator->size_of( p3 ) == 0 );
+
+    // all allocation paths mark the end
+    [[maybe_unused]] const auto reserved = ballocator->reserve_range( 200, 10 );
+    assert( reserved );
+    assert( ballocator->size_of( 200 ) == 10 );
+    const auto p4 = ballocator->alloc_near( 150, 7 );
+    assert( ballocator->size_of( p4 ) == 7 );
+    const auto p5 = ballocator->try_alloc( 9, 1 ).pos;
+    assert( ballocator->size_of( p5 ) == 9 );
+    for( const auto p: { p1, p2, p4, p5, 200ul } )
+        ballocator->free( p );
+    assert( ballocator->usage() == 0 );
+
+    ballocator->fill();
+    assert( ballocator->size_of( 0 ) == n_bits );
+    ballocator->free( 0 );
+    assert( ballocator->usage() == 0 );
+    ballocator->reset();
+    assert( ballocator->size_of( 0 ) == 0 );
+}
+
+template<typename W, template<typename> typename bit_allocator>
+void range_query_tests() {
+    using BA = jps::serialized_bit_allocator<W, bit_allocator>;
+
+    const auto n_bits = 256ul;
+    std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/( 8*sizeof( W )));
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+    assert( ballocator->size() == n_bits );
+
+    [[maybe_unused]] const auto p = ballocator->alloc( 3 );
+    assert( p == 0 );
+    [[maybe_unused]] bool reserved;
+    reserved = ballocator->reserve_range( 5, 2 );
+    assert( reserved );
+    reserved = ballocator->reserve_range( 60, 130 );
+    assert( reserved );
+    reserved = ballocator->reserve_range( 255, 1 );
+    assert( reserved );
+
+    // within a word
+    assert( ballocator->count_in_range( 0, 8 ) == 5 );
+    assert( ballocator->count_in_range( 2, 4 ) == 2 );
+    assert( ballocator->is_free( 3, 2 ) && !ballocator->is_free( 3, 3 ));
+    assert( ballocator->is_allocated( 0, 3 ) && !ballocator->is_allocated( 0, 4 ));
+
+    // over many words
+    assert( ballocator->count_in_range( 0, n_bits ) == ballocator->usage() );
+    assert( ballocator->count_in_range( 50, 150 ) == 130 );
+    assert( ballocator->count_in_range( 61, 128 ) == 128 );
+    assert( ballocator->is_allocated( 60, 130 ) && !ballocator->is_allocated( 59, 130 ));
+    assert( !ballocator->is_allocated( 60, 131 ));
+    assert( ballocator->is_free( 7, 53 ) && !ballocator->is_free( 7, 54 ));
+    assert( ballocator->is_free( 190, 65 ) && !ballocator->is_free( 190, 66 ));
+
+    // empty ranges
+    assert( ballocator->count_in_range( 100, 0 ) == 0 );
+    assert( ballocator->is_free( 100, 0 ) && ballocator->is_allocated( 10, 0 ));
+    assert( ballocator->count_in_range( 255, 1, std::memory_order::acquire ) == 1 );
+
+    // ranges beyond the bitmap
+    assert( ballocator->count_in_range( 250, 100 ) == 1 && ballocator->count_in_range( 300, 10 ) == 0 );
+    assert( ballocator->count_in_range( 1, ~size_t( 0 )) == ballocator->usage()-1 );
+    assert( !ballocator->is_allocated( 255, 2 ) && !ballocator->is_free( 250, 10 ));
+    assert( !ballocator->is_free( 256, 1 ) && !ballocator->is_free( ~size_t( 0 ), 2 ));
+}
+
+void wide_word_tests() {
+    using W = jps::uint128_t;
+    using BA = jps::serialized_bit_allocator<W>;
+    static_assert( sizeof( jps::_reentrant_lock_free_bit_allocator<W> ) == 16 );
+
+    // the halves of the bit counting
+    static_assert( jps::_countl_zero( W( 1 )) == 127 && jps::_countl_zero( W( 1 ) << 64 ) == 63 );
+    static_assert( jps::_countr_zero( W( 1 ) << 100 ) == 100 && jps::_countr_zero( W( 0 )) == 128 );
+    static_assert( jps::_countl_one( W( ~W( 0 )) << 1 ) == 127 && jps::_countr_one( W( ~W( 0 )) >> 60 ) == 68 );
+    static_assert( jps::_popcount( W( ~W( 0 ))) == 128 && jps::_popcount( W( 3 ) << 63 ) == 2 );
+
+    const auto n_bits = 512ul;
+    std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/128 );
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+    assert( ballocator->size() == n_bits );
+
+    // up to 128 bits are a single word
+    [[maybe_unused]] size_t p;
+    p = ballocator->alloc( 100 );
+    assert( p == 0 );
+    p = ballocator->alloc( 28 );
+    assert( p == 100 );
+    p = ballocator->alloc( 128 );
+    assert( p == 128 );
+    p = ballocator->alloc( 1 );
+    assert( p == 256 );
+    assert( ballocator->data()[0] == W( ~W( 0 )) && ballocator->data()[1] == W( ~W( 0 )));
+    assert( ballocator->data()[2] == W( 1 ) << 127 );
+
+    // and more span words
+    p = ballocator->alloc( 200 );
+    assert( p == 257 );
+    assert( ballocator->usage() == 457 );
+    p = ballocator->alloc( 100 );
+    assert( p == ballocator->size() );
+    ballocator->free( 100, 28 );
+    ballocator->free( 257, 200 );
+    assert( ballocator->count_in_range( 0, 256 ) == 228 );
+    assert( ballocator->is_free( 100, 28 ) && ballocator->is_allocated( 128, 129 ));
+
+    assert( ballocator->largest_free_range() == n_bits-257 );
+    p = ballocator->alloc<jps::top_down>( 60 );
+    assert( p == n_bits-60 );
+    p = ballocator->alloc_near( 90, 8 );
+    assert( p == 100 );
+
+    std::vector<W> copy( n_bits/128 );
+    ballocator->snapshot( copy.data() );
+    assert( copy[0] == W( ~W( 0 )) << 20 && copy[1] == W( ~W( 0 )));
+    assert( copy[3] == W( ~W( 0 )) >> 68 );
+    ballocator->reset();
+    assert( ballocator->usage() == 0 );
+}
+
+template<template<typename> typename bit_allocator>
+void owner_tags_tests() {
+    using W = uint64_t;
+    using BA = jps::serialized_bit_allocator<W, bit_allocator, false, jps::no_recorder, jps::first_fit, false,
+                                             uint8_t>;
+
+    const auto n_bits = 256ul;
+    std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/64 + n_bits/sizeof( W ));
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+    assert( ballocator->size() == n_bits );
+
+    [[maybe_unused]] size_t p;
+    p = ballocator->alloc_for( 1, 10 );
+    assert( p == 0 );
+    p = ballocator->alloc_for( 2, 100 );
+    assert( p == 10 );
+    p = ballocator->alloc_for( 1, 70 );
+    assert( p == 110 );
+    p = ballocator->alloc( 6 );
+    assert( p == 180 );
+    p = ballocator->alloc_for( 1, 4 );
+    assert( p == 186 );
+    assert( ballocator->owner_of( 0 ) == 1 && ballocator->owner_of( 109 ) == 2 && ballocator->owner_of( 179 ) == 1 );
+    assert( ballocator->owner_of( 180 ) == 0 && ballocator->owner_of( 190 ) == 0 );
+
+    // freed bits lose their owner, extensions get it
+    ballocator->shrink( 10, 100, 50 );
+    assert( ballocator->owner_of( 59 ) == 2 && ballocator->owner_of( 60 ) == 0 );
+    [[maybe_unused]] const auto extended = ballocator->try_extend( 186, 4, 8 );
+    assert( extended );
+    assert( ballocator->owner_of( 193 ) == 1 );
+
+    [[maybe_unused]] size_t released;
+    released = ballocator->release_all( 1 );
+    assert( released == 10+70+8 );
+    assert( ballocator->usage() == 50+6 );
+    assert( ballocator->owner_of( 0 ) == 0 && ballocator->owner_of( 110 ) == 0 );
+    released = ballocator->release_all( 1 );
+    assert( released == 0 );
+
+    p = ballocator->alloc_for( 3, 10 );
+    assert( p == 0 );
+    released = ballocator->release_all( 2 );
+    assert( released == 50 );
+    released = ballocator->release_all( 3 );
+    assert( released == 10 );
+    ballocator->free( 180, 6 );
+    assert( ballocator->usage() == 0 );
+
+    // owners alternating within a word, and a range of an owner over word borders
+    for( auto i = 0u; i < 20; ++i ) {
+        p = ballocator->alloc_for( uint8_t( 1 + i%2 ), 3 );
+        assert( p == 3*i );
+    }
+    p = ballocator->alloc_for( 1, 80 );
+    assert( p == 60 );
+    released = ballocator->release_all( 1 );
+    assert( released == 30+80 );
+    assert( ballocator->usage() == 30 && ballocator->owner_of( 3 ) == 2 && ballocator->is_allocated( 57, 3 ));
+    assert( !ballocator->is_allocated( 60, 1 ) && ballocator->owner_of( 60 ) == 0 );
+    released = ballocator->release_all( 2 );
+    assert( released == 30 );
+    assert( ballocator->usage() == 0 );
+
+    // tags go with the companion bitmap of track_lengths
+    using TBA = jps::serialized_bit_allocator<W, bit_allocator, false, jps::no_recorder, jps::first_fit, true,
+                                              uint16_t>;
+    std::vector<W> tbuffer( sizeof( TBA )/sizeof( W ) - 1 + 2*n_bits/64 + n_bits*2/sizeof( W ));
+    auto* tallocator = new ( tbuffer.data() ) TBA( tbuffer.size()*sizeof( W ));
+    assert( tallocator->size() == n_bits );
+
+    p = tallocator->alloc_for( 1000, 20 );
+    assert( p == 0 );
+    p = tallocator->alloc_for( 2000, 30 );
+    assert( p == 20 );
+    p = tallocator->alloc_for( 1000, 40 );
+    assert( p == 50 );
+    assert( tallocator->size_of( 20 ) == 30 && tallocator->owner_of( 89 ) == 1000 );
+    tallocator->free( 20 );
+    released = tallocator->release_all( 1000 );
+    assert( released == 60 );
+    assert( tallocator->usage() == 0 );
+    tallocator->fill();
+    released = tallocator->release_all( 1000 );
+    assert( tallocator->owner_of( 0 ) == 0 && released == 0 );
+}
+
+/**
+ * The tags of a word are compared in blocks of 8 bytes, with 8, 4, 2 or a single tag in each.
+ */
+template<typename W, typename owner_type>
+void owner_lanes_tests() {
+    using BA = jps::serialized_bit_allocator<W, jps::_reentrant_lock_free_bit_allocator, false, jps::no_recorder,
+                                             jps::first_fit, false, owner_type>;
+
+    const auto n_bits = 256ul;
+    std::vector<uint64_t> buffer(( sizeof( BA ) + n_bits/8 + n_bits*sizeof( owner_type ))/sizeof( uint64_t ));
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( uint64_t ));
+    assert( ballocator->size() == n_bits );
+
+    // owners differing in all bits of their tags, and in the lowest one only
+    const owner_type owners[3] = { 1, owner_type( ~owner_type( 0 )), owner_type( ~owner_type( 0 ) - 1 ) };
+    [[maybe_unused]] size_t tagged[3] = { 0, 0, 0 };
+    [[maybe_unused]] size_t p;
+    for( auto i = 0u; i < 60; ++i ) {
+        p = ballocator->alloc_for( owners[i%3], i%5 + 1 );
+        assert( p != ballocator->size() );
+        tagged[i%3] += i%5 + 1;
+    }
+    for( auto i = 0u; i < 3; ++i ) {
+        [[maybe_unused]] const auto released = ballocator->release_all( owners[i] );
+        assert( released == tagged[i] );
+    }
+    assert( ballocator->usage() == 0 );
+}
+
+void defragment_tests() {
+    using W = uint64_t;
+    using BA = jps::serialized_bit_allocator<W>;
+
+    const auto n_bits = 1024ul;
+    std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/64 );
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+    assert( ballocator->size() == n_bits );
+
+    // half of the bits are free, but no run is longer than 8 bits
+    [[maybe_unused]] size_t q;
+    for( auto p = 0ul; p < n_bits; p += 8 ) {
+        q = ballocator->alloc( 8 );
+        assert( q == p );
+    }
+    for( auto p = 0ul; p < n_bits; p += 16 )
+        ballocator->free( p, 8 );
+    q = ballocator->alloc( 128 );
+    assert( q == ballocator->size() );
+
+    // more than the free bits cannot be made free
+    [[maybe_unused]] bool done;
+    done = jps::defragmenter<BA>( *ballocator, 640 ).run();
+    assert( !done );
+
+    // step by step, the last of the equally used windows is chosen
+    jps::defragmenter<BA> defrag( *ballocator, 128 );
+    auto steps = 0ul;
+    while( defrag.step( 4 ))
+        ++steps;
+    assert( steps > n_bits/64/4 );
+    assert( defrag.state() == jps::defragmenter<BA>::phase::done );
+    assert( defrag.window() == n_bits-128 );
+    assert( defrag.plan().size() == 8 && defrag.cost() == 64 );
+
+    // a destination taken in the meantime fails the move
+    const auto& plan = defrag.plan();
+    [[maybe_unused]] const auto reserved = ballocator->reserve_range( plan[0].new_pos, 1 );
+    assert( reserved );
+    [[maybe_unused]] bool begun;
+    begun = defrag.begin( plan[0] );
+    assert( !begun );
+    ballocator->free( plan[0].new_pos, 1 );
+
+    for( const auto& m: plan ) {
+        assert( m.len == 8 && ( m.new_pos < defrag.window() ));
+        begun = defrag.begin( m );
+        assert( begun );
+        defrag.commit( m );
+    }
+    assert( ballocator->usage() == n_bits/2 );
+    q = ballocator->alloc( 128 );
+    assert( q == n_bits-128 );
+
+    // runs crossing the edges of the window count in full, and move as a whole
+    ballocator->fill();
+    for( const auto& [p, n]: { std::pair{ 0ul, 60ul }, { 130ul, 120ul }, { 262ul, 38ul }, { 310ul, 110ul }} )
+        ballocator->free( p, n );
+    jps::defragmenter<BA> crossing( *ballocator, 128 );
+    done = crossing.run();
+    assert( done );
+    assert( crossing.window() == 256 && crossing.cost() == 22 );
+    assert( crossing.plan().size() == 2 );
+    assert( crossing.plan()[0].old_pos == 250 && crossing.plan()[0].new_pos == 0 && crossing.plan()[0].len == 12 );
+    assert( crossing.plan()[1].old_pos == 300 && crossing.plan()[1].new_pos == 12 && crossing.plan()[1].len == 10 );
+
+    // moved allocations keep their owners, also within a run of several of them
+    using TBA = jps::serialized_bit_allocator<W, jps::_reentrant_lock_free_bit_allocator, false, jps::no_recorder,
+                                              jps::first_fit, false, uint8_t>;
+    std::vector<W> tbuffer( sizeof( TBA )/sizeof( W ) - 1 + n_bits/64 + n_bits/sizeof( W ));
+    auto* tallocator = new ( tbuffer.data() ) TBA( tbuffer.size()*sizeof( W ));
+    assert( tallocator->size() == n_bits );
+    for( auto p = 0ul; p < n_bits; p += 16 ) {
+        q = tallocator->alloc_for( 1, 4 );
+        assert( q == p );
+        q = tallocator->alloc_for( 2, 4 );
+        assert( q == p+4 );
+        q = tallocator->alloc( 8 );
+        assert( q == p+8 );
+    }
+    for( auto p = 0ul; p < n_bits; p += 16 )
+        tallocator->free( p+8, 8 );
+    jps::defragmenter<TBA> tagged( *tallocator, 128 );
+    done = tagged.run();
+    assert( done && tagged.window() == n_bits-128 );
+    for( const auto& m: tagged.plan() ) {
+        begun = tagged.begin( m );
+        assert( m.len == 8 && begun );
+        assert( tallocator->owner_of( m.new_pos ) == 1 && tallocator->owner_of( m.new_pos+7 ) == 2 );
+        tagged.commit( m );
+        assert( tallocator->owner_of( m.old_pos ) == 0 );
+    }
+    // the window joins the free bits before it
+    q = tallocator->alloc( 136 );
+    assert( q == n_bits-136 );
+    // and both owners of each moved run find their bits at the new positions
+    [[maybe_unused]] size_t released;
+    released = tallocator->release_all( 1 );
+    assert( released == n_bits/4 );
+    released = tallocator->release_all( 2 );
+    assert( released == n_bits/4 );
+    assert( tallocator->usage() == 136 );
+
+    // a destination far away is searched for over several steps, a word at a time
+    const auto far_bits = 4096ul;
+    std::vector<W> far_buffer( sizeof( BA )/sizeof( W ) - 1 + far_bits/64 );
+    auto* far = new ( far_buffer.data() ) BA( far_buffer.size()*sizeof( W ));
+    far->fill();
+    far->free( 0, 20 );
+    far->free( 30, 34 );
+    far->free( 4000, 10 );
+    jps::defragmenter<BA> bounded( *far, 64 );
+    while( bounded.state() != jps::defragmenter<BA>::phase::plan )
+        bounded.step( 1 );
+    auto plan_steps = 0ul;
+    while( bounded.step( 1 ))
+        ++plan_steps;
+    assert( bounded.state() == jps::defragmenter<BA>::phase::done && bounded.window() == 0 );
+    assert( bounded.plan().size() == 1 && bounded.plan()[0].new_pos == 4000 && bounded.plan()[0].len == 10 );
+    assert( plan_steps >= 4000/64 - 1 );
+}
+
+template<typename BA>
+concept can_co_alloc = requires( BA& ba ) { ba.co_alloc( size_t( 1 ), []( std::coroutine_handle<> ) {} ); };
+
+void shared_tests() {
+    using BA = jps::serialized_bit_allocator<uint64_t, jps::_single_threaded_bit_allocator>;
+    static_assert( !can_co_alloc<BA> && can_co_alloc<waiting_bit_allocator<uint64_t>> &&
+                   !can_co_alloc<jps::process_shared<waiting_bit_allocator<uint64_t>>> );
+    static_assert( !BA::is_process_local &&
+                   jps::serialized_bit_allocator<uint64_t, jps::_flat_combining_bit_allocator>::is_process_local );
+    const auto name = "/jps_test_st_" + std::to_string( getpid() );
+
+    auto created = jps::shared_bit_allocator<BA>::create( name, 1024 );
+    assert( created->size() == ( 1024-sizeof( BA )+sizeof( uint64_t ))*8 );
+    [[maybe_unused]] size_t p;
+    p = created->alloc( 10 );
+    assert( p == 0 );
+
+    // a second mapping sees the same bitmap, and locks the same mutex
+    auto attached = jps::shared_bit_allocator<BA>::attach( name );
+    assert( attached.get() != created.get() );
+    assert( attached->size() == created->size() );
+    p = attached->alloc( 5 );
+    assert( p == 10 );
+    assert( created->usage() == 15 );
+    attached->free( 0, 15 );
+    assert( created->usage() == 0 );
+
+    // segments of another allocator type, or none, are rejected
+    [[maybe_unused]] auto rejected = false;
+    try {
+        (void) jps::shared_bit_allocator<jps::serialized_bit_allocator<uint8_t>>::attach( name );
+    }
+    catch( const std::runtime_error& ) {
+        rejected = true;
+    }
+    assert( rejected );
+
+    rejected = false;
+    try {
+        (void) jps::shared_bit_allocator<BA>::create( name, 1024 );
+    }
+    catch( const std::system_error& ) {
+        rejected = true;
+    }
+    assert( rejected );
+
+    jps::shared_bit_allocator<BA>::unlink( name );
+    rejected = false;
+    try {
+        (void) jps::shared_bit_allocator<BA>::attach( name );
+    }
+    catch( const std::system_error& ) {
+        rejected = true;
+    }
+    assert( rejected );
+}
+
+void adaptive_tests() {
+    using W = uint8_t;
+    using BA = jps::serialized_bit_allocator<W, jps::_adaptive_bit_allocator>;
+
+    // rollbacks switch to the serialized mode, and an uncontended lock switches back
+    jps::_adaptive_guard guard;
+    for( auto i = 0u; i < jps::_adaptive_guard::window; ++i )
+        guard.count( i % 4 == 0 );
+    assert( guard.serialized() );
+    for( auto i = 0u; i < jps::_adaptive_guard::window; ++i )
+        guard.count( i % 64 == 0 );
+    assert( !guard.serialized() );
+    [[maybe_unused]] const auto locked = guard.lock();
+    assert( !locked );
+    guard.unlock();
+
+    // allocations are the same in both modes
+    const auto n_bits = 64ul;
+    [[maybe_unused]] size_t p;
+    [[maybe_unused]] bool claimed;
+    for( const auto serialized: { false, true } ) {
+        guard.serialized_ = serialized;
+        jps::_adaptive_bit_allocator<W> words[n_bits/8];
+        for( auto& w: words )
+            w = 0;
+
+        const auto mo = std::memory_order::acquire;
+        p = words[0].alloc( 3, 0, n_bits, mo, &guard );
+        assert( p == 0 );
+        p = words[0].alloc( 20, 0, n_bits, mo, &guard );
+        assert( p == 3 );
+        p = words[0].alloc( 41, 0, n_bits, mo, &guard );
+        assert( p == 23 );
+        p = words[0].alloc( 1, 0, n_bits, mo, &guard );
+        assert( p == n_bits );
+        words[0].free( 3, 20, std::memory_order::release, &guard );
+        p = words[0].try_alloc( 12, 1, 0, n_bits, mo, &guard ).pos;
+        assert( p == 3 );
+        claimed = words[0].claim_range( 15, 8, mo, &guard );
+        assert( claimed );
+        claimed = words[0].claim_range( 14, 2, mo, &guard );
+        assert( !claimed );
+        assert( guard.serialized() == serialized );
+    }
+
+    std::vector<W> buffer( sizeof( BA )/sizeof( W ) - 1 + n_bits/8 );
+    auto* ballocator = new ( buffer.data() ) BA( buffer.size()*sizeof( W ));
+    assert( ballocator->size() == n_bits );
+    p = ballocator->alloc( 20 );
+    assert( p == 0 );
+    p = ballocator->alloc( 50 );
+    assert( p == ballocator->size() );
+    ballocator->free( 0, 20 );
+    assert( ballocator->usage() == 0 );
+}
+
+struct trace_test_tag {};
+
+void trace_tests() {
+    using W = uint8_t;
+    using recorder = jps::trace_recorder<16, trace_test_tag>;
+
+    bit_allocator_buffer<W, 32> buffer;
+    std::memset( &buffer, 0, sizeof( buffer ));
+    auto* ballocator = new ( &buffer )
+            jps::serialized_bit_allocator<W, jps::_reentrant_lock_free_bit_allocator, false, recorder>( sizeof( buffer ));
+
+    const auto p1 = ballocator->alloc( 3 );
+    [[maybe_unused]] const auto p2 = ballocator->alloc( 9 );
+    ballocator->free( p1, 3 );
+    [[maybe_unused]] const auto p3 = ballocator->alloc( 1000 );
+    assert( p3 == ballocator->size() );
+
+    // the failed allocation is not recorded
+    const auto records = recorder::collect();
+    assert( records.size() == 3 );
+    assert( records[0].op == jps::trace_op::alloc && records[0].pos == p1 && records[0].len == 3 );
+    assert( records[1].op == jps::trace_op::alloc && records[1].pos == p2 && records[1].len == 9 );
+    assert( records[2].op == jps::trace_op::free && records[2].pos == p1 && records[2].len == 3 );
+    assert( records[0].timestamp <= records[1].timestamp && records[1].timestamp <= records[2].timestamp );
+
+    // the binary format reads back what was written
+    std::stringstream ss;
+    recorder::write( ss );
+    const auto read = jps::read_trace( ss );
+    assert( read.size() == records.size() );
+    assert( std::memcmp( read.data(), records.data(), records.size()*sizeof( jps::trace_record )) == 0 );
+
+    assert( ballocator->largest_free_range() == ballocator->size() - 12 );
+
+    // a length beyond 32 bits is saturated and flagged
+    recorder::clear();
+    recorder::record( jps::trace_op::free, 0, size_t( 1 ) << 40 );
+    recorder::record( jps::trace_op::free, 0, 7 );
+    const auto long_records = recorder::collect();
+    assert( long_records.size() == 2 );
+    assert( long_records[0].len == UINT32_MAX && long_records[0].flags == jps::trace_len_saturated );
+    assert( long_records[1].len == 7 && long_records[1].flags == 0 );
+
+    // the rings of exited threads are taken over by new threads with their thread index, and keep their records
+    // until then
+    recorder::clear();
+    std::thread( []() { recorder::record( jps::trace_op::alloc, 1, 1 ); } ).join();
+    std::thread( []() {
+        assert( recorder::collect().size() == 1 );
+        recorder::record( jps::trace_op::alloc, 2, 1 );
+    } ).join();
+    const auto reused = recorder::collect();
+    assert( reused.size() == 2 );
+    assert( reused[0].thread == reused[1].thread && reused[0].pos == 1 && reused[1].pos == 2 );
+    assert( recorder::n_rings() == 2 );
+}
+
+
 int main( [[maybe_unused]] int argc, [[maybe_unused]] char* argv[] ) {
     {
         loop_bufferlen_tests<uint8_t, 8>();
@@ -421,5 +1813,127 @@ int main( [[maybe_unused]] int argc, [[maybe_unused]] char* argv[] ) {
         simple_tests_uint64<32>();
     }
 
+    {
+        range_end_tests_uint8<32>();
+        scan_end_tests<uint8_t, jps::_reentrant_lock_free_bit_allocator>();
+        scan_end_tests<uint8_t, jps::_single_threaded_bit_allocator>();
+        scan_end_tests<uint64_t, jps::_reentrant_lock_free_bit_allocator>();
+        scan_end_tests<uint64_t, jps::_single_threaded_bit_allocator>();
+        full_word_scan_tests<uint8_t, jps::_reentrant_lock_free_bit_allocator>();
+        full_word_scan_tests<uint8_t, jps::_single_threaded_bit_allocator>();
+        full_word_scan_tests<uint16_t, jps::_reentrant_lock_free_bit_allocator>();
+        full_word_scan_tests<uint16_t, jps::_single_threaded_bit_allocator>();
+    }
+
+    {
+        trace_tests();
+    }
+
+    {
+        try_alloc_tests<jps::_reentrant_lock_free_bit_allocator>();
+        try_alloc_tests<jps::_single_threaded_bit_allocator>();
+    }
+
+    {
+        alloc_wait_tests<jps::_reentrant_lock_free_bit_allocator>();
+        alloc_wait_tests<jps::_single_threaded_bit_allocator>();
+    }
+
+    {
+        alloc_drain_tests<jps::_reentrant_lock_free_bit_allocator>();
+        alloc_drain_tests<jps::_single_threaded_bit_allocator>();
+        alloc_drain_tests<jps::_flat_combining_bit_allocator>();
+    }
+
+    {
+        co_alloc_tests();
+    }
+
+    {
+        snapshot_tests<jps::_reentrant_lock_free_bit_allocator>();
+        snapshot_tests<jps::_single_threaded_bit_allocator>();
+    }
+
+    {
+        compress_tests();
+        canonical_tests();
+    }
+
+    {
+        sparse_tests();
+        sparse_open_tests();
+    }
+
+    {
+        bulk_tests<jps::_reentrant_lock_free_bit_allocator>();
+        bulk_tests<jps::_single_threaded_bit_allocator>();
+        parallel_fill_tests();
+    }
+
+    {
+        parallel_scan_tests<jps::_reentrant_lock_free_bit_allocator>();
+        parallel_scan_tests<jps::_single_threaded_bit_allocator>();
+        parallel_scan_tests<jps::_flat_combining_bit_allocator>();
+    }
+
+    {
+        placement_tests<uint8_t, jps::_reentrant_lock_free_bit_allocator>();
+        placement_tests<uint64_t, jps::_reentrant_lock_free_bit_allocator>();
+        placement_tests<uint64_t, jps::_single_threaded_bit_allocator>();
+        placement_tests<uint64_t, jps::_flat_combining_bit_allocator>();
+    }
+
+    {
+        alloc_near_tests<jps::_reentrant_lock_free_bit_allocator>();
+        alloc_near_tests<jps::_single_threaded_bit_allocator>();
+        alloc_near_tests<jps::_flat_combining_bit_allocator>();
+    }
+
+    {
+        extend_tests<jps::_reentrant_lock_free_bit_allocator>();
+        extend_tests<jps::_single_threaded_bit_allocator>();
+        extend_tests<jps::_flat_combining_bit_allocator>();
+    }
+
+    {
+        track_lengths_tests<jps::_reentrant_lock_free_bit_allocator>();
+        track_lengths_tests<jps::_single_threaded_bit_allocator>();
+        track_lengths_tests<jps::_flat_combining_bit_allocator>();
+    }
+
+    {
+        range_query_tests<uint8_t, jps::_reentrant_lock_free_bit_allocator>();
+        range_query_tests<uint64_t, jps::_reentrant_lock_free_bit_allocator>();
+        range_query_tests<uint64_t, jps::_single_threaded_bit_allocator>();
+        range_query_tests<uint64_t, jps::_flat_combining_bit_allocator>();
+    }
+
+    {
+        wide_word_tests();
+    }
+
+    {
+        owner_tags_tests<jps::_reentrant_lock_free_bit_allocator>();
+        owner_tags_tests<jps::_single_threaded_bit_allocator>();
+        owner_tags_tests<jps::_flat_combining_bit_allocator>();
+        owner_lanes_tests<uint8_t, uint8_t>();
+        owner_lanes_tests<uint16_t, uint16_t>();
+        owner_lanes_tests<uint32_t, uint32_t>();
+        owner_lanes_tests<uint64_t, uint64_t>();
+        owner_lanes_tests<jps::uint128_t, uint8_t>();
+    }
+
+    {
+        defragment_tests();
+    }
+
+    {
+        shared_tests();
+    }
+
+    {
+        adaptive_tests();
+    }
+
     return 0;
 }
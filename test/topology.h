@@ -0,0 +1,223 @@
+#pragma once
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+namespace jps {
+
+/**
+ * The policies to distribute worker threads over the logical CPUs of the machine.
+ */
+enum class affinity {
+    none,       // do not pin the workers at all
+    compact,    // fill all SMT siblings of a core before moving on to the next core, package, and node
+    scatter,    // round-robin over the packages first, then the cores, and the SMT siblings last
+    core,       // one worker per physical core, SMT siblings are left idle
+    numa,       // one worker per NUMA node
+};
+
+inline const char* to_string( affinity a ) {
+    switch( a ) {
+        case affinity::none:    return "none";
+        case affinity::compact: return "compact";
+        case affinity::scatter: return "scatter";
+        case affinity::core:    return "core";
+        case affinity::numa:    return "numa";
+    }
+    return "?";
+}
+
+inline affinity affinity_from_string( const std::string& s ) {
+    for( auto a: { affinity::none, affinity::compact, affinity::scatter, affinity::core, affinity::numa })
+        if( s == to_string( a ))
+            return a;
+    throw std::invalid_argument( "unknown affinity policy: " + s );
+}
+
+
+class topology {
+public:
+    struct cpu {
+        unsigned id;
+        unsigned core;
+        unsigned package;
+        unsigned node;
+        unsigned smt;       // index of this cpu among the SMT siblings of its core
+    };
+
+    /**
+     * Detect the topology of the logical CPUs this process may run on.
+     *
+     * On Linux, the topology is read from sysfs. Everywhere else (or if sysfs is not available), each of the
+     * `std::thread::hardware_concurrency()` CPUs is considered a core of its own on a single package and node.
+     */
+    static topology detect() {
+        topology t;
+#ifdef __linux__
+        namespace fs = std::filesystem;
+
+        cpu_set_t allowed;
+        CPU_ZERO( &allowed );
+        const bool have_mask = sched_getaffinity( 0, sizeof( allowed ), &allowed ) == 0;
+
+        std::error_code ec;
+        for( const auto& entry: fs::directory_iterator( "/sys/devices/system/cpu", ec )) {
+            const auto name = entry.path().filename().string();
+            if( name.size() <= 3 || name.compare( 0, 3, "cpu" ) != 0 ||
+                !std::all_of( name.begin()+3, name.end(), []( char c ) { return c >= '0' && c <= '9'; } ))
+                continue;
+
+            cpu c{ unsigned( std::stoul( name.substr( 3 ))), 0, 0, 0, 0 };
+            if( have_mask && !CPU_ISSET( c.id, &allowed ))
+                continue;
+
+            c.core = _read_id( entry.path() / "topology" / "core_id", c.id );
+            c.package = _read_id( entry.path() / "topology" / "physical_package_id", 0 );
+            for( const auto& sub: fs::directory_iterator( entry.path(), ec )) {
+                const auto sub_name = sub.path().filename().string();
+                if( sub_name.size() > 4 && sub_name.compare( 0, 4, "node" ) == 0 )
+                    c.node = unsigned( std::stoul( sub_name.substr( 4 )));
+            }
+            t.cpus_.push_back( c );
+        }
+#endif
+        if( t.cpus_.empty() ) {
+            const auto n = std::max( 1u, std::thread::hardware_concurrency() );
+            for( auto i = 0u; i < n; ++i )
+                t.cpus_.push_back( { i, i, 0, 0, 0 } );
+        }
+
+        // enumerate the SMT siblings of each core
+        std::sort( t.cpus_.begin(), t.cpus_.end(), []( const cpu& a, const cpu& b ) {
+            return std::tie( a.node, a.package, a.core, a.id ) < std::tie( b.node, b.package, b.core, b.id );
+        } );
+        for( auto i = 1ul; i < t.cpus_.size(); ++i ) {
+            const auto& p = t.cpus_[i-1];
+            auto& c = t.cpus_[i];
+            if( p.package == c.package && p.core == c.core )
+                c.smt = p.smt+1;
+        }
+
+        return t;
+    }
+
+    [[nodiscard]] const std::vector<cpu>& cpus() const { return cpus_; }
+    [[nodiscard]] size_t n_cpus() const { return cpus_.size(); }
+    [[nodiscard]] size_t n_cores() const { return _count( []( const cpu& c ) { return c.smt == 0; } ); }
+    [[nodiscard]] size_t n_packages() const { return _distinct( &cpu::package ); }
+    [[nodiscard]] size_t n_nodes() const { return _distinct( &cpu::node ); }
+
+    /**
+     * Return the number of workers a particular policy can place without oversubscribing a CPU.
+     */
+    [[nodiscard]] size_t max_workers( affinity a ) const {
+        switch( a ) {
+            case affinity::core: return n_cores();
+            case affinity::numa: return n_nodes();
+            default:             return n_cpus();
+        }
+    }
+
+    /**
+     * Return the CPUs to pin the workers to in the order of the worker ids. Worker `i` shall be pinned to
+     * `placement( a )[i % placement( a ).size()]`. For `affinity::none` the result is empty.
+     */
+    [[nodiscard]] std::vector<unsigned> placement( affinity a ) const {
+        std::vector<cpu> order;
+
+        switch( a ) {
+            case affinity::none:
+                return {};
+
+            case affinity::compact:
+                order = cpus_;
+                break;
+
+            case affinity::scatter: {
+                // rank the cores within each package and interleave the packages
+                std::map<std::pair<unsigned, unsigned>, unsigned> core_rank;
+                std::map<unsigned, unsigned> n_ranked;
+                for( const auto& c: cpus_ )
+                    if( core_rank.emplace( std::make_pair( c.package, c.core ), n_ranked[c.package] ).second )
+                        ++n_ranked[c.package];
+
+                order = cpus_;
+                std::stable_sort( order.begin(), order.end(), [&]( const cpu& x, const cpu& y ) {
+                    const auto rx = core_rank[{ x.package, x.core }];
+                    const auto ry = core_rank[{ y.package, y.core }];
+                    return std::tie( x.smt, rx, x.package ) < std::tie( y.smt, ry, y.package );
+                } );
+                break;
+            }
+
+            case affinity::core:
+                std::copy_if( cpus_.begin(), cpus_.end(), std::back_inserter( order ),
+                              []( const cpu& c ) { return c.smt == 0; } );
+                break;
+
+            case affinity::numa:
+                for( const auto& c: cpus_ )
+                    if( order.empty() || order.back().node != c.node )
+                        order.push_back( c );
+                break;
+        }
+
+        std::vector<unsigned> ids;
+        ids.reserve( order.size() );
+        for( const auto& c: order )
+            ids.push_back( c.id );
+        return ids;
+    }
+
+private:
+    static unsigned _read_id( const std::filesystem::path& p, unsigned fallback ) {
+        std::ifstream in( p );
+        long id;
+        if( in >> id && id >= 0 )
+            return unsigned( id );
+        return fallback;
+    }
+    template<typename Pred>
+    size_t _count( Pred pred ) const {
+        return std::count_if( cpus_.begin(), cpus_.end(), pred );
+    }
+    size_t _distinct( unsigned cpu::*field ) const {
+        std::vector<unsigned> v;
+        for( const auto& c: cpus_ )
+            v.push_back( c.*field );
+        std::sort( v.begin(), v.end() );
+        return std::unique( v.begin(), v.end() ) - v.begin();
+    }
+
+    std::vector<cpu> cpus_;
+};
+
+
+/**
+ * Pin the calling thread to a logical CPU. Returns false if pinning is not supported or failed.
+ */
+inline bool pin_this_thread( [[maybe_unused]] unsigned cpu_id ) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( cpu_id, &set );
+    return pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) == 0;
+#else
+    return false;
+#endif
+}
+
+}